@@ -0,0 +1,101 @@
+#ifndef BIT_GRID_HPP
+#define BIT_GRID_HPP
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace scarab {
+
+// Grid of bits packed 64 cells to a word, bit i % 64 of word i / 64 in each
+// row.  Rows start on a new word so that runs of cells in a row can be tested
+// a word at a time.
+class BitGrid {
+public:
+  BitGrid() : size_x_(0), size_y_(0), words_x_(0) { }
+
+  // Resize to size_x by size_y cells, all cleared
+  void resize(int size_x, int size_y) {
+    size_x_ = size_x;
+    size_y_ = size_y;
+    words_x_ = (size_x + 63) / 64;
+    words_.assign(size_t(words_x_) * size_y, 0);
+  }
+  // Resize to size_x by size_y cells copied from words, wordsX() per row
+  void assign(int size_x, int size_y, const uint64_t *words) {
+    size_x_ = size_x;
+    size_y_ = size_y;
+    words_x_ = (size_x + 63) / 64;
+    words_.assign(words, words + size_t(words_x_) * size_y);
+  }
+  void clear() {
+    size_x_ = size_y_ = words_x_ = 0;
+    std::vector<uint64_t>().swap(words_);
+  }
+
+  bool empty() const { return words_.empty(); }
+  int sizeX() const { return size_x_; }
+  int sizeY() const { return size_y_; }
+  size_t bytes() const { return words_.size() * sizeof(uint64_t); }
+
+  int wordsX() const { return words_x_; }
+  // All words, row after row
+  const uint64_t* words() const { return words_.empty() ? NULL : &words_[0]; }
+  // Words of row j, cell i in bit i % 64 of word i / 64
+  const uint64_t* row(int j) const { return &words_[j * words_x_]; }
+
+  bool get(int i, int j) const {
+    return (words_[j * words_x_ + (i >> 6)] >> (i & 63)) & 1;
+  }
+  void set(int i, int j, bool value) {
+    uint64_t &word = words_[j * words_x_ + (i >> 6)];
+    uint64_t bit = uint64_t(1) << (i & 63);
+    word = value ? word | bit : word & ~bit;
+  }
+
+  // Replace the bits of word w of row j selected by mask with those of bits
+  void setBits(int j, int w, uint64_t mask, uint64_t bits) {
+    uint64_t &word = words_[j * words_x_ + w];
+    word = (word & ~mask) | (bits & mask);
+  }
+
+  // True if all of cells [min_i, max_i) in row j are set
+  bool rowAll(int j, int min_i, int max_i) const {
+    if (min_i >= max_i) {
+      return true;
+    }
+    const uint64_t *row = &words_[j * words_x_];
+    int first = min_i >> 6, last = (max_i - 1) >> 6;
+    uint64_t first_mask = ~uint64_t(0) << (min_i & 63);
+    uint64_t last_mask = ~uint64_t(0) >> (63 - ((max_i - 1) & 63));
+    if (first == last) {
+      uint64_t mask = first_mask & last_mask;
+      return (row[first] & mask) == mask;
+    }
+    if ((row[first] & first_mask) != first_mask) {
+      return false;
+    }
+    for (int k = first + 1; k < last; ++k) {
+      if (row[k] != ~uint64_t(0)) {
+        return false;
+      }
+    }
+    return (row[last] & last_mask) == last_mask;
+  }
+  // True if all cells in [min_i, max_i) x [min_j, max_j) are set
+  bool rectAll(int min_i, int min_j, int max_i, int max_j) const {
+    for (int j = min_j; j < max_j; ++j) {
+      if (!rowAll(j, min_i, max_i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  int size_x_, size_y_, words_x_;
+  std::vector<uint64_t> words_;
+};
+
+} // end namespace scarab
+#endif
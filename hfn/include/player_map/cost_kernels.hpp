@@ -0,0 +1,48 @@
+#ifndef COST_KERNELS_HPP
+#define COST_KERNELS_HPP
+
+#include <stdint.h>
+
+namespace scarab {
+
+// Cost of a cell as computed by OccupancyMap::updateCosts(), in single
+// precision:
+//   infinite if lethal, that is occupied or occ_dist code <= lethal_dist
+//   prob_factor * occ_prob, or unknown_prob_cost if occ_prob is out of
+//     [0, 100], plus
+//   dist_factor * (1 - (occ_dist - lethal_occ_dist) * inv_dist_range)
+// where occ_dist is scale * sqrt(code), or max_occ_dist for MAP_DIST_MAX.
+struct CostParams {
+  bool all_lethal;      // every cell is lethal
+  int lethal_dist;      // largest lethal occ_dist code, below MAP_DIST_MAX
+  float scale;
+  float max_occ_dist;
+  float lethal_occ_dist;
+  float inv_dist_range; // 1 / (max_occ_dist - lethal_occ_dist)
+  float prob_factor;
+  float unknown_prob_cost;
+  float dist_factor;
+};
+
+// Parameters for a map of the given scale whose distances were computed up to
+// map_max_occ_dist, for costs over [lethal_occ_dist, max_occ_dist] as given
+// to OccupancyMap::updateCSpace()
+CostParams makeCostParams(double scale, double map_max_occ_dist,
+                          double max_occ_dist, double lethal_occ_dist,
+                          double cost_occ_prob, double cost_occ_dist);
+
+// Compute the costs of n consecutive cells.  Returns the largest finite
+// cost, or -infinity if there is none.  Uses AVX2 where the CPU supports it;
+// the results are identical either way.
+float computeCosts(const CostParams &params, const uint8_t *occ_state,
+                   const int8_t *occ_prob, const uint16_t *occ_dist, int n,
+                   float *cost);
+// Scalar version of computeCosts(), always available
+float computeCostsScalar(const CostParams &params, const uint8_t *occ_state,
+                         const int8_t *occ_prob, const uint16_t *occ_dist,
+                         int n, float *cost);
+// True if computeCosts() runs the AVX2 kernel on this CPU
+bool haveAvx2CostKernel();
+
+} // end namespace scarab
+#endif
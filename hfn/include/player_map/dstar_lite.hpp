@@ -0,0 +1,61 @@
+#ifndef DSTAR_LITE_HPP
+#define DSTAR_LITE_HPP
+
+#include <utility>
+#include <vector>
+
+#include "player_map/open_list.hpp"
+#include "player_map/rosmap.hpp"
+
+namespace scarab {
+
+// D* Lite search over an OccupancyMap, using the same moves and costs as
+// OccupancyMap::astar().  The search runs backwards from the goal and is kept
+// between calls, so replanning to the same goal after the robot moves or the
+// map is updated in place only repairs the affected part of the search.
+class DStarLite {
+public:
+  // map must outlive this planner
+  explicit DStarLite(const OccupancyMap *map);
+
+  // Plan from (startx, starty) to (stopx, stopy).  Returns an empty path if
+  // the goal is unreachable.
+  Path plan(double startx, double starty, double stopx, double stopy,
+            bool allow_unknown = false);
+  // Discard the search, e.g. to free memory
+  void reset();
+
+  // Number of cells expanded by the last call to plan()
+  int numExpanded() const { return expanded_; }
+
+private:
+  typedef std::pair<float, float> Key;
+
+  void initialize(int start, int stop, bool allow_unknown);
+  Key calculateKey(int index) const;
+  static bool keyLess(const Key &a, const Key &b);
+  float heuristic(int from, int to) const;
+  // Cost of moving into cell to from its neighbor in direction k, see
+  // neighbor_di and neighbor_dj
+  float moveCost(int to, int k) const;
+  float computeRhs(int index) const;
+  // Queue index if it is inconsistent, otherwise remove it
+  void updateQueue(int index);
+  // Recompute rhs for the neighbors of index, after the cost of moving into
+  // index changed
+  void updateNeighbors(int index);
+  void computeShortestPath();
+
+  const OccupancyMap *map_;
+  unsigned map_version_;
+  int size_x_, size_y_;
+  int start_, stop_;
+  bool allow_unknown_;
+  float km_;
+  std::vector<float> g_, rhs_;
+  IndexedHeap<Key, 4> queue_;
+  int expanded_;
+};
+
+} // end namespace scarab
+#endif
@@ -28,6 +28,8 @@
 #ifndef MAP_H
 #define MAP_H
 
+#include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -42,7 +44,8 @@ struct _rtk_fig_t;
 #define MAP_WIFI_MAX_LEVELS 8
 
 
-// Description for a single map cell.
+// Description for a single map cell.  Maps store each field in a separate
+// plane (see map_t); this struct holds a copy of the values of one cell.
 typedef struct {
   enum {
     OCCUPIED,
@@ -68,6 +71,14 @@ typedef struct {
 } map_cell_t;
 
 
+// Stored distance for cells at least max_occ_dist from the nearest occupied
+// cell
+#define MAP_DIST_MAX 0xFFFF
+
+// Largest distance (in cells) that can be stored in the occ_dist plane
+#define MAP_DIST_MAX_CELLS 255
+
+
 // Description for a map
 typedef struct {
   // Map origin; the map is a viewport onto a conceptual larger map.
@@ -79,8 +90,26 @@ typedef struct {
   // Map dimensions (number of cells)
   int size_x, size_y;
 
-  // The map data, stored as a grid
-  map_cell_t *cells;
+  // The map data, stored as a grid with one plane per cell field
+  void *data;
+
+  // File mapping holding data if the map came from map_open(), otherwise
+  // NULL and data is allocated with malloc()
+  void *mapping;
+  size_t mapping_size;
+
+  // Occupancy state of each cell (OCCUPIED, UNKNOWN or FREE)
+  uint8_t *occ_state;
+
+  // Probability of occupancy (0-100, -1 = unknown)
+  int8_t *occ_prob;
+
+  // Squared distance (in cells) to the nearest occupied cell, or
+  // MAP_DIST_MAX if it is at least max_occ_dist away
+  uint16_t *occ_dist;
+
+  // Cost of traversing each cell
+  float *cost;
 
   // Max distance at which we care about obstacles, for constructing
   // likelihood field
@@ -100,18 +129,91 @@ map_t *map_alloc(void);
 // Destroy a map
 void map_free(map_t *map);
 
-// Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa);
+// Allocate the cell planes for a map of size_x by size_y cells
+int map_alloc_cells(map_t *map, int size_x, int size_y);
+
+// Get the index of the cell at the given point, or -1 if it is off the map
+int map_get_index(const map_t *map, double ox, double oy);
+
+// Get a copy of the cell at the given point.  Returns 0 if the point is off
+// the map.
+int map_get_cell(const map_t *map, double ox, double oy, map_cell_t *cell);
 
 // Load an occupancy map
 int map_load_occ(map_t *map, const char *filename, double scale, int negate);
 
+// Version of the format written by map_save()
+#define MAP_FILE_VERSION 1
+
+// Header of the files written by map_save().  The cell planes follow at
+// header_size bytes, in the layout of map_alloc_cells(), then extra_size
+// bytes of data for the caller.
+typedef struct {
+  char magic[8];          // "PMAPCSPC"
+  uint32_t version;       // MAP_FILE_VERSION
+  uint32_t byte_order;    // 0x01020304 as stored by the writer
+  uint64_t header_size;
+  uint64_t extra_size;
+  int32_t size_x, size_y;
+
+  // Parameters the occupancy states and costs were computed with, only
+  // stored for the reader to check
+  int32_t free_threshold, occupied_threshold;
+
+  double origin_x, origin_y, scale;
+  double max_occ_dist;
+  double lethal_occ_dist, cost_occ_prob, cost_occ_dist;
+} map_file_header_t;
+
+// Save the map with its cspace and costs, followed by header->extra_size
+// bytes from extra.  The parameters and extra_size are taken from header,
+// the rest of it is filled in.  Returns 0 on success.
+int map_save(const map_t *map, const char *filename, map_file_header_t *header,
+             const void *extra);
+
+// Write the map_save() contents to the current position of fd
+int map_write_fd(const map_t *map, int fd, map_file_header_t *header,
+                 const void *extra);
+
+// Load a map saved by map_save() by mapping the file copy on write, so that
+// cells are read on first use and changes stay in memory.  Fills in header
+// and points extra at the extra data, which stays mapped along with the
+// cells.  Returns 0 on success, -1 if the file cannot be read or is not a map
+// file of this version and byte order.
+int map_open(map_t *map, const char *filename, map_file_header_t *header,
+             const void **extra);
+
+// How map_open_fd() maps the cells
+enum {
+  MAP_OPEN_PRIVATE,      // copy on write, as map_open()
+  MAP_OPEN_SHARED_READ,  // read only, seeing changes made through fd
+  MAP_OPEN_SHARED_WRITE  // changes are written through to fd
+};
+
+// Load the map_save() contents found from offset in fd up to its end, as
+// map_open().  offset must be a multiple of the page size.
+int map_open_fd(map_t *map, int fd, size_t offset, int mode,
+                map_file_header_t *header, const void **extra);
+
 // Load a wifi signal strength map
 //int map_load_wifi(map_t *map, const char *filename, int index);
 
 // Update the cspace distances
 void map_update_cspace(map_t *map, double max_occ_dist);
 
+// Set the max_occ_dist used by map_update_cspace_region() without updating
+// any distances, e.g. before updating disjoint regions from several threads
+void map_set_max_occ_dist(map_t *map, double max_occ_dist);
+
+// Update the cspace distances of the cells in [min_i, max_i) x [min_j, max_j)
+// using the max_occ_dist of the last call to map_update_cspace() or
+// map_set_max_occ_dist().  Only writes the distances of those cells.
+void map_update_cspace_region(map_t *map, int min_i, int min_j,
+                              int max_i, int max_j);
+
+// Update the cspace distances with the original brute-force method
+void map_update_cspace_brute(map_t *map, double max_occ_dist);
+
 
 /**************************************************************************
  * Range functions
@@ -153,6 +255,22 @@ void map_draw_wifi(map_t *map, struct _rtk_fig_t *fig, int index);
 // Compute the cell index for the given map coords.
 #define MAP_INDEX(map, i, j) ((i) + (j) * map->size_x)
 
+// Get the distance to the nearest occupied cell for the given cell index
+static inline double map_occ_dist(const map_t *map, int index) {
+  uint16_t d = map->occ_dist[index];
+  return d == MAP_DIST_MAX ? map->max_occ_dist : map->scale * sqrt((double) d);
+}
+
+// Get a copy of the values of the cell at the given index
+static inline map_cell_t map_cell(const map_t *map, int index) {
+  map_cell_t cell;
+  cell.occ_state = map->occ_state[index];
+  cell.occ_prob = map->occ_prob[index];
+  cell.occ_dist = map_occ_dist(map, index);
+  cell.cost = map->cost[index];
+  return cell;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,190 @@
+#ifndef OPEN_LIST_HPP
+#define OPEN_LIST_HPP
+
+#include <set>
+#include <vector>
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace scarab {
+
+// Binary heap generalized to D children per node, indexed by cell so that
+// the key of a cell already in the heap can be changed in O(log n).
+template <typename Key, int D = 4>
+class IndexedHeap {
+public:
+  IndexedHeap() { }
+
+  // Allow cell indices in [0, ncells)
+  void resize(int ncells) {
+    clear();
+    pos_.assign(ncells, -1);
+  }
+
+  void clear() {
+    for (size_t i = 0; i < heap_.size(); ++i) {
+      pos_[heap_[i].second] = -1;
+    }
+    heap_.clear();
+  }
+
+  bool empty() const { return heap_.empty(); }
+  size_t size() const { return heap_.size(); }
+  bool contains(int index) const { return pos_[index] != -1; }
+  const Key& key(int index) const { return heap_[pos_[index]].first; }
+  const Key& topKey() const { return heap_.front().first; }
+  int top() const { return heap_.front().second; }
+
+  // Insert index, or change its key if it is already in the heap
+  void push(int index, const Key &key) {
+    int pos = pos_[index];
+    if (pos == -1) {
+      pos = heap_.size();
+      heap_.push_back(std::make_pair(key, index));
+      pos_[index] = pos;
+      siftUp(pos);
+    } else if (key < heap_[pos].first) {
+      heap_[pos].first = key;
+      siftUp(pos);
+    } else {
+      heap_[pos].first = key;
+      siftDown(pos);
+    }
+  }
+
+  int pop() {
+    int index = heap_.front().second;
+    remove(index);
+    return index;
+  }
+
+  void remove(int index) {
+    int pos = pos_[index];
+    pos_[index] = -1;
+    if (pos + 1 == int(heap_.size())) {
+      heap_.pop_back();
+      return;
+    }
+    int moved = heap_.back().second;
+    heap_[pos] = heap_.back();
+    heap_.pop_back();
+    pos_[moved] = pos;
+    siftUp(pos);
+    siftDown(pos_[moved]);
+  }
+
+private:
+  void siftUp(int pos) {
+    std::pair<Key, int> entry = heap_[pos];
+    while (pos > 0) {
+      int parent = (pos - 1) / D;
+      if (!(entry.first < heap_[parent].first)) {
+        break;
+      }
+      heap_[pos] = heap_[parent];
+      pos_[heap_[pos].second] = pos;
+      pos = parent;
+    }
+    heap_[pos] = entry;
+    pos_[entry.second] = pos;
+  }
+
+  void siftDown(int pos) {
+    std::pair<Key, int> entry = heap_[pos];
+    int n = heap_.size();
+    while (true) {
+      int first = D * pos + 1;
+      if (first >= n) {
+        break;
+      }
+      int best = first;
+      int last = first + D < n ? first + D : n;
+      for (int child = first + 1; child < last; ++child) {
+        if (heap_[child].first < heap_[best].first) {
+          best = child;
+        }
+      }
+      if (!(heap_[best].first < entry.first)) {
+        break;
+      }
+      heap_[pos] = heap_[best];
+      pos_[heap_[pos].second] = pos;
+      pos = best;
+    }
+    heap_[pos] = entry;
+    pos_[entry.second] = pos;
+  }
+
+  std::vector<std::pair<Key, int> > heap_;
+  std::vector<int> pos_;
+};
+
+// Priority queue of cell indices used as the open list of OccupancyMap's
+// searches.  Keys are non-negative.
+class OpenList {
+public:
+  virtual ~OpenList() { }
+
+  // Prepare for a search over ncells cells and empty the list
+  virtual void reset(int ncells) = 0;
+  virtual bool empty() const = 0;
+  // Insert index, or lower its key if it is already in the list
+  virtual void push(int index, float key) = 0;
+  // Remove and return the index with the smallest key.  Lists that do not
+  // support decrease-key may return an index more than once, in increasing
+  // key order; callers must skip indices that were already expanded.
+  virtual int pop(float *key) = 0;
+};
+
+// Balanced binary tree; decrease-key is an erase plus an insert
+class SetOpenList : public OpenList {
+public:
+  void reset(int ncells);
+  bool empty() const { return set_.empty(); }
+  void push(int index, float key);
+  int pop(float *key);
+
+private:
+  std::set<std::pair<float, int> > set_;
+  std::vector<float> keys_;  // key of each index in set_, or infinity
+};
+
+// Indexed 4-ary heap with decrease-key
+class HeapOpenList : public OpenList {
+public:
+  HeapOpenList() : ncells_(0) { }
+  void reset(int ncells);
+  bool empty() const { return heap_.empty(); }
+  void push(int index, float key);
+  int pop(float *key);
+
+private:
+  IndexedHeap<float, 4> heap_;
+  int ncells_;
+};
+
+// Radix heap over the bit patterns of the (non-negative) float keys.  Pushes
+// and pops are amortized O(1) for monotone searches such as Dijkstra and A*
+// with a consistent heuristic, whose keys never drop below the last key
+// popped.  Decrease-key is handled by inserting duplicates.
+class BucketOpenList : public OpenList {
+public:
+  BucketOpenList();
+  void reset(int ncells);
+  bool empty() const { return size_ == 0; }
+  void push(int index, float key);
+  int pop(float *key);
+
+private:
+  static const int NUM_BUCKETS = 33;
+  int bucket(uint32_t key) const;
+
+  std::vector<std::pair<uint32_t, int> > buckets_[NUM_BUCKETS];
+  uint32_t last_;
+  size_t size_;
+};
+
+} // end namespace scarab
+#endif
@@ -1,18 +1,26 @@
 #ifndef ROSMAP_HPP
 #define ROSMAP_HPP
 
+#include <list>
+#include <string>
 #include <vector>
 #include <set>
 
 #include <boost/scoped_array.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <nav_msgs/OccupancyGrid.h>
 
+#include "player_map/bit_grid.hpp"
+#include "player_map/cost_kernels.hpp"
 #include "player_map/map.h"
+#include "player_map/open_list.hpp"
 #include <Eigen/StdVector>
 namespace scarab {
 
@@ -20,31 +28,137 @@ typedef std::vector<Eigen::Vector2f, Eigen::aligned_allocator<Eigen::Vector2f> >
 
 double pathLength(const scarab::Path &path);
 
+// Convert a single occupancy grid value to a player map occupancy state
+inline uint8_t convertState(int8_t value,
+    const int free_threshold, const int occupied_threshold) {
+  if(0 <= value && value <= free_threshold) {
+    return map_cell_t::FREE;
+  } else if(occupied_threshold <= value && value <= 100) {
+    return map_cell_t::OCCUPIED;
+  } else {
+    return map_cell_t::UNKNOWN;
+  }
+}
+
+class SearchWorkspace;
+class SharedMapSegment;
+class TiledMap;
+
+// Completed single source search kept by OccupancyMap
+struct DistanceField {
+  enum { UNREACHED = 255 };
+  int source;
+  double max_occ_dist;
+  bool allow_unknown;
+  unsigned version;
+  std::vector<float> costs;  // infinite if unreachable
+  // Direction to the previous cell as 3 * (di + 1) + dj + 1, 4 at the source
+  // and UNREACHED if there is none
+  std::vector<uint8_t> prev;
+};
+
 class OccupancyMap {
 public:
+  // Open list implementation used by the graph searches
+  enum QueueType {
+    SET_QUEUE,   // std::set, decrease-key is an erase plus an insert
+    HEAP_QUEUE,  // indexed 4-ary heap with decrease-key
+    BUCKET_QUEUE // radix heap with lazy deletion
+  };
+
+  // Search used by plan()
+  enum PlannerType {
+    ASTAR_PLANNER,       // 8-connected A* over the cost map
+    JPS_PLANNER,         // jump point search, A* paths with fewer expansions
+    THETA_STAR_PLANNER,  // Theta* over jump points, any-angle paths
+    HIERARCHICAL_PLANNER // A* over blocks, then astar() near the coarse path
+  };
+
   OccupancyMap();
   ~OccupancyMap();
 
   static OccupancyMap* FromMapServer(const char *srv_name,
     const int free_threshold=0, const int occupied_threshold=100);
+  // Map with its cspace and costs loaded from a file written by save(),
+  // mapped into memory rather than read and recomputed, or NULL if the file
+  // cannot be loaded.  Compare the thresholds and cspace parameters with
+  // those expected before using it.
+  static OccupancyMap* FromFile(const char *filename);
+  // Write the map, cspace and costs for FromFile().  Returns false if the
+  // cspace has not been calculated or the file cannot be written.
+  bool save(const char *filename) const;
+
+  // Keep the map, cspace and costs in the POSIX shared memory segment name
+  // (e.g. "/scarab_map") for other processes to Attach() to, and write all
+  // later changes through to it.  Until the cspace is calculated, and while
+  // it is recalculated for a new map, other processes keep the last one.
+  // Returns false if the segment could not be created yet.
+  bool share(const char *name);
+  // Map attached read only to a segment shared by another process, or NULL
+  // if there is none.  The cells are used in place; only the blocks and bit
+  // layers derived from them are copied.  setMap() and updateCSpace() fail.
+  static OccupancyMap* Attach(const char *name);
+  // Pick up changes made by the owner of an attached map, including a new
+  // map.  Returns true if the map changed.  Queries running while the owner
+  // writes may see a mix of old and new cells, as for a map updated between
+  // them; the next sync() brings everything up to date.
+  bool sync();
 
   void setMap(map_t *map);
   void setMap(const nav_msgs::OccupancyGrid &grid);
+  // Plan over cells [min_i, max_i) x [min_j, max_j) of a tiled map, copying
+  // its cspace and costs if they were calculated
+  void setMap(const TiledMap &tiles, int min_i, int min_j, int max_i,
+              int max_j);
   void updateCSpace(double max_occ_dist, double lethal_occ_dist,
                     double cost_occ_prob = 0.0, double cost_occ_dist = 0.0);
 
-  nav_msgs::OccupancyGrid getCSpace();
-  nav_msgs::OccupancyGrid getCostMap();
+  // The cspace and costs as grids, kept until the map changes.  The cost grid
+  // is only converted where costs changed after an in place update.
+  const nav_msgs::OccupancyGrid& getCSpace();
+  const nav_msgs::OccupancyGrid& getCostMap();
+  // Bring getCostMap() up to date and return the tiles of tile_size cells
+  // that changed since it was last brought up to date.  Returns false if the
+  // whole grid was converted instead, because the map was replaced, changed
+  // more than once or the costs were rescaled.
+  bool getCostMapUpdates(int tile_size,
+                         std::vector<map_msgs::OccupancyGridUpdate> *updates);
 
   double minX();
   double minY();
   double maxX();
   double maxY();
 
+  // Incremented whenever the map, cspace or costs change
+  unsigned version() const { return version_; }
+  // Cells whose cost or unknown state changed going from version to
+  // version(), or NULL if that was not a single in place update (see
+  // setMap()), in which case anything may have changed
+  const std::vector<int>* changedCells(unsigned version) const;
+
+  const map_t* map() const { return map_; }
+  // True if a path may enter cell (i, j)
+  bool traversable(int i, int j, bool allow_unknown) const {
+    if (!MAP_VALID(map_, i, j)) {
+      return false;
+    }
+    if (!passable_.empty()) {
+      return passable_.get(i, j) && (allow_unknown || known_.get(i, j));
+    }
+    int index = MAP_INDEX(map_, i, j);
+    return !isinf(map_->cost[index]) &&
+      (allow_unknown || map_->occ_state[index] != map_cell_t::UNKNOWN);
+  }
+
   double lethalOccDist() const { return lethal_occ_dist_; }
   double maxOccDist() const { return max_occ_dist_; }
+  double costOccProb() const { return cost_occ_prob_; }
+  double costOccDist() const { return cost_occ_dist_; }
+  int freeThreshold() const { return max_free_threshold_; }
+  int occupiedThreshold() const { return min_occupied_threshold_; }
 
-  const map_cell_t* getCell(double x, double y) const;
+  // Copy the cell at (x, y) into cell.  Returns false if it is off the map.
+  bool getCell(double x, double y, map_cell_t *cell) const;
   int coordIndex(double x, double y) const {
     int xi = MAP_GXWX(map_, x);
     int yi = MAP_GYWY(map_, y);
@@ -57,18 +171,83 @@ public:
 
   int numX() { return map_->size_x; }
   int numY() { return map_->size_y; }
-  const map_cell_t* at(int xi, int yi) const {
-    return map_->cells + MAP_INDEX(map_, xi, yi);
+  map_cell_t at(int xi, int yi) const {
+    return map_cell(map_, MAP_INDEX(map_, xi, yi));
   }
 
   // True if cell is free and far away from obstacles
   bool safePoint(double x, double y) const; // Use lethalOccDist()
   bool safePoint(double x, double y, double occ_dist) const;
 
+  // True if every cell crossed by the segment is free, known unless
+  // allow_unknown is set, and at least max_occ_dist from obstacles.  The
+  // cells are traversed exactly, each visited once, including both ends.
   bool lineOfSight(double x1, double y1, double x2, double y2,
                    double max_occ_dist = 0.0, bool allow_unknown = false) const;
+  // Previous lineOfSight(), sampling the segment every half cell, which can
+  // step over the corners of cells.  Kept for comparison in map_benchmark.
+  bool lineOfSightSampled(double x1, double y1, double x2, double y2,
+                          double max_occ_dist = 0.0,
+                          bool allow_unknown = false) const;
+  // True if every cell overlapping the rectangle with corners (x1, y1) and
+  // (x2, y2) is free, known unless allow_unknown is set, and at least
+  // max_occ_dist from obstacles
+  bool regionClear(double x1, double y1, double x2, double y2,
+                   double max_occ_dist = 0.0, bool allow_unknown = false) const;
+
+  // Keep a layer of bits marking the cells that are not occupied and at least
+  // margin from obstacles, updated along with the costs.  safePoint(),
+  // nearestPoint(), lineOfSight() and regionClear() for that margin then
+  // only test bits instead of looking up distances.
+  void addMarginLayer(double margin);
+  // Layer added for margin, or NULL if there is none or the costs have not
+  // been computed yet
+  const BitGrid* marginLayer(double margin) const;
+
+  // The searches below keep their state in a SearchWorkspace.  The versions
+  // taking one are const and only touch that workspace, so threads with a
+  // workspace each may search a shared map at once as long as it doesn't
+  // change meanwhile.  The others use a workspace owned by the map.
   Path astar(double x1, double y1, double x2, double y2,
              double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path astar(SearchWorkspace *ws, double x1, double y1, double x2, double y2,
+             double max_occ_dist = 0.0, bool allow_unknown = false) const;
+  // Shortest path ignoring cell costs, through the cells astar() would use
+  Path jps(double x1, double y1, double x2, double y2,
+           double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path jps(SearchWorkspace *ws, double x1, double y1, double x2, double y2,
+           double max_occ_dist = 0.0, bool allow_unknown = false) const;
+  // Any-angle path ignoring cell costs, usually shorter than the one from
+  // jps(); only contains the corners
+  Path thetaStar(double x1, double y1, double x2, double y2,
+                 double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path thetaStar(SearchWorkspace *ws, double x1, double y1,
+                 double x2, double y2, double max_occ_dist = 0.0,
+                 bool allow_unknown = false) const;
+  // Plan over blocks of cells first, then run astar() restricted to the blocks
+  // near the coarse path, so long plans only explore a corridor of the map.
+  // Paths may be slightly longer than those from astar().
+  Path hierarchicalAstar(double x1, double y1, double x2, double y2,
+                         double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path hierarchicalAstar(SearchWorkspace *ws, double x1, double y1,
+                         double x2, double y2, double max_occ_dist = 0.0,
+                         bool allow_unknown = false) const;
+  // False if no path over the blocks of hierarchicalAstar() joins the cells
+  // of (x1, y1) and (x2, y2), so that no path in the map does either; true if
+  // one may.  Costs a search over blocks, not cells.
+  bool blocksConnect(double x1, double y1, double x2, double y2,
+                     bool allow_unknown = false) const;
+  // Plan with the given search.  JPS and Theta* fall back to astar() unless
+  // the cost factors passed to updateCSpace() are zero.
+  Path plan(PlannerType type, double x1, double y1, double x2, double y2,
+            double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path plan(SearchWorkspace *ws, PlannerType type, double x1, double y1,
+            double x2, double y2, double max_occ_dist = 0.0,
+            bool allow_unknown = false) const;
+  // Center of the closest cell within 5 m of (x, y) that is free, has finite
+  // cost and is at least max_occ_dist from obstacles, or (x, y) itself if its
+  // cell is.
+  // Returns false if there is none.
   bool nearestPoint(double x, double y, double max_occ_dist,
                     double *out_x, double *out_y) const;
   // TODO: Unify these two APIs
@@ -77,21 +256,60 @@ public:
   const Path& prepareShortestPaths(double x, double y, double min_distance,
                                    double max_distance, double max_occ_dist,
                                    bool allow_unknown = false);
+  const Path& prepareShortestPaths(SearchWorkspace *ws, double x, double y,
+                                   double min_distance, double max_distance,
+                                   double max_occ_dist,
+                                   bool allow_unknown = false) const;
   // Get the path whose endpoint is ind from last call to prepareShortestPaths()
   Path buildShortestPath(int ind);
+  Path buildShortestPath(const SearchWorkspace &ws, int ind) const;
 
   // Calculate single source shortest paths to all endpoints
   // Returns a vector, element at index i is true if path from dests[i] exists
   // Use buildShortestPath to construct path; index matches point in dests
+  // The result is cached, so repeating the call for the same source and
+  // arguments does not search again until the map changes.
   void prepareAllShortestPaths(double x, double y, double max_occ_dist,
                                bool allow_unknown = false);
+  void prepareAllShortestPaths(SearchWorkspace *ws, double x, double y,
+                               double max_occ_dist,
+                               bool allow_unknown = false) const;
   // Get shortest path
   Path shortestPath(double x, double y);
+  Path shortestPath(const SearchWorkspace &ws, double x, double y) const;
+  // Path from (x1, y1) to (x2, y2) read from the cached shortest paths rooted
+  // at (x2, y2), which are computed first if needed.  Answers repeated
+  // queries to fixed goals in time proportional to the path length.
+  Path cachedPath(double x1, double y1, double x2, double y2,
+                  double max_occ_dist = 0.0, bool allow_unknown = false);
+  Path cachedPath(SearchWorkspace *ws, double x1, double y1,
+                  double x2, double y2, double max_occ_dist = 0.0,
+                  bool allow_unknown = false) const;
+  // Memory used by cached shortest paths before the least recently used are
+  // dropped, in bytes
+  void setFieldCacheSize(size_t bytes);
+  // Costs of the shortest paths from every source to every target, as
+  // astar() would find them, in costs[s * targets.size() + t]; infinite if
+  // unreachable.  Runs one search per source, stopping once every target is
+  // reached, with the sources spread over nthreads threads (0 for one per
+  // core).  If paths is not NULL it receives the paths in the same order.
+  void costMatrix(const Path &sources, const Path &targets,
+                  double max_occ_dist, bool allow_unknown, int nthreads,
+                  std::vector<float> *costs,
+                  std::vector<Path> *paths = NULL) const;
 
   void setThresholds(int free, int occ);
   void setCostFactors(double occ_prob, double occ_dist);
 
+  // Select the open list used by the map's own workspace
+  void setQueueType(QueueType type);
+  QueueType queueType() const;
+  // Number of cells expanded by the last search in the map's own workspace
+  int numExpanded() const;
+
 private:
+  friend class SearchWorkspace;
+
   struct Node {
     Node() {}
     Node(const std::pair<int, int> &c, float d, float h) :
@@ -101,30 +319,199 @@ private:
     float heuristic;
   };
 
-  struct NodeCompare {
-    bool operator()(const Node &lnode, const Node &rnode) {
-      return make_pair(lnode.heuristic, lnode.coord) <
-        make_pair(rnode.heuristic, rnode.coord);
-    }
-  };
+  // Apply grid to the current map in place, only recomputing the cspace
+  // around cells that changed.  Returns false if the map geometry differs or
+  // the cspace has not been computed yet.
+  bool updateMap(const nav_msgs::OccupancyGrid &grid);
+  // Recompute costs in the region, appending cells whose cost changed to
+  // changed if it is not NULL.  If cspace is set, the distances in the region
+  // are recomputed first.  Large regions are split into bands of rows
+  // computed by separate threads.
+  void updateCosts(int min_i, int min_j, int max_i, int max_j,
+                   std::vector<int> *changed = NULL, bool cspace = false);
+  CostParams costParams() const;
+  // Compute the costs of a band of the updateCosts() region, appending
+  // changed cells to changed if it is not NULL and storing the largest finite
+  // cost in max_cost
+  void updateCostBand(const CostParams &params, bool cspace,
+                      int min_i, int min_j, int max_i, int max_j,
+                      std::vector<int> *changed, float *max_cost);
+  void mapChanged(bool incremental);
+  // Blocks and bit layers derived from the cells, as save() stores them after
+  // the cells: packDerived() fills data, writeDerived() writes to p, sized
+  // the same, and readDerived() replaces them unless their layout differs.
+  void packDerived(std::vector<char> *data) const;
+  void writeDerived(char *p) const;
+  bool readDerived(const char *p, size_t size);
+  // Header of a map file with the parameters of the cspace, and the reverse
+  void fileHeader(map_file_header_t *header) const;
+  void loadHeader(const map_file_header_t &header);
+  // Create the segment for share() if the cspace is up to date
+  bool shareCSpace();
+  // Owner: start a change to the shared cells, ended by mapChanged()
+  void beginSharedWrite();
+  // Owner: update the shared header and derived data after a change
+  void publishShared();
+  // Reader: copy the parameters and derived data from the segment
+  void loadShared();
+  // True, with an error, if the map is attached read only
+  bool sharedReadOnly(const char *caller) const;
+  // Update cost_grid_ for version_.  Returns true if only the cells that
+  // changed since its previous version were converted.
+  bool updateCostGrid();
+  // Recompute the block edges used by hierarchicalAstar() for all blocks
+  // affected by the region
+  void updateBlocks(int min_i, int min_j, int max_i, int max_j);
+  // Recompute the edges of blocks [min_bi, max_bi] x [min_bj, max_bj]
+  void updateBlockRows(int min_bi, int min_bj, int max_bi, int max_bj);
+  // A* over blocks from the block of cell (starti, startj) to that of
+  // (stopi, stopj), leaving the previous block of each in block_prev.
+  // Returns false if the stop block is not reached.
+  bool searchBlocks(int starti, int startj, int stopi, int stopj,
+                    bool allow_unknown, std::vector<int> *block_prev) const;
+  // lineOfSight() that also requires every cell crossed to be traversable(),
+  // as the moves of the grid searches do, for the any-angle shortcuts of
+  // Theta*.  The margin alone lets through cells right at the lethal
+  // distance, whose cost is infinite.
+  bool lineOfTravel(double x1, double y1, double x2, double y2,
+                    double max_occ_dist, bool allow_unknown) const;
+  bool traceLine(double x1, double y1, double x2, double y2,
+                 double max_occ_dist, bool allow_unknown,
+                 bool finite_cost) const;
+  // Sort the cell offsets searched by nearestPoint() for the map scale
+  void updateNearestOffsets();
+  // Drop the bits of all layers, keeping the margins
+  void clearLayers();
+  // Recompute the bit layers in the region, or everywhere if their size is
+  // out of date
+  void updateLayers(int min_i, int min_j, int max_i, int max_j);
+  void updateMarginLayer(double margin, BitGrid *layer,
+                         int min_i, int min_j, int max_i, int max_j);
+
+  void initializeSearch(SearchWorkspace *ws, double startx,
+                        double starty) const;
+  // Check arguments and initialize an A*-style search between two points.
+  // Returns false if there is no map.
+  bool startPointSearch(SearchWorkspace *ws, const char *caller,
+                        double startx, double starty,
+                        double stopx, double stopy, double max_occ_dist) const;
+  // Jump point search from the initialized start to the stop cell.  If
+  // los_occ_dist is non-negative, run Theta* over the jump points instead,
+  // connecting each successor to its grandparent when lineOfSight() allows.
+  bool jumpPointSearch(SearchWorkspace *ws, double los_occ_dist,
+                       bool allow_unknown) const;
+  // Jump from (i, j) in direction (di, dj) to the next jump point
+  bool jump(const SearchWorkspace &ws, int i, int j, int di, int dj,
+            bool allow_unknown, int *jump_i, int *jump_j) const;
+  bool nextNode(SearchWorkspace *ws, double max_occ_dist, Node *curr_node,
+                bool allow_unknown) const;
+  void addNeighbors(SearchWorkspace *ws, const Node &node,
+                    double max_occ_dist, bool allow_unknown) const;
+  void buildPath(const SearchWorkspace &ws, int i, int j, Path *path) const;
 
-  void initializeSearch(double startx, double starty);
-  bool nextNode(double max_occ_dist, Node *curr_node, bool allow_unknown);
-  void addNeighbors(const Node &node, double max_occ_dist, bool allow_unknown);
-  void buildPath(int i, int j, Path *path);
+  // Cached field matching the arguments, moved to the front of the cache, or
+  // NULL if there is none
+  boost::shared_ptr<const DistanceField> findField(int source,
+                                                   double max_occ_dist,
+                                                   bool allow_unknown) const;
+  // Copy the finished search in ws into the cache
+  boost::shared_ptr<const DistanceField> storeField(const SearchWorkspace &ws,
+                                                    double max_occ_dist,
+                                                    bool allow_unknown) const;
+  // Append the path from (i, j) back to the source of field
+  void fieldPath(const DistanceField &field, int i, int j, Path *path) const;
+
+  // Run the costMatrix() searches for sources first, first + step, ...
+  void costMatrixWorker(size_t first, size_t step, const Path &sources,
+                        const std::vector<int> &targets,
+                        const std::vector<uint8_t> &is_target,
+                        bool allow_unknown, std::vector<float> *costs,
+                        std::vector<Path> *paths) const;
 
   map_t *map_;
+  int max_free_threshold_, min_occupied_threshold_;
+  double max_occ_dist_, lethal_occ_dist_;
+  double cost_occ_prob_, cost_occ_dist_;
+  unsigned version_;
+  bool incremental_update_;  // last change was an in place updateMap()
+  std::vector<int> changed_cells_;
+  // Largest finite cost, kept by getCostMap() and updates of the whole map
+  float max_cost_;
+  bool max_cost_valid_;
+  // Grids returned by getCSpace() and getCostMap(), for the map versions given
+  nav_msgs::OccupancyGrid cspace_grid_, cost_grid_;
+  unsigned cspace_grid_version_, cost_grid_version_;
+  float cost_grid_max_cost_;  // costs in cost_grid_ are relative to this
+  // Most recently used first; entries from older map versions are dropped.
+  // Shared by all workspaces, so guarded by fields_mutex_.
+  mutable std::list<boost::shared_ptr<const DistanceField> > fields_;
+  mutable boost::mutex fields_mutex_;
+  size_t field_cache_size_;
+  // Coarse level for hierarchicalAstar(): for each block of BLOCK_SIZE x
+  // BLOCK_SIZE cells, bit (dj + 1) * 3 + di + 1 is set if a move leads from
+  // one of its cells to the block at offset (di, dj).  The bits are repeated
+  // from BLOCK_UNKNOWN_SHIFT for moves allowed through unknown cells.
+  enum { BLOCK_SIZE = 8, CORRIDOR_RADIUS = 2, BLOCK_UNKNOWN_SHIFT = 16 };
+  std::vector<uint32_t> blocks_;
+  int blocks_x_, blocks_y_;
+  // Cells with finite cost and cells that are not unknown, set once the
+  // costs are computed and empty before
+  BitGrid passable_, known_;
+  std::vector<std::pair<double, BitGrid> > margin_layers_;
+  // Offsets within NEAREST_POINT_RADIUS meters by increasing distance, and
+  // the squared distance in cells of each
+  std::vector<std::pair<int, int> > nearest_offsets_;
+  std::vector<int> nearest_dist_sq_;
+  // Segment written by share() or attached to, the name given to share() and
+  // the sequence of the segment last loaded by a reader
+  boost::scoped_ptr<SharedMapSegment> shared_;
+  std::string shared_name_;
+  uint32_t shared_sequence_;
+  boost::scoped_ptr<SearchWorkspace> workspace_;
+};
+
+// Scratch state for the searches of OccupancyMap.  A workspace can be reused
+// for any number of searches on any map, but only by one thread at a time.
+class SearchWorkspace {
+public:
+  explicit SearchWorkspace(
+    OccupancyMap::QueueType type = OccupancyMap::HEAP_QUEUE);
+
+  // Select the open list used by the searches
+  void setQueueType(OccupancyMap::QueueType type);
+  OccupancyMap::QueueType queueType() const { return queue_type_; }
+  // Number of cells expanded by the last search
+  int numExpanded() const { return expanded_; }
+
+private:
+  friend class OccupancyMap;
+
+  static OpenList* createOpenList(OccupancyMap::QueueType type);
+  // Size the arrays for a map of ncells cells and start a new epoch
+  void begin(int ncells);
+  bool closed(int index) const { return stamps_[index] == epoch_ + 1; }
+
   int ncells_;
   int starti_, startj_;
   int stopi_, stopj_;
-  int max_free_threshold_, min_occupied_threshold_;
-  double max_occ_dist_, lethal_occ_dist_;
+  // Blocks the current search may enter, or empty for the whole map
+  std::vector<uint8_t> corridor_;
   boost::scoped_array<float> costs_;
   boost::scoped_array<int> prev_i_;
   boost::scoped_array<int> prev_j_;
+  // Direction a jump point was reached from, as 3 * (di + 1) + dj + 1
+  boost::scoped_array<uint8_t> jump_dir_;
+  // Search state of a cell is only valid if its stamp is epoch_ (open) or
+  // epoch_ + 1 (closed); older stamps mean unvisited by the current search
+  boost::scoped_array<uint32_t> stamps_;
+  uint32_t epoch_;
   // Priority queue mapping cost to index
-  boost::scoped_ptr<std::set<Node, NodeCompare> > Q_;
+  boost::scoped_ptr<OpenList> Q_;
+  OccupancyMap::QueueType queue_type_;
+  int expanded_;
   Path endpoints_;
+  // Cached search used by shortestPath(), or NULL to use the last search
+  boost::shared_ptr<const DistanceField> field_;
 };
 
 } // end namespace scarab
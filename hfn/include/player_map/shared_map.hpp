@@ -0,0 +1,69 @@
+#ifndef SHARED_MAP_HPP
+#define SHARED_MAP_HPP
+
+#include <string>
+
+#include <stdint.h>
+
+#include "player_map/map.h"
+
+namespace scarab {
+
+// Map in a POSIX shared memory segment: a page holding a seqlock, then the
+// contents of a map file (see map_save()).  The owner writes the cells in
+// place between beginWrite() and endWrite(); other processes attach read
+// only and check the sequence to see whether the map changed while they
+// read it.  A segment is never resized, so the owner replaces it by a new
+// one under the same name, marking the old one stale.
+class SharedMapSegment {
+public:
+  // Create segment name holding map, header and extra, replacing any segment
+  // of that name, and move the cells of map into it.  Returns NULL on error.
+  static SharedMapSegment* create(const char *name, map_t *map,
+                                  map_file_header_t *header,
+                                  const void *extra);
+  // Attach to segment name read only, pointing the cells of map into it
+  static SharedMapSegment* attach(const char *name, map_t *map);
+  // The owner marks the segment stale and removes its name
+  ~SharedMapSegment();
+
+  bool owner() const { return owner_; }
+  const std::string& name() const { return name_; }
+  // Header and extra data in the segment, writable by the owner only
+  map_file_header_t* header() const { return header_; }
+  char* extra() const { return extra_; }
+
+  // Owner: bracket changes to the segment
+  void beginWrite();
+  void endWrite();
+  bool writing() const { return writing_; }
+
+  // Readers: sequence to read at, waiting out a write in progress, and
+  // whether a read that started at sequence must be retried
+  uint32_t readBegin() const;
+  bool readRetry(uint32_t sequence) const;
+  // True once the owner replaced or removed the segment
+  bool stale() const;
+
+private:
+  struct Control {
+    uint32_t sequence;  // odd while the owner writes
+    uint32_t stale;
+  };
+
+  SharedMapSegment(const std::string &name, bool owner, Control *control,
+                   size_t control_size, map_t *map);
+  // Mark segment name stale, if it exists, and remove the name
+  static void replace(const char *name);
+
+  std::string name_;
+  bool owner_;
+  bool writing_;
+  Control *control_;
+  size_t control_size_;
+  map_file_header_t *header_;
+  char *extra_;
+};
+
+} // end namespace scarab
+#endif
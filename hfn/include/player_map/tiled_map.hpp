@@ -0,0 +1,137 @@
+#ifndef TILED_MAP_HPP
+#define TILED_MAP_HPP
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <nav_msgs/OccupancyGrid.h>
+
+#include "player_map/map.h"
+
+namespace scarab {
+
+// Occupancy map stored in square tiles allocated on demand, so that memory
+// scales with the area mapped rather than its bounding box, and the map grows
+// in any direction without moving the cells already stored.  Tiles that
+// were never written share one all-unknown tile.  Cells are addressed by
+// (i, j), which may be negative, with cell (i, j) centered at
+// (originX() + i * scale(), originY() + j * scale()).  Each tile holds the
+// same planes as a map_t, so tile(i, j).occ_state[offset(i, j)] reads what
+// map->occ_state[MAP_INDEX(map, i, j)] would.
+class TiledMap {
+public:
+  enum {
+    TILE_BITS = 6,
+    TILE_SIZE = 1 << TILE_BITS,
+    TILE_CELLS = TILE_SIZE * TILE_SIZE
+  };
+
+  struct Tile {
+    float cost[TILE_CELLS];
+    uint16_t occ_dist[TILE_CELLS];
+    uint8_t occ_state[TILE_CELLS];
+    int8_t occ_prob[TILE_CELLS];
+    bool dirty;  // occupancy changed since the last updateCSpace()
+  };
+
+  TiledMap(double scale, double origin_x, double origin_y);
+  ~TiledMap();
+
+  double scale() const { return scale_; }
+  double originX() const { return origin_x_; }
+  double originY() const { return origin_y_; }
+  // Cell containing a point, as MAP_GXWX()
+  int cellX(double x) const;
+  int cellY(double y) const;
+  double worldX(int i) const { return origin_x_ + i * scale_; }
+  double worldY(int j) const { return origin_y_ + j * scale_; }
+
+  // Bounds of the cells written so far, [minI(), maxI()) x [minJ(), maxJ()),
+  // empty if none were
+  int minI() const { return min_i_; }
+  int minJ() const { return min_j_; }
+  int maxI() const { return max_i_; }
+  int maxJ() const { return max_j_; }
+
+  // Tile holding cell (i, j), the shared unknown tile if it was never written
+  const Tile& tile(int i, int j) const {
+    const Tile *t = findTile(i >> TILE_BITS, j >> TILE_BITS);
+    return t != NULL ? *t : unknown_;
+  }
+  // Index of cell (i, j) within its tile
+  static int offset(int i, int j) {
+    return ((j & (TILE_SIZE - 1)) << TILE_BITS) | (i & (TILE_SIZE - 1));
+  }
+  // Copy of the values of cell (i, j), as map_cell()
+  map_cell_t cell(int i, int j) const;
+  // True if the tile holding cell (i, j) is allocated
+  bool allocated(int i, int j) const {
+    return findTile(i >> TILE_BITS, j >> TILE_BITS) != NULL;
+  }
+
+  // Set the occupancy of cell (i, j), allocating its tile.  Its cspace and
+  // costs, and those of its neighbors, are updated by updateCSpace().
+  void setCell(int i, int j, uint8_t occ_state, int8_t occ_prob);
+  // Write grid into the map where its origin falls, converting values as
+  // OccupancyMap::setMap() does.  Tiles only covered by unknown values are not
+  // allocated.  Returns false if the grid has another resolution.
+  bool setGrid(const nav_msgs::OccupancyGrid &grid, int free_threshold = 0,
+               int occupied_threshold = 100);
+
+  // Compute distances and costs as OccupancyMap::updateCSpace(), for the
+  // tiles changed since the last call and those around them, or for all
+  // tiles if the parameters changed.  Tiles that only hold unknown cells far
+  // from obstacles stay unallocated.
+  void updateCSpace(double max_occ_dist, double lethal_occ_dist,
+                    double cost_occ_prob = 0.0, double cost_occ_dist = 0.0);
+  double maxOccDist() const { return max_occ_dist_; }
+  double lethalOccDist() const { return lethal_occ_dist_; }
+  double costOccProb() const { return cost_occ_prob_; }
+  double costOccDist() const { return cost_occ_dist_; }
+
+  // Copy cells [min_i, max_i) x [min_j, max_j) into map, reallocating its
+  // cells, for an OccupancyMap to plan over
+  void extract(int min_i, int min_j, int max_i, int max_j, map_t *map) const;
+
+  size_t numTiles() const { return num_tiles_; }
+  // Memory used by the tiles and the directory of tiles
+  size_t bytes() const;
+
+private:
+  TiledMap(const TiledMap&);
+  TiledMap& operator=(const TiledMap&);
+
+  const Tile* findTile(int ti, int tj) const {
+    ti -= tile_min_x_;
+    tj -= tile_min_y_;
+    if (ti < 0 || ti >= tiles_x_ || tj < 0 || tj >= tiles_y_) {
+      return NULL;
+    }
+    return tiles_[ti + tj * tiles_x_];
+  }
+  // Tile (ti, tj), allocated as a copy of the unknown tile if needed
+  Tile* writableTile(int ti, int tj);
+  // Extend the directory to cover tile (ti, tj)
+  void growTo(int ti, int tj);
+  // Recompute the distances and costs of tile (ti, tj) into out, reading
+  // occupancy from scratch, a window around the tile with a border of
+  // margin cells
+  void computeTile(int ti, int tj, int margin, map_t *scratch,
+                   Tile *out) const;
+
+  double scale_, origin_x_, origin_y_;
+  int min_i_, min_j_, max_i_, max_j_;
+  // Directory of tiles_x_ by tiles_y_ tiles starting at tile
+  // (tile_min_x_, tile_min_y_), NULL where never written
+  std::vector<Tile*> tiles_;
+  int tile_min_x_, tile_min_y_, tiles_x_, tiles_y_;
+  size_t num_tiles_;
+  Tile unknown_;
+  double max_occ_dist_, lethal_occ_dist_, cost_occ_prob_, cost_occ_dist_;
+  // max_occ_dist_ as limited by map_set_max_occ_dist()
+  double map_max_occ_dist_;
+};
+
+} // end namespace scarab
+#endif
@@ -0,0 +1,156 @@
+#include "player_map/cost_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "player_map/map.h"
+
+// The AVX2 kernel is compiled for that target alone and only called after
+// checking the CPU, so the rest of the library keeps the default flags
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCARAB_COST_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+namespace scarab {
+
+CostParams makeCostParams(double scale, double map_max_occ_dist,
+                          double max_occ_dist, double lethal_occ_dist,
+                          double cost_occ_prob, double cost_occ_dist) {
+  CostParams params;
+  params.all_lethal = !(lethal_occ_dist < max_occ_dist);
+  // Largest occ_dist code within lethal_occ_dist, using the arithmetic of
+  // map_occ_dist()
+  double lethal_cells = lethal_occ_dist / scale;
+  int lethal_dist = min(floor(lethal_cells * lethal_cells), MAP_DIST_MAX - 1.0);
+  while (lethal_dist + 1 < MAP_DIST_MAX &&
+         scale * sqrt(double(lethal_dist + 1)) <= lethal_occ_dist) {
+    ++lethal_dist;
+  }
+  while (lethal_dist >= 0 &&
+         scale * sqrt(double(lethal_dist)) > lethal_occ_dist) {
+    --lethal_dist;
+  }
+  params.lethal_dist = lethal_dist;
+  params.scale = scale;
+  params.max_occ_dist = map_max_occ_dist;
+  params.lethal_occ_dist = lethal_occ_dist;
+  params.inv_dist_range = params.all_lethal ? 0.0 :
+    1.0 / (max_occ_dist - lethal_occ_dist);
+  params.prob_factor = cost_occ_prob / 100.0;
+  params.unknown_prob_cost = cost_occ_prob * 0.5;
+  params.dist_factor = cost_occ_dist;
+  return params;
+}
+
+float computeCostsScalar(const CostParams &params, const uint8_t *occ_state,
+                         const int8_t *occ_prob, const uint16_t *occ_dist,
+                         int n, float *cost) {
+  const float inf = numeric_limits<float>::infinity();
+  float max_cost = -inf;
+  if (params.all_lethal) {
+    fill(cost, cost + n, inf);
+    return max_cost;
+  }
+  for (int k = 0; k < n; ++k) {
+    int code = occ_dist[k];
+    if (occ_state[k] == map_cell_t::OCCUPIED || code <= params.lethal_dist) {
+      cost[k] = inf;
+      continue;
+    }
+    float d = code == MAP_DIST_MAX ? params.max_occ_dist :
+      params.scale * sqrtf(float(code));
+    int prob = occ_prob[k];
+    float c = prob < 0 || prob > 100 ? params.unknown_prob_cost :
+      params.prob_factor * float(prob);
+    c = c + params.dist_factor *
+      (1.0f - (d - params.lethal_occ_dist) * params.inv_dist_range);
+    cost[k] = c;
+    max_cost = max(max_cost, c);
+  }
+  return max_cost;
+}
+
+#ifdef SCARAB_COST_AVX2
+// Same operations as computeCostsScalar(), 8 cells at a time
+__attribute__((target("avx2")))
+static float computeCostsAvx2(const CostParams &params,
+                              const uint8_t *occ_state, const int8_t *occ_prob,
+                              const uint16_t *occ_dist, int n, float *cost) {
+  const float inf = numeric_limits<float>::infinity();
+  const __m256 v_inf = _mm256_set1_ps(inf);
+  const __m256 v_neg_inf = _mm256_set1_ps(-inf);
+  const __m256 v_one = _mm256_set1_ps(1.0f);
+  const __m256 v_scale = _mm256_set1_ps(params.scale);
+  const __m256 v_max_occ_dist = _mm256_set1_ps(params.max_occ_dist);
+  const __m256 v_lethal_occ_dist = _mm256_set1_ps(params.lethal_occ_dist);
+  const __m256 v_inv_dist_range = _mm256_set1_ps(params.inv_dist_range);
+  const __m256 v_prob_factor = _mm256_set1_ps(params.prob_factor);
+  const __m256 v_unknown_prob_cost = _mm256_set1_ps(params.unknown_prob_cost);
+  const __m256 v_dist_factor = _mm256_set1_ps(params.dist_factor);
+  const __m256i v_occupied = _mm256_set1_epi32(map_cell_t::OCCUPIED);
+  const __m256i v_above_lethal = _mm256_set1_epi32(params.lethal_dist + 1);
+  const __m256i v_dist_max = _mm256_set1_epi32(MAP_DIST_MAX);
+  const __m256i v_zero = _mm256_setzero_si256();
+  const __m256i v_hundred = _mm256_set1_epi32(100);
+
+  __m256 v_max_cost = v_neg_inf;
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i code = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(occ_dist + k)));
+    __m256i state = _mm256_cvtepu8_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(occ_state + k)));
+    __m256i prob = _mm256_cvtepi8_epi32(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(occ_prob + k)));
+
+    __m256 lethal = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_cmpeq_epi32(state, v_occupied),
+      _mm256_cmpgt_epi32(v_above_lethal, code)));
+    __m256 d = _mm256_mul_ps(v_scale, _mm256_sqrt_ps(_mm256_cvtepi32_ps(code)));
+    d = _mm256_blendv_ps(d, v_max_occ_dist, _mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(code, v_dist_max)));
+    __m256 unknown = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_cmpgt_epi32(v_zero, prob), _mm256_cmpgt_epi32(prob, v_hundred)));
+    __m256 c = _mm256_mul_ps(v_prob_factor, _mm256_cvtepi32_ps(prob));
+    c = _mm256_blendv_ps(c, v_unknown_prob_cost, unknown);
+    __m256 t = _mm256_mul_ps(_mm256_sub_ps(d, v_lethal_occ_dist),
+                             v_inv_dist_range);
+    c = _mm256_add_ps(c, _mm256_mul_ps(v_dist_factor, _mm256_sub_ps(v_one, t)));
+
+    v_max_cost = _mm256_max_ps(v_max_cost, _mm256_blendv_ps(c, v_neg_inf, lethal));
+    _mm256_storeu_ps(cost + k, _mm256_blendv_ps(c, v_inf, lethal));
+  }
+
+  float lanes[8];
+  _mm256_storeu_ps(lanes, v_max_cost);
+  float max_cost = *max_element(lanes, lanes + 8);
+  return max(max_cost, computeCostsScalar(params, occ_state + k,
+                                          occ_prob + k, occ_dist + k,
+                                          n - k, cost + k));
+}
+#endif
+
+bool haveAvx2CostKernel() {
+#ifdef SCARAB_COST_AVX2
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+#else
+  return false;
+#endif
+}
+
+float computeCosts(const CostParams &params, const uint8_t *occ_state,
+                   const int8_t *occ_prob, const uint16_t *occ_dist, int n,
+                   float *cost) {
+#ifdef SCARAB_COST_AVX2
+  if (!params.all_lethal && haveAvx2CostKernel()) {
+    return computeCostsAvx2(params, occ_state, occ_prob, occ_dist, n, cost);
+  }
+#endif
+  return computeCostsScalar(params, occ_state, occ_prob, occ_dist, n, cost);
+}
+
+} // end namespace scarab
@@ -0,0 +1,242 @@
+#include "player_map/dstar_lite.hpp"
+
+#include <cmath>
+#include <limits>
+
+#include <ros/ros.h>
+
+using namespace std;
+namespace scarab {
+
+// Neighbor k is opposite neighbor 7 - k
+static const int neighbor_di[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+static const int neighbor_dj[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+static const float neighbor_length[8] = {
+  M_SQRT2, 1.0, M_SQRT2, 1.0, 1.0, M_SQRT2, 1.0, M_SQRT2
+};
+
+DStarLite::DStarLite(const OccupancyMap *map)
+  : map_(map), map_version_(0), size_x_(0), size_y_(0), start_(-1),
+    stop_(-1), allow_unknown_(false), km_(0.0), expanded_(0) {
+
+}
+
+void DStarLite::reset() {
+  vector<float>().swap(g_);
+  vector<float>().swap(rhs_);
+  queue_.resize(0);
+  start_ = stop_ = -1;
+}
+
+Path DStarLite::plan(double startx, double starty, double stopx, double stopy,
+                     bool allow_unknown /* = false */) {
+  Path path;
+  expanded_ = 0;
+
+  if (map_->map() == NULL) {
+    ROS_WARN("DStarLite::plan() Map not set");
+    return path;
+  }
+  int start = map_->coordIndex(startx, starty);
+  int stop = map_->coordIndex(stopx, stopy);
+  if (start < 0 || stop < 0) {
+    ROS_ERROR("DStarLite::plan() Invalid starting or stopping position");
+    return path;
+  }
+
+  // Reuse the previous search if only the start or some cell costs changed
+  const vector<int> *changed = NULL;
+  if (map_->version() != map_version_) {
+    changed = map_->changedCells(map_version_);
+  }
+  if (g_.empty() || stop != stop_ || allow_unknown != allow_unknown_ ||
+      (map_->version() != map_version_ && changed == NULL)) {
+    initialize(start, stop, allow_unknown);
+  } else {
+    km_ += heuristic(start_, start);
+    start_ = start;
+    if (changed != NULL) {
+      // The cost of a cell is part of every move into it
+      for (size_t k = 0; k < changed->size(); ++k) {
+        updateNeighbors((*changed)[k]);
+      }
+    }
+  }
+  map_version_ = map_->version();
+
+  // An enclosed goal would otherwise expand every cell the old search reached
+  // before rhs of the start became infinite; the queue keeps until next time
+  if (!map_->blocksConnect(startx, starty, stopx, stopy, allow_unknown)) {
+    return path;
+  }
+
+  // The start itself may be left overconsistent, but its rhs is its cost
+  computeShortestPath();
+  if (isinf(rhs_[start_])) {
+    return path;
+  }
+
+  // Follow the cheapest moves down to the goal
+  const map_t *map = map_->map();
+  int index = start_;
+  path.push_back(Eigen::Vector2f(MAP_WXGX(map, index % size_x_),
+                                 MAP_WYGY(map, index / size_x_)));
+  for (size_t steps = 0; index != stop_ && steps < g_.size(); ++steps) {
+    int i = index % size_x_, j = index / size_x_;
+    float best_cost = numeric_limits<float>::infinity();
+    int best = -1;
+    for (int k = 0; k < 8; ++k) {
+      int ni = i + neighbor_di[k], nj = j + neighbor_dj[k];
+      if (!MAP_VALID(map, ni, nj)) {
+        continue;
+      }
+      int nindex = MAP_INDEX(map, ni, nj);
+      float cost = moveCost(nindex, k) + g_[nindex];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best = nindex;
+      }
+    }
+    if (best == -1) {
+      return Path();
+    }
+    index = best;
+    path.push_back(Eigen::Vector2f(MAP_WXGX(map, index % size_x_),
+                                   MAP_WYGY(map, index / size_x_)));
+  }
+  if (index != stop_) {
+    // Ran out of steps in a cycle of the g values
+    return Path();
+  }
+  return path;
+}
+
+void DStarLite::initialize(int start, int stop, bool allow_unknown) {
+  size_x_ = map_->map()->size_x;
+  size_y_ = map_->map()->size_y;
+  start_ = start;
+  stop_ = stop;
+  allow_unknown_ = allow_unknown;
+  km_ = 0.0;
+
+  int ncells = size_x_ * size_y_;
+  g_.assign(ncells, numeric_limits<float>::infinity());
+  rhs_.assign(ncells, numeric_limits<float>::infinity());
+  queue_.resize(ncells);
+
+  rhs_[stop_] = 0.0;
+  queue_.push(stop_, calculateKey(stop_));
+}
+
+DStarLite::Key DStarLite::calculateKey(int index) const {
+  float cost = min(g_[index], rhs_[index]);
+  return Key(cost + heuristic(start_, index) + km_, cost);
+}
+
+bool DStarLite::keyLess(const Key &a, const Key &b) {
+  // The heuristic is exact along straight runs, so cells on the shortest
+  // path tie with the start; treat keys within rounding error as smaller so
+  // that they are still expanded
+  float tolerance = 1e-4 * max(1.0f, b.first);
+  return a.first < b.first + tolerance;
+}
+
+float DStarLite::heuristic(int from, int to) const {
+  int di = abs(from % size_x_ - to % size_x_);
+  int dj = abs(from / size_x_ - to / size_x_);
+  return di < dj ? (dj - di) + M_SQRT2 * di : (di - dj) + M_SQRT2 * dj;
+}
+
+float DStarLite::moveCost(int to, int k) const {
+  const map_t *map = map_->map();
+  if (isinf(map->cost[to]) ||
+      (!allow_unknown_ && map->occ_state[to] == map_cell_t::UNKNOWN)) {
+    return numeric_limits<float>::infinity();
+  }
+  return neighbor_length[k] + map->cost[to];
+}
+
+float DStarLite::computeRhs(int index) const {
+  int i = index % size_x_, j = index / size_x_;
+  float rhs = numeric_limits<float>::infinity();
+  for (int k = 0; k < 8; ++k) {
+    int ni = i + neighbor_di[k], nj = j + neighbor_dj[k];
+    if (0 <= ni && ni < size_x_ && 0 <= nj && nj < size_y_) {
+      int nindex = ni + nj * size_x_;
+      rhs = min(rhs, moveCost(nindex, k) + g_[nindex]);
+    }
+  }
+  return rhs;
+}
+
+void DStarLite::updateQueue(int index) {
+  if (g_[index] != rhs_[index]) {
+    queue_.push(index, calculateKey(index));
+  } else if (queue_.contains(index)) {
+    queue_.remove(index);
+  }
+}
+
+void DStarLite::updateNeighbors(int index) {
+  int i = index % size_x_, j = index / size_x_;
+  for (int k = 0; k < 8; ++k) {
+    int ni = i + neighbor_di[k], nj = j + neighbor_dj[k];
+    int nindex = ni + nj * size_x_;
+    if (0 <= ni && ni < size_x_ && 0 <= nj && nj < size_y_ &&
+        nindex != stop_) {
+      rhs_[nindex] = computeRhs(nindex);
+      updateQueue(nindex);
+    }
+  }
+}
+
+void DStarLite::computeShortestPath() {
+  while (!queue_.empty() &&
+         (keyLess(queue_.topKey(), calculateKey(start_)) ||
+          rhs_[start_] > g_[start_])) {
+    int index = queue_.top();
+    Key old_key = queue_.topKey();
+    Key new_key = calculateKey(index);
+    if (old_key < new_key) {
+      // The start moved since this cell was queued
+      queue_.push(index, new_key);
+      continue;
+    }
+    ++expanded_;
+
+    // Moves into index from neighbor n have the same cost as the move from
+    // index to n, so only the neighbors relying on index need updating
+    int i = index % size_x_, j = index / size_x_;
+    float old_g = g_[index];
+    if (old_g > rhs_[index]) {
+      g_[index] = rhs_[index];
+      queue_.remove(index);
+    } else {
+      g_[index] = numeric_limits<float>::infinity();
+      updateQueue(index);
+    }
+    for (int k = 0; k < 8; ++k) {
+      int ni = i + neighbor_di[k], nj = j + neighbor_dj[k];
+      int nindex = ni + nj * size_x_;
+      if (ni < 0 || ni >= size_x_ || nj < 0 || nj >= size_y_ ||
+          nindex == stop_) {
+        continue;
+      }
+      float cost = moveCost(index, 7 - k);
+      if (isinf(cost)) {
+        continue;
+      }
+      if (g_[index] < old_g) {
+        if (cost + g_[index] < rhs_[nindex]) {
+          rhs_[nindex] = cost + g_[index];
+          updateQueue(nindex);
+        }
+      } else if (rhs_[nindex] == cost + old_g) {
+        rhs_[nindex] = computeRhs(nindex);
+        updateQueue(nindex);
+      }
+    }
+  }
+}
+
+} // end namespace scarab
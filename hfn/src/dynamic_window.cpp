@@ -0,0 +1,121 @@
+#include "dynamic_window.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "scan_kernels.hpp"
+
+using namespace std;
+namespace scarab {
+
+// i-th of n samples spread from lo to hi
+static double sample(double lo, double hi, int i, int n) {
+  return n > 1 ? lo + (hi - lo) * i / (n - 1) : 0.5 * (lo + hi);
+}
+
+// Chord from the start of the arc at v and w to its point after t seconds,
+// which is at half the angle turned
+static double chordLength(double v, double w, double t) {
+  if (fabs(w * t) < 1e-6) {
+    return v * t;
+  }
+  return 2.0 * v / w * sin(0.5 * w * t);
+}
+
+DynamicWindow::DynamicWindow(const Params &p) :
+  params_(p), angle_min_(0.0f), angle_increment_(0.0f) {
+  params_.v_samples = max(params_.v_samples, 1);
+  params_.w_samples = max(params_.w_samples, 1);
+  steps_ = max(1, int(params_.sim_time / params_.sim_step + 0.5));
+  int n = params_.v_samples * params_.w_samples;
+  v_.resize(n);
+  w_.resize(n);
+  chord_.resize(n);
+  half_angle_.resize(n);
+  cos_half_.resize(n);
+  hit_.resize(n);
+}
+
+void DynamicWindow::update(const sensor_msgs::LaserScan &scan,
+                           const vector<float> &free) {
+  angle_min_ = scan.angle_min;
+  angle_increment_ = scan.angle_increment;
+  clearance_.resize(free.size());
+  for (size_t i = 0; i < free.size(); ++i) {
+    double orig_range = scan.ranges[i];
+    if (scan.range_min <= orig_range && orig_range <= scan.range_max) {
+      clearance_[i] = free[i];
+    } else {
+      clearance_[i] = scan.range_max;
+    }
+  }
+}
+
+bool DynamicWindow::bestVelocity(double v0, double w0, double goal_x,
+                                 double goal_y, double *v, double *w) {
+  // Velocities reachable within one period
+  double dv = params_.acc_v * params_.period;
+  double dw = params_.acc_w * params_.period;
+  double v_hi = min(params_.v_max, v0 + dv);
+  double v_lo = min(max(0.0, v0 - dv), v_hi);
+  double w_hi = min(params_.w_max, w0 + dw);
+  double w_lo = min(max(-params_.w_max, w0 - dw), w_hi);
+
+  int n = v_.size();
+  for (int i = 0; i < params_.v_samples; ++i) {
+    for (int j = 0; j < params_.w_samples; ++j) {
+      int c = i * params_.w_samples + j;
+      v_[c] = sample(v_lo, v_hi, i, params_.v_samples);
+      w_[c] = sample(w_lo, w_hi, j, params_.w_samples);
+      half_angle_[c] = 0.5 * w_[c] * params_.sim_step;
+      cos_half_[c] = cos(half_angle_[c]);
+      chord_[c] = chordLength(v_[c], w_[c], params_.sim_step);
+    }
+  }
+  if (!clearance_.empty()) {
+    rolloutArcs(&chord_[0], &half_angle_[0], &cos_half_[0], n,
+                &clearance_[0], clearance_.size(), angle_min_,
+                angle_increment_, steps_, &hit_[0]);
+  } else {
+    fill(hit_.begin(), hit_.end(), 1);
+  }
+
+  double sim_time = steps_ * params_.sim_step;
+  double best_score = -numeric_limits<double>::infinity();
+  for (int c = 0; c < n; ++c) {
+    // Admissible if the robot can stop before the arc leaves the free space
+    int free_steps = hit_[c] - 1;
+    if (free_steps < steps_ &&
+        v_[c] > sqrt(2.0 * v_[c] * free_steps * params_.sim_step *
+                     params_.acc_v)) {
+      continue;
+    }
+
+    // Heading to the goal from the end of the rollout
+    double theta = w_[c] * sim_time;
+    double chord = chordLength(v_[c], w_[c], sim_time);
+    double x = chord * cos(0.5 * theta), y = chord * sin(0.5 * theta);
+    double error = atan2(goal_y - y, goal_x - x) - theta;
+    error = atan2(sin(error), cos(error));
+
+    double score = params_.heading_weight * (1.0 - fabs(error) / M_PI) +
+      params_.clearance_weight * free_steps / steps_ +
+      params_.velocity_weight * v_[c] / params_.v_max;
+    if (score > best_score) {
+      best_score = score;
+      *v = v_[c];
+      *w = w_[c];
+    }
+  }
+  if (best_score > -numeric_limits<double>::infinity()) {
+    return true;
+  }
+
+  // Brake as hard as allowed
+  *v = max(0.0, v0 - dv);
+  *w = w0 > 0.0 ? max(0.0, w0 - dw) : min(0.0, w0 + dw);
+  return false;
+}
+
+} // end namespace scarab
@@ -0,0 +1,52 @@
+#ifndef DYNAMIC_WINDOW_HPP
+#define DYNAMIC_WINDOW_HPP
+
+#include <vector>
+
+#include <sensor_msgs/LaserScan.h>
+
+namespace scarab {
+
+// Dynamic window controller: samples (v, w) pairs reachable within one
+// command period, rolls out the arc of each against the free distance of
+// every beam of a laser scan, and picks the admissible pair scoring best on
+// heading to the goal, clearance and speed.
+class DynamicWindow {
+public:
+  struct Params {
+    double v_max, w_max;      // velocity limits
+    double acc_v, acc_w;      // acceleration limits
+    double period;            // seconds between commands
+    double sim_time;          // seconds of each rollout
+    double sim_step;          // seconds between checks along a rollout
+    int v_samples, w_samples; // samples across the window
+    double heading_weight, clearance_weight, velocity_weight;
+  };
+
+  DynamicWindow(const Params &p);
+
+  // Check rollouts against the free distance along each beam of scan; beams
+  // without a valid range in scan are taken as clear to range_max
+  void update(const sensor_msgs::LaserScan &scan,
+              const std::vector<float> &free);
+
+  // Best (v, w) reachable from (v0, w0) for a goal at (goal_x, goal_y) in
+  // the frame of the scan.  Returns false, with (v, w) stopping the robot
+  // as fast as it can, if no arc is admissible.
+  bool bestVelocity(double v0, double w0, double goal_x, double goal_y,
+                    double *v, double *w);
+
+  const Params &params() const { return params_; }
+
+private:
+  Params params_;
+  int steps_;
+  float angle_min_, angle_increment_;
+  std::vector<float> clearance_;
+  // Each candidate and its arc, as rolloutArcs() takes them
+  std::vector<float> v_, w_, chord_, half_angle_, cos_half_;
+  std::vector<int> hit_;
+};
+
+} // end namespace scarab
+#endif
@@ -0,0 +1,209 @@
+#include "free_space.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+namespace scarab {
+
+// Closest point to (x, y) on the segment from (x1, y1) to (x2, y2), kept in
+// (bx, by) if it is closer than dist2
+static void closerOnSegment(double x, double y, double x1, double y1,
+                            double x2, double y2, double *dist2, double *bx,
+                            double *by) {
+  double sx = x2 - x1, sy = y2 - y1;
+  double length2 = sx * sx + sy * sy;
+  double t = 0.0;
+  if (length2 > 0.0) {
+    t = min(max(((x - x1) * sx + (y - y1) * sy) / length2, 0.0), 1.0);
+  }
+  double cx = x1 + t * sx, cy = y1 + t * sy;
+  double d2 = (x - cx) * (x - cx) + (y - cy) * (y - cy);
+  if (d2 < *dist2) {
+    *dist2 = d2;
+    *bx = cx;
+    *by = cy;
+  }
+}
+
+// Least squared distance from a point r from the sensor to points within
+// radius of the sensor and at least sep from it in angle: r sin(sep) if they
+// can reach the foot of the perpendicular, more if not, and r past a right
+// angle
+static double boundDistance2(double r, double sep, double radius) {
+  if (sep >= M_PI_2) {
+    return r * r;
+  }
+  double c = cos(sep);
+  if (r * c <= radius) {
+    return r * r * (1.0 - c * c);
+  }
+  return r * r + radius * (radius - 2.0 * r * c);
+}
+
+FreeSpace::FreeSpace() : max_radius_(0.0f), wide_edge_(0) {
+
+}
+
+void FreeSpace::update(const sensor_msgs::LaserScan &scan,
+                       const vector<float> &free) {
+  int size = free.size();
+  angles_.update(scan.angle_min, scan.angle_increment, size);
+  x_.resize(size);
+  y_.resize(size);
+  if (size > 0) {
+    projectRanges(&free[0], angles_.cos(), angles_.sin(), size, &x_[0],
+                  &y_[0]);
+  }
+
+  // Room for every beam, so the vertices never reallocate for a scan size
+  vertex_.reserve(size);
+  block_radius_.reserve((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+  vertex_.clear();
+  last_vertex_.resize(size);
+  for (int i = 0; i < size; ++i) {
+    double orig_range = scan.ranges[i];
+    if (scan.range_min <= orig_range && orig_range <= scan.range_max) {
+      vertex_.push_back(i);
+    }
+    last_vertex_[i] = vertex_.size();
+  }
+
+  // Each block takes in the last vertex of its last edge
+  int nvertices = vertex_.size();
+  block_radius_.assign((nvertices + BLOCK_SIZE - 1) / BLOCK_SIZE, 0.0f);
+  max_radius_ = 0.0f;
+  for (int v = 1; v <= nvertices; ++v) {
+    float radius = max(free[vertex_[v - 1]], 0.0f);
+    block_radius_[(v - 1) / BLOCK_SIZE] =
+      max(block_radius_[(v - 1) / BLOCK_SIZE], radius);
+    if (v > 1 && (v - 2) / BLOCK_SIZE != (v - 1) / BLOCK_SIZE) {
+      block_radius_[(v - 2) / BLOCK_SIZE] =
+        max(block_radius_[(v - 2) / BLOCK_SIZE], radius);
+    }
+    max_radius_ = max(max_radius_, radius);
+  }
+
+  // Beams add up to less than a turn, so at most one edge spans over half
+  wide_edge_ = 0;
+  for (int v = 1; v < nvertices; ++v) {
+    if (vertexAngle(v + 1) - vertexAngle(v) >= M_PI) {
+      wide_edge_ = v;
+    }
+  }
+}
+
+double FreeSpace::pointAngle(double x, double y) const {
+  double a = atan2(y, x);
+  if (a < angles_.angleMin()) {
+    a += 2.0 * M_PI;
+  } else if (a >= angles_.angleMin() + 2.0 * M_PI) {
+    a -= 2.0 * M_PI;
+  }
+  return a;
+}
+
+int FreeSpace::edgeAt(double a) const {
+  int nvertices = vertex_.size();
+  int i = 0;
+  if (angles_.angleIncrement() > 0.0f) {
+    i = floor((a - angles_.angleMin()) / angles_.angleIncrement());
+    i = min(max(i, 0), int(last_vertex_.size()) - 1);
+  }
+  int v = min(max(last_vertex_[i], 1), nvertices - 1);
+  // The beam angles are rounded, so check against the vertices themselves
+  while (v > 1 && a < vertexAngle(v)) {
+    --v;
+  }
+  while (v < nvertices - 1 && a > vertexAngle(v + 1)) {
+    ++v;
+  }
+  return v;
+}
+
+bool FreeSpace::contains(double x, double y) const {
+  int nvertices = vertex_.size();
+  if (x == 0.0 && y == 0.0) {
+    return true;
+  }
+  if (nvertices < 2) {
+    return false;
+  }
+  double a = pointAngle(x, y);
+  if (a < vertexAngle(1) || a > vertexAngle(nvertices)) {
+    return false;
+  }
+
+  // Inside the wedge of the edge from v to v + 1, so inside the polygon if
+  // on the same side of the edge as the sensor
+  int v = edgeAt(a);
+  double x1 = vertexX(v), y1 = vertexY(v);
+  double x2 = vertexX(v + 1), y2 = vertexY(v + 1);
+  return (x2 - x1) * (y - y1) - (y2 - y1) * (x - x1) >= 0.0;
+}
+
+void FreeSpace::searchEdges(double x, double y, double a, int begin,
+                            int step, double *dist2, double *bx,
+                            double *by) const {
+  double r = hypot(x, y);
+  int nvertices = vertex_.size();
+  int v = begin;
+  while (1 <= v && v < nvertices) {
+    // Edges of the block from v on are at least sep from (x, y) in angle,
+    // and those further on no less, so the search is over once even the
+    // furthest vertex of all is too far
+    int b = (v - 1) / BLOCK_SIZE;
+    int end = step > 0 ? min(BLOCK_SIZE * (b + 1) + 1, nvertices) :
+      BLOCK_SIZE * b;
+    double sep = step > 0 ? vertexAngle(v) - a : a - vertexAngle(v + 1);
+    if (sep > 0.0) {
+      if (boundDistance2(r, sep, max_radius_) >= *dist2) {
+        break;
+      }
+      if (boundDistance2(r, sep, block_radius_[b]) >= *dist2) {
+        v = end;
+        continue;
+      }
+    }
+    for (; v != end; v += step) {
+      if (v != wide_edge_) {
+        closerOnSegment(x, y, vertexX(v), vertexY(v), vertexX(v + 1),
+                        vertexY(v + 1), dist2, bx, by);
+      }
+    }
+  }
+}
+
+void FreeSpace::closestBoundaryPoint(double x, double y, double *bx,
+                                     double *by) const {
+  int nvertices = vertex_.size();
+  *bx = 0.0;
+  *by = 0.0;
+  double dist2 = x * x + y * y;
+  if (nvertices == 0) {
+    return;
+  }
+
+  // The edges to and from the sensor, then the others outward from the
+  // angle of (x, y) both ways, and both ways again a turn either side for
+  // edges that are closer the other way around
+  closerOnSegment(x, y, 0.0, 0.0, vertexX(1), vertexY(1), &dist2, bx, by);
+  closerOnSegment(x, y, vertexX(nvertices), vertexY(nvertices), 0.0, 0.0,
+                  &dist2, bx, by);
+  if (nvertices < 2) {
+    return;
+  }
+  if (wide_edge_ > 0) {
+    closerOnSegment(x, y, vertexX(wide_edge_), vertexY(wide_edge_),
+                    vertexX(wide_edge_ + 1), vertexY(wide_edge_ + 1), &dist2,
+                    bx, by);
+  }
+  double a = pointAngle(x, y);
+  int v = edgeAt(a);
+  searchEdges(x, y, a, v, -1, &dist2, bx, by);
+  searchEdges(x, y, a, v + 1, 1, &dist2, bx, by);
+  searchEdges(x, y, a - 2.0 * M_PI, 1, 1, &dist2, bx, by);
+  searchEdges(x, y, a + 2.0 * M_PI, nvertices - 1, -1, &dist2, bx, by);
+}
+
+} // end namespace scarab
@@ -0,0 +1,75 @@
+#ifndef FREE_SPACE_HPP
+#define FREE_SPACE_HPP
+
+#include <vector>
+
+#include <sensor_msgs/LaserScan.h>
+
+#include "scan_kernels.hpp"
+
+namespace scarab {
+
+// Free space around the robot seen in a laser scan: the polygon from the
+// sensor through the point at the free distance along each valid beam and
+// back.  It is star-shaped about the sensor with its vertices in order of
+// angle, so the edge facing a point is found from the beam at its angle
+// rather than by walking the polygon.
+class FreeSpace {
+public:
+  FreeSpace();
+
+  // Rebuild from the free distance along each beam of scan; only beams with
+  // a valid range in scan are vertices
+  void update(const sensor_msgs::LaserScan &scan,
+              const std::vector<float> &free);
+
+  const BeamAngles& angles() const { return angles_; }
+  // Point along each beam at its free distance, valid or not
+  const float* x() const { return &x_[0]; }
+  const float* y() const { return &y_[0]; }
+
+  // Vertices of the polygon, the sensor first
+  int size() const { return int(vertex_.size()) + 1; }
+  float vertexX(int v) const { return v == 0 ? 0.0f : x_[vertex_[v - 1]]; }
+  float vertexY(int v) const { return v == 0 ? 0.0f : y_[vertex_[v - 1]]; }
+
+  // True if (x, y) is inside or on the boundary of the polygon
+  bool contains(double x, double y) const;
+  // Point of the boundary of the polygon closest to (x, y).  Edges are
+  // searched outward in angle from (x, y), skipping blocks of them whose
+  // angle and furthest vertex put them further than the closest so far.
+  void closestBoundaryPoint(double x, double y, double *bx,
+                            double *by) const;
+
+private:
+  enum { BLOCK_SIZE = 16 };
+
+  // Angle of vertex v > 0
+  double vertexAngle(int v) const { return angles_.angle(vertex_[v - 1]); }
+  // Angle of (x, y) from angle_min up to a turn past it
+  double pointAngle(double x, double y) const;
+  // Vertex v > 0 starting the edge between vertices at the angle a, clamped
+  // to the first and last such edges
+  int edgeAt(double a) const;
+  // Search edges (v, v + 1) from v = begin in steps of step for points
+  // closer to (x, y), taken to be at angle a, than dist2, until the angle
+  // between them rules that out.  Skips the wide edge.
+  void searchEdges(double x, double y, double a, int begin, int step,
+                   double *dist2, double *bx, double *by) const;
+
+  BeamAngles angles_;
+  std::vector<float> x_, y_;
+  // Beam of each vertex after the sensor, and for each beam the last vertex
+  // at or before it, 0 if none
+  std::vector<int> vertex_, last_vertex_;
+  // Distance to the furthest vertex, and to the furthest vertex of each
+  // block of edges (v, v + 1) for v from BLOCK_SIZE * b + 1
+  float max_radius_;
+  std::vector<float> block_radius_;
+  // Edge (v, v + 1) spanning over half a turn, which passes behind the
+  // sensor and so outside its wedge, 0 if none
+  int wide_edge_;
+};
+
+} // end namespace scarab
+#endif
@@ -2,16 +2,22 @@
 
 #include <tf/tf.h>
 #include <nav_msgs/Path.h>
-#include <visualization_msgs/Marker.h>
 
-#include <boost/thread/thread.hpp>
+#include <algorithm>
 
-#include <CGAL/squared_distance_2.h>
+#include <boost/thread/thread.hpp>
 
 #include <angles/angles.h>
 
 using namespace std;
 
+// Side of the square buckets HFNWrapper sorts waypoints into
+static const float WAYPOINT_BUCKET = 1.0;
+// Side of the tiles of the costmap published on costmap_updates
+static const int COSTMAP_TILE_SIZE = 64;
+// Seconds between checks of the shared map for changes
+static const double SHARED_MAP_PERIOD = 0.5;
+
 //=========================== Helper functions ============================//
 
 double linear_distance(const geometry_msgs::Pose &start,
@@ -29,7 +35,7 @@ double ang_distance(const geometry_msgs::Pose &start,
 //=========================== HumanFriendlyNav ============================//
 namespace scarab {
 
-HumanFriendlyNav::HumanFriendlyNav(Params p) : params_(p) {
+HumanFriendlyNav::HumanFriendlyNav(Params p) : params_(p), dwa_(p.dwa) {
 
 }
 
@@ -53,13 +59,48 @@ HumanFriendlyNav* HumanFriendlyNav::ROSInit(ros::NodeHandle& nh) {
   nh.param("waypoint_thresh", p.waypoint_thresh, 0.2);
   nh.param("alpha_thresh", p.alpha_thresh, 2.094);
 
+  string controller;
+  nh.param("controller", controller, string("hfn"));
+  if (controller == "hfn") {
+    p.controller = HFN_CONTROLLER;
+  } else if (controller == "dwa") {
+    p.controller = DWA_CONTROLLER;
+  } else {
+    ROS_WARN("HumanFriendlyNav: Unknown controller %s, using hfn",
+             controller.c_str());
+    p.controller = HFN_CONTROLLER;
+  }
+  p.dwa.v_max = p.v_opt;
+  p.dwa.w_max = p.w_max;
+  p.dwa.period = 1.0 / p.freq;
+  nh.param("acc_lim_v", p.dwa.acc_v, 0.5);
+  nh.param("acc_lim_w", p.dwa.acc_w, 1.5);
+  nh.param("dwa_sim_time", p.dwa.sim_time, 2.0);
+  nh.param("dwa_sim_step", p.dwa.sim_step, 0.1);
+  nh.param("dwa_v_samples", p.dwa.v_samples, 10);
+  nh.param("dwa_w_samples", p.dwa.w_samples, 21);
+  nh.param("dwa_heading_weight", p.dwa.heading_weight, 1.0);
+  nh.param("dwa_clearance_weight", p.dwa.clearance_weight, 0.1);
+  nh.param("dwa_velocity_weight", p.dwa.velocity_weight, 0.1);
+
   HumanFriendlyNav *human_friendly_nav = new HumanFriendlyNav(p);
   return human_friendly_nav;
 }
 
 void HumanFriendlyNav::setLaserScan(const sensor_msgs::LaserScan &input) {
-  double alpha_des, distance_des;
   freeDistance(input);
+  if (params_.controller == DWA_CONTROLLER) {
+    dwa_.update(input, free_distance_.ranges);
+    double v, w;
+    if (!dwa_.bestVelocity(current_twist_.linear.x, current_twist_.angular.z,
+                           goal_.position.x, goal_.position.y, &v, &w)) {
+      ROS_WARN_THROTTLE(1.0, "HumanFriendlyNav: No admissible arc, braking");
+    }
+    goal_twist_.linear.x = v;
+    goal_twist_.angular.z = w;
+    return;
+  }
+  double alpha_des, distance_des;
   desiredOrientation(alpha_des, distance_des);
   orientationToTwist(alpha_des, distance_des, goal_twist_);
 }
@@ -98,66 +139,15 @@ void HumanFriendlyNav::setGoal(const geometry_msgs::PoseStamped &input) {
 
   // Move goal_ to closest point on interior of polygon defined if it's on the
   // outside
-  Point_2 old_goal(goal_.position.x, goal_.position.y);
-  if (CGAL::bounded_side_2(polygon_.vertices_begin(), polygon_.vertices_end(),
-                           old_goal, K()) == CGAL::ON_UNBOUNDED_SIDE) {
-    // Find closest vertex
-    Polygon_2::Vertex_iterator closest_v, it_v;
-    double min_dist_vertex = numeric_limits<double>::max();
-    for (it_v = polygon_.vertices_begin(); it_v != polygon_.vertices_end(); ++it_v) {
-      double dist = CGAL::squared_distance(old_goal, *it_v);
-      if (dist < min_dist_vertex) {
-        closest_v = it_v;
-        min_dist_vertex = dist;
-      }
-    }
-
-    // Find closest edge
-    Polygon_2::Edge_const_iterator closest_e, it_e;
-    double min_dist_edge = numeric_limits<double>::max();
-    for (it_e = polygon_.edges_begin(); it_e != polygon_.edges_end(); ++it_e) {
-      double dist = CGAL::squared_distance(old_goal, *it_e);
-      if (dist < min_dist_edge) {
-        closest_e = it_e;
-        min_dist_edge = dist;
-      }
-    }
-
-    // Pick object that's closet
-    if (min_dist_vertex < min_dist_edge) {
-      goal_.position.x = closest_v->x();
-      goal_.position.y = closest_v->y();
-    } else {
-      // Check if point when projected onto segment lies on segment
-      Vector_2 seg_vec = closest_e->to_vector();
-      Vector_2 point_vec(closest_e->source(), old_goal);
-
-      double dotprod = seg_vec * point_vec;
-      if (0.0 <= dotprod && dotprod <= seg_vec.squared_length()) {
-        // Point lies on segment
-        Vector_2 projection = dotprod / seg_vec.squared_length() * seg_vec;
-        goal_.position.x = closest_e->source().x() + projection.x();
-        goal_.position.y = closest_e->source().y() + projection.y();
-      } else {
-        // Point is not on segment, use closest vertex instead
-        goal_.position.x = closest_v->x();
-        goal_.position.y = closest_v->y();
-      }
-    }
-
-    Point_2 boundary_point(goal_.position.x, goal_.position.y);
-    Vector_2 direction(old_goal, boundary_point);
-    Vector_2 offset = direction / sqrt(direction.squared_length());
-    offset = offset * 0.8 * params_.waypoint_thresh;
-    goal_.position.x += offset.x();
-    goal_.position.y += offset.y();
-  }
-
-  Point_2 new_goal = Point_2(goal_.position.x, goal_.position.y);
-  if (CGAL::bounded_side_2(polygon_.vertices_begin(), polygon_.vertices_end(),
-                           new_goal, K()) == CGAL::ON_UNBOUNDED_SIDE) {
-    // ROS_WARN("Failed to move point to inside");
-    // ROS_BREAK();
+  double old_x = goal_.position.x, old_y = goal_.position.y;
+  if (!free_space_.contains(old_x, old_y)) {
+    free_space_.closestBoundaryPoint(old_x, old_y, &goal_.position.x,
+                                     &goal_.position.y);
+
+    double dx = goal_.position.x - old_x, dy = goal_.position.y - old_y;
+    double offset = 0.8 * params_.waypoint_thresh / hypot(dx, dy);
+    goal_.position.x += offset * dx;
+    goal_.position.y += offset * dy;
   }
 }
 
@@ -166,68 +156,10 @@ void HumanFriendlyNav::setOdom(const nav_msgs::Odometry &input) {
 }
 
 void HumanFriendlyNav::freeDistance(const sensor_msgs::LaserScan &input) {
-  free_distance_ = input;
-
-  vector<float>::const_iterator it_input;
-  vector<float>::iterator it_free;
-  for (it_input=input.ranges.begin(), it_free=free_distance_.ranges.begin();
-       it_input!=input.ranges.end(); ++it_input, ++it_free) {
-    if (input.range_min <= *it_input && *it_input <= input.range_max) {
-      addObstacle(it_free, *it_input);
-    }
-  }
+  inflation_.inflate(input, obstacleRadius(), &free_distance_);
 
   // Build polygon
-  polygon_.clear();
-  polygon_.push_back(Point_2(0.0, 0.0));
-  for (size_t i = 0; i < free_distance_.ranges.size(); ++i) {
-    double orig_range = input.ranges.at(i);
-    if (input.range_min <= orig_range && orig_range <= input.range_max) {
-      double t = free_distance_.angle_min + i * free_distance_.angle_increment;
-      double x = cos(t) * free_distance_.ranges.at(i);
-      double y = sin(t) * free_distance_.ranges.at(i);
-      polygon_.push_back(Point_2(x, y));
-    }
-  }
-}
-
-void HumanFriendlyNav::addObstacle(vector<float>::iterator &it, float scan_dist)
-{
-  float r = min(obstacleRadius(), scan_dist-0.001f);
-  float phi = asin(r / scan_dist);
-  float dTheta = free_distance_.angle_increment;
-  float theta = 0.0;
-
-  vector<float>::iterator it_f=it;
-  while (!(it_f==free_distance_.ranges.begin() || theta-dTheta<=-phi)) {
-    it_f--;
-    theta -= dTheta;
-  }
-
-  while (it_f!=free_distance_.ranges.end() && theta+dTheta<=phi) {
-    float l = calcReducedRange(scan_dist, r, theta);
-    if (l < *it_f) {
-      *it_f = l;
-    }
-    if (*it_f < 0.0) {
-      *it_f = 0.0;
-    }
-    it_f++;
-    theta += dTheta;
-  }
-}
-
-float HumanFriendlyNav::calcReducedRange(float d, float r, float theta) {
-  float b = -2.0*d*cos(theta);
-  float c = d*d - r*r;
-
-  float discriminant = b*b - 4.0*c;
-  if (discriminant < 0.0) {
-    return 0.0;
-  }
-
-  float l = (-b-sqrt(discriminant)) / 2.0;
-  return (l>0.0) ? l : 0.0;
+  free_space_.update(input, free_distance_.ranges);
 }
 
 float HumanFriendlyNav::obstacleRadius() {
@@ -235,27 +167,25 @@ float HumanFriendlyNav::obstacleRadius() {
 }
 
 void HumanFriendlyNav::desiredOrientation(double &alpha_des, double &distance_des) {
-  vector<float>::const_iterator it;
-  double alpha;
+  const vector<float> &ranges = free_distance_.ranges;
+  int size = ranges.size();
 
   // get distance directly in front of robot
-  size_t ind = free_distance_.ranges.size()/2;
-  double distance0 = free_distance_.ranges[ind];
+  size_t ind = size/2;
+  double distance0 = ranges[ind];
 
   // if goal within sight, drive towards it
   double alpha_goal = atan2(goal_.position.y, goal_.position.x);
   if ((alpha_goal>free_distance_.angle_min) &&
       (alpha_goal<free_distance_.angle_max)) {
-    it = free_distance_.ranges.begin();
-    alpha = free_distance_.angle_min;
-    while (alpha_goal > alpha + free_distance_.angle_increment) {
-      alpha += free_distance_.angle_increment;
-      it++;
-    }
+    // Beam whose interval of angles holds the goal
+    int goal_ind = ceil((alpha_goal - free_distance_.angle_min) /
+                        free_distance_.angle_increment) - 1;
+    goal_ind = min(max(goal_ind, 0), size - 1);
 
     geometry_msgs::Pose zero_pose;
     double distance_to_goal = linear_distance(goal_, zero_pose);
-    if (distance_to_goal <= *it) {
+    if (distance_to_goal <= ranges[goal_ind]) {
       alpha_des = alpha_goal;
       distance_des = min(distance_to_goal, distance0);
       return;
@@ -264,21 +194,11 @@ void HumanFriendlyNav::desiredOrientation(double &alpha_des, double &distance_de
 
   // else drive towards closest free point
   alpha_des = 0;
-  double distance_to_goal = numeric_limits<double>::max();
-
-  alpha = free_distance_.angle_min;
-  for (it=free_distance_.ranges.begin(); it!=free_distance_.ranges.end();
-       ++it, alpha+=free_distance_.angle_increment) {
-    geometry_msgs::Pose scan_point;
-    scan_point.position.x = (*it) * cos(alpha);
-    scan_point.position.y = (*it) * sin(alpha);
-
-    double dist = linear_distance(goal_, scan_point);
-    if (dist < distance_to_goal) {
-      distance_to_goal = dist;
-      alpha_des = alpha;
-      distance_des = min(double(*it), distance0);
-    }
+  int nearest = nearestPoint(free_space_.x(), free_space_.y(), size,
+                             goal_.position.x, goal_.position.y);
+  if (nearest >= 0) {
+    alpha_des = free_space_.angles().angle(nearest);
+    distance_des = min(double(ranges[nearest]), distance0);
   }
 }
 
@@ -315,6 +235,13 @@ double clamp(double val, double min, double max) {
 
 void HumanFriendlyNav::getCommandVel(geometry_msgs::Twist *cmd_vel)
 {
+  // The dynamic window already keeps to the acceleration limits
+  if (params_.controller == DWA_CONTROLLER) {
+    cmd_vel->linear.x = goal_twist_.linear.x;
+    cmd_vel->angular.z = goal_twist_.angular.z;
+    return;
+  }
+
   double left, right;
   twistToWheelVel(current_twist_, left, right);
 
@@ -365,8 +292,8 @@ void HumanFriendlyNav::twistToWheelVel(const geometry_msgs::Twist &twist,
 
 
 HFNWrapper::HFNWrapper(const Params &params, HumanFriendlyNav *hfn) :
-  active_(false), turning_(false), map_(new scarab::OccupancyMap()),
-  params_(params), hfn_(hfn) {
+  active_(false), turning_(false), waypoint_ind_(-1), buckets_x_(0),
+  buckets_y_(0), map_(new scarab::OccupancyMap()), params_(params), hfn_(hfn) {
   flags_.have_pose = false;
   flags_.have_odom = false;
   flags_.have_map = false;
@@ -376,14 +303,33 @@ HFNWrapper::HFNWrapper(const Params &params, HumanFriendlyNav *hfn) :
   vis_pub_ = nh_.advertise<visualization_msgs::Marker>("marker", 10, true);
   vel_pub_ = nh_.advertise<geometry_msgs::Twist>("cmd_vel", 10);
   inflated_pub_ = nh_.advertise<sensor_msgs::LaserScan>("inflated_scan", 10, true);
-  costmap_pub_ = nh_.advertise<nav_msgs::OccupancyGrid>("costmap", 1, true);
+  if (params_.costmap_updates) {
+    // New subscribers get the whole costmap, then only the changed tiles
+    costmap_pub_ = nh_.advertise<nav_msgs::OccupancyGrid>(
+      "costmap", 1, boost::bind(&HFNWrapper::onCostMapConnect, this, _1));
+    costmap_updates_pub_ =
+      nh_.advertise<map_msgs::OccupancyGridUpdate>("costmap_updates", 10);
+  } else {
+    costmap_pub_ = nh_.advertise<nav_msgs::OccupancyGrid>("costmap", 1, true);
+  }
 
   pose_sub_ = nh_.subscribe("pose", 1, &HFNWrapper::onPose, this);
-  map_sub_ = nh_.subscribe("map", 1, &HFNWrapper::onMap, this);
+  if (params_.shared_map.empty()) {
+    map_sub_ = nh_.subscribe("map", 1, &HFNWrapper::onMap, this);
+  } else {
+    shared_map_timer_ = nh_.createTimer(ros::Duration(SHARED_MAP_PERIOD),
+                                        &HFNWrapper::onSharedMapTimer, this);
+  }
   laser_sub_ = nh_.subscribe("scan", 1, &HFNWrapper::onLaserScan, this);
   odom_sub_ = nh_.subscribe("odom", 1, &HFNWrapper::onOdom, this);
 
   map_->setThresholds(params_.free_threshold, params_.occupied_threshold);
+  if (!params_.cspace_file.empty() && params_.shared_map.empty()) {
+    loadCSpace(params_.cspace_file);
+  }
+  // Margins of the lineOfSight() and nearestPoint() checks while navigating
+  map_->addMarginLayer(params_.los_margin);
+  map_->addMarginLayer(params_.lethal_occ_dist);
 
   pubWaypoints();
 }
@@ -391,6 +337,35 @@ HFNWrapper::HFNWrapper(const Params &params, HumanFriendlyNav *hfn) :
 HFNWrapper::~HFNWrapper() {
 }
 
+bool HFNWrapper::cspaceMatches(const scarab::OccupancyMap &map) const {
+  // The map topic would be converted with these, so a map made with other
+  // parameters cannot stand in for it
+  return map.freeThreshold() == params_.free_threshold &&
+    map.occupiedThreshold() == params_.occupied_threshold &&
+    map.maxOccDist() == params_.max_occ_dist &&
+    map.lethalOccDist() == params_.lethal_occ_dist &&
+    map.costOccProb() == params_.cost_occ_prob &&
+    map.costOccDist() == params_.cost_occ_dist;
+}
+
+void HFNWrapper::loadCSpace(const std::string &filename) {
+  boost::scoped_ptr<scarab::OccupancyMap> map(
+    scarab::OccupancyMap::FromFile(filename.c_str()));
+  if (!map) {
+    ROS_WARN("HFNWrapper: Failed to load %s, waiting for map",
+             filename.c_str());
+    return;
+  }
+  if (!cspaceMatches(*map)) {
+    ROS_WARN("HFNWrapper: %s was made with different parameters, waiting "
+             "for map", filename.c_str());
+    return;
+  }
+  // Later maps with the same geometry are applied in place
+  map_.swap(map);
+  flags_.have_map = true;
+}
+
 
 void HFNWrapper::registerStatusCallback(const boost::function<void(Status)> &callback) {
   callback_ = callback;
@@ -406,6 +381,7 @@ HFNWrapper* HFNWrapper::ROSInit(ros::NodeHandle& nh) {
   nh.param("goal_tolerance_ang", p.goal_tol_ang, M_PI * 2.0);
   nh.param("path_margin", p.path_margin, 0.5);
   nh.param("waypoint_spacing", p.waypoint_spacing, 0.05);
+  nh.param("waypoint_window", p.waypoint_window, 2.0);
   nh.param("los_margin", p.los_margin, 0.2);
   nh.param("timeout", p.timeout, 500.0);
   nh.param("stuck_distance", p.stuck_distance, 0.05);
@@ -416,8 +392,27 @@ HFNWrapper* HFNWrapper::ROSInit(ros::NodeHandle& nh) {
   nh.param("occupied_threshold", p.occupied_threshold, 100);
   nh.param("allow_unknown_path", p.allow_unknown_path, true);
   nh.param("allow_unknown_los", p.allow_unknown_los, false);
+  string planner;
+  nh.param("planner", planner, string("astar"));
+  if (planner == "astar") {
+    p.planner = scarab::OccupancyMap::ASTAR_PLANNER;
+  } else if (planner == "jps") {
+    p.planner = scarab::OccupancyMap::JPS_PLANNER;
+  } else if (planner == "theta_star") {
+    p.planner = scarab::OccupancyMap::THETA_STAR_PLANNER;
+  } else if (planner == "hierarchical") {
+    p.planner = scarab::OccupancyMap::HIERARCHICAL_PLANNER;
+  } else {
+    ROS_WARN("HFNWrapper: Unknown planner %s, using astar", planner.c_str());
+    p.planner = scarab::OccupancyMap::ASTAR_PLANNER;
+  }
+  nh.param("incremental_replan", p.incremental_replan, false);
+  nh.param("cache_goal_paths", p.cache_goal_paths, false);
+  nh.param("costmap_updates", p.costmap_updates, false);
   nh.param("map_frame_id", p.map_frame, string("/map"));
   nh.param("min_map_update", p.min_map_update, 0.0);
+  nh.param("cspace_file", p.cspace_file, string(""));
+  nh.param("shared_map", p.shared_map, string(""));
   p.name_space = nh.getNamespace();
 
   HumanFriendlyNav *hfn = HumanFriendlyNav::ROSInit(nh);
@@ -500,6 +495,34 @@ void HFNWrapper::onPose(const geometry_msgs::PoseStamped &input) {
   }
 }
 
+void HFNWrapper::publishCostMap() {
+  if (!params_.costmap_updates) {
+    if (costmap_pub_.getNumSubscribers() > 0) {
+      costmap_pub_.publish(map_->getCostMap());
+    }
+    return;
+  }
+  if (costmap_pub_.getNumSubscribers() == 0 &&
+      costmap_updates_pub_.getNumSubscribers() == 0) {
+    return;
+  }
+  if (!map_->getCostMapUpdates(COSTMAP_TILE_SIZE, &costmap_updates_)) {
+    costmap_pub_.publish(map_->getCostMap());
+    return;
+  }
+  for (size_t k = 0; k < costmap_updates_.size(); ++k) {
+    costmap_updates_[k].header.frame_id = params_.map_frame;
+    costmap_updates_[k].header.stamp = ros::Time::now();
+    costmap_updates_pub_.publish(costmap_updates_[k]);
+  }
+}
+
+void HFNWrapper::onCostMapConnect(const ros::SingleSubscriberPublisher &pub) {
+  if (flags_.have_map) {
+    pub.publish(map_->getCostMap());
+  }
+}
+
 void HFNWrapper::onMap(const nav_msgs::OccupancyGrid &input) {
   geometry_msgs::PoseStamped goal;
   if ((input.header.stamp - last_map_update_).toSec() < params_.min_map_update) {
@@ -513,9 +536,38 @@ void HFNWrapper::onMap(const nav_msgs::OccupancyGrid &input) {
   map_->updateCSpace(params_.max_occ_dist, params_.lethal_occ_dist,
                      params_.cost_occ_prob, params_.cost_occ_dist);
   //~ costmap_pub_.publish(map_->getCSpace());
-  if (costmap_pub_.getNumSubscribers() > 0) {
-    costmap_pub_.publish(map_->getCostMap());
+  mapUpdated();
+}
+
+void HFNWrapper::onSharedMapTimer(const ros::TimerEvent &event) {
+  if (flags_.have_map) {
+    if (map_->sync()) {
+      ROS_DEBUG("HFNWrapper: Shared map changed");
+      mapUpdated();
+    }
+    return;
+  }
+  boost::scoped_ptr<scarab::OccupancyMap> map(
+    scarab::OccupancyMap::Attach(params_.shared_map.c_str()));
+  if (!map) {
+    ROS_WARN_THROTTLE(10.0, "HFNWrapper: Waiting for shared map %s",
+                      params_.shared_map.c_str());
+    return;
   }
+  if (!cspaceMatches(*map)) {
+    ROS_WARN_THROTTLE(10.0, "HFNWrapper: Shared map %s was made with "
+                      "different parameters", params_.shared_map.c_str());
+    return;
+  }
+  map_.swap(map);
+  map_->addMarginLayer(params_.los_margin);
+  map_->addMarginLayer(params_.lethal_occ_dist);
+  flags_.have_map = true;
+  mapUpdated();
+}
+
+void HFNWrapper::mapUpdated() {
+  publishCostMap();
 
   ensureValidPose();
 
@@ -524,29 +576,29 @@ void HFNWrapper::onMap(const nav_msgs::OccupancyGrid &input) {
   }
 }
 
-void HFNWrapper::pubPolygon(const HumanFriendlyNav::Polygon_2 &polygon) {
-  visualization_msgs::Marker m;
-  m.header.stamp = ros::Time();
-  m.header.frame_id = hfn_->params().base_frame;
-  m.action = visualization_msgs::Marker::ADD;
-  m.type = visualization_msgs::Marker::LINE_STRIP;
-  m.id = 100;
-  m.ns = params_.name_space + "/polygon";
-  m.pose.orientation.w = 1.0;
-  m.scale.x = 0.1;
-  m.scale.y = 0.1;
-  m.scale.z = 0.1;
-  m.color.a = 1.0;
-  m.color.r = 1.0;
-  m.points.resize(polygon.size());
-  HumanFriendlyNav::Polygon_2::Vertex_iterator it;
-  size_t i;
-  for (it = polygon.vertices_begin(), i = 0;
-       it != polygon.vertices_end(); ++it, ++i) {
-    m.points.at(i).x = it->x();
-    m.points.at(i).y = it->y();
-  }
-  m.points.push_back(m.points.front());
+void HFNWrapper::pubPolygon(const FreeSpace &polygon) {
+  // Only the points change from scan to scan
+  visualization_msgs::Marker &m = polygon_marker_;
+  if (m.ns.empty()) {
+    m.header.stamp = ros::Time();
+    m.header.frame_id = hfn_->params().base_frame;
+    m.action = visualization_msgs::Marker::ADD;
+    m.type = visualization_msgs::Marker::LINE_STRIP;
+    m.id = 100;
+    m.ns = params_.name_space + "/polygon";
+    m.pose.orientation.w = 1.0;
+    m.scale.x = 0.1;
+    m.scale.y = 0.1;
+    m.scale.z = 0.1;
+    m.color.a = 1.0;
+    m.color.r = 1.0;
+  }
+  m.points.resize(polygon.size() + 1);
+  for (int i = 0; i < polygon.size(); ++i) {
+    m.points[i].x = polygon.vertexX(i);
+    m.points[i].y = polygon.vertexY(i);
+  }
+  m.points.back() = m.points.front();
   vis_pub_.publish(m);
 }
 
@@ -559,12 +611,16 @@ string HFNWrapper::uninitializedString() {
   return description;
 }
 
-void HFNWrapper::onLaserScan(const sensor_msgs::LaserScan &scan) {
+void HFNWrapper::onLaserScan(const sensor_msgs::LaserScanConstPtr &scan) {
   flags_.have_laser = true;
-  hfn_->setLaserScan(scan);
-  inflated_pub_.publish(hfn_->inflatedScan());
-
-  pubPolygon(hfn_->inflatedPolygon());
+  hfn_->setLaserScan(*scan);
+  // Both are for debugging, so skip serializing them with no one listening
+  if (inflated_pub_.getNumSubscribers() > 0) {
+    inflated_pub_.publish(hfn_->inflatedScan());
+  }
+  if (vis_pub_.getNumSubscribers() > 0) {
+    pubPolygon(hfn_->inflatedPolygon());
+  }
 
   if (!initialized() || !active_) {
     return;
@@ -617,7 +673,7 @@ void HFNWrapper::setGoal(const vector<geometry_msgs::PoseStamped> &p) {
   for (int i = 0; i < p.size(); ++i) {
     const geometry_msgs::PoseStamped &pose = p.at(i);
     double x = pose.pose.position.x, y = pose.pose.position.y;
-    if (map_->getCell(x, y) == NULL) {
+    if (map_->coordIndex(x, y) < 0) {
       ROS_WARN("HFNWrapper: UNREACHABLE (Goal %f %f is outside map limits)", x, y);
       callback_(UNREACHABLE);
       return;
@@ -626,6 +682,9 @@ void HFNWrapper::setGoal(const vector<geometry_msgs::PoseStamped> &p) {
 
 
   goals_ = p;
+  if (replanners_.size() > goals_.size()) {
+    replanners_.resize(goals_.size());
+  }
   waypoints_.clear();
   pose_history_.clear();
   goal_time_ = ros::Time::now();
@@ -641,8 +700,9 @@ void HFNWrapper::setGoal(const vector<geometry_msgs::PoseStamped> &p) {
   for (std::vector<geometry_msgs::PoseStamped>::iterator it = goals_.begin();
        it != goals_.end(); ++it) {
     // Check if goals_ location is reachable
-    if (map_->getCell(it->pose.position.x, it->pose.position.y)->occ_dist <
-        params_.lethal_occ_dist) {
+    map_cell_t goal_cell;
+    map_->getCell(it->pose.position.x, it->pose.position.y, &goal_cell);
+    if (goal_cell.occ_dist < params_.lethal_occ_dist) {
 
       double startx = it->pose.position.x, starty = it->pose.position.y;
       double newx, newy;
@@ -665,10 +725,32 @@ void HFNWrapper::setGoal(const vector<geometry_msgs::PoseStamped> &p) {
     last_pose.position.x = path.back().x();
     last_pose.position.y = path.back().y();
     if (linear_distance(last_pose, it->pose) > params_.waypoint_spacing) {
-      scarab::Path path_segment =
-        map_->astar(last_pose.position.x, last_pose.position.y,
-                    it->pose.position.x, it->pose.position.y,
-                    params_.lethal_occ_dist, params_.allow_unknown_path);
+      scarab::Path path_segment;
+      if (params_.incremental_replan) {
+        size_t segment = it - goals_.begin();
+        if (replanners_.size() <= segment) {
+          replanners_.resize(segment + 1);
+        }
+        if (!replanners_[segment]) {
+          replanners_[segment].reset(new scarab::DStarLite(map_.get()));
+        }
+        path_segment =
+          replanners_[segment]->plan(last_pose.position.x, last_pose.position.y,
+                                     it->pose.position.x, it->pose.position.y,
+                                     params_.allow_unknown_path);
+      } else if (params_.cache_goal_paths) {
+        // The search from each goal is reused until the map changes
+        path_segment =
+          map_->cachedPath(last_pose.position.x, last_pose.position.y,
+                           it->pose.position.x, it->pose.position.y,
+                           params_.lethal_occ_dist, params_.allow_unknown_path);
+      } else {
+        path_segment =
+          map_->plan(params_.planner,
+                     last_pose.position.x, last_pose.position.y,
+                     it->pose.position.x, it->pose.position.y,
+                     params_.lethal_occ_dist, params_.allow_unknown_path);
+      }
       if (path_segment.size() != 0) {
         for (size_t i=0; i<path_segment.size(); ++i) {
           path.push_back(path_segment[i]);
@@ -684,16 +766,22 @@ void HFNWrapper::setGoal(const vector<geometry_msgs::PoseStamped> &p) {
     }
   }
 
-  // Generate evenly spaced path
+  // Generate evenly spaced path, interpolating along segments longer than the
+  // spacing (e.g., from any-angle planners)
   waypoints_.push_back(path[0]);
-  for (size_t i = 0; i < path.size() - 1; ++i) {
-    const Eigen::Vector2f& prev = waypoints_.back();
-    const Eigen::Vector2f& curr = path[i];
-    if ((prev - curr).norm() > params_.waypoint_spacing) {
-      waypoints_.push_back(path[i-1]);
+  float since_waypoint = 0.0; // distance travelled since last waypoint
+  for (size_t i = 1; i < path.size() && params_.waypoint_spacing > 0; ++i) {
+    Eigen::Vector2f delta = path[i] - path[i-1];
+    float length = delta.norm();
+    float s = params_.waypoint_spacing - since_waypoint;
+    for (; s < length; s += params_.waypoint_spacing) {
+      waypoints_.push_back(path[i-1] + delta * (s / length));
     }
+    since_waypoint = length - (s - params_.waypoint_spacing);
   }
   waypoints_.push_back(path.back());
+  waypoint_ind_ = -1;
+  indexWaypoints();
   pubWaypoints();
 
   timeout_timer_ = nh_.createTimer(ros::Duration(params_.timeout),
@@ -714,9 +802,92 @@ void HFNWrapper::stop() {
   timeout_timer_.stop();
 
   waypoints_.clear();
+  waypoint_ind_ = -1;
+  buckets_.clear();
+  replanners_.clear();
   pubWaypoints();
 }
 
+void HFNWrapper::indexWaypoints() {
+  buckets_.clear();
+  if (waypoints_.empty()) {
+    return;
+  }
+  Eigen::Vector2f max_point = waypoints_[0];
+  bucket_origin_ = waypoints_[0];
+  for (size_t i = 1; i < waypoints_.size(); ++i) {
+    bucket_origin_ = bucket_origin_.cwiseMin(waypoints_[i]);
+    max_point = max_point.cwiseMax(waypoints_[i]);
+  }
+  buckets_x_ = floor((max_point.x() - bucket_origin_.x()) / WAYPOINT_BUCKET) + 1;
+  buckets_y_ = floor((max_point.y() - bucket_origin_.y()) / WAYPOINT_BUCKET) + 1;
+  buckets_.resize(buckets_x_ * buckets_y_);
+  for (size_t i = 0; i < waypoints_.size(); ++i) {
+    int bi = floor((waypoints_[i].x() - bucket_origin_.x()) / WAYPOINT_BUCKET);
+    int bj = floor((waypoints_[i].y() - bucket_origin_.y()) / WAYPOINT_BUCKET);
+    buckets_[bi + bj * buckets_x_].push_back(i);
+  }
+}
+
+int HFNWrapper::findWaypoint(const Eigen::Vector2f &pos) {
+  if (buckets_.empty()) {
+    return -1;
+  }
+  // Search rings of buckets around pos outwards, until the rings are farther
+  // away than the closest visible waypoint found
+  int bi = floor((pos.x() - bucket_origin_.x()) / WAYPOINT_BUCKET);
+  int bj = floor((pos.y() - bucket_origin_.y()) / WAYPOINT_BUCKET);
+  int max_r = max(max(bi, buckets_x_ - 1 - bi), max(bj, buckets_y_ - 1 - bj));
+  float min_dist = numeric_limits<float>::infinity();
+  int min_ind = -1;
+  for (int r = 0; r <= max_r; ++r) {
+    // Waypoints in ring r are at least r - 1 buckets away
+    float ring_dist = max(0, r - 1) * WAYPOINT_BUCKET;
+    if (ring_dist * ring_dist >= min_dist) {
+      break;
+    }
+    candidates_.clear();
+    for (int j = bj - r; j <= bj + r; ++j) {
+      // Only the first and last rows are full, the others just have two ends
+      int step = (j == bj - r || j == bj + r) ? 1 : max(2 * r, 1);
+      for (int i = bi - r; i <= bi + r; i += step) {
+        if (i < 0 || i >= buckets_x_ || j < 0 || j >= buckets_y_) {
+          continue;
+        }
+        const vector<int> &bucket = buckets_[i + j * buckets_x_];
+        for (size_t k = 0; k < bucket.size(); ++k) {
+          candidates_.push_back(
+            make_pair((pos - waypoints_[bucket[k]]).squaredNorm(), bucket[k]));
+        }
+      }
+    }
+    int ind = closestVisible(pos, &candidates_, min_dist);
+    if (ind != -1) {
+      min_ind = ind;
+      min_dist = (pos - waypoints_[ind]).squaredNorm();
+    }
+  }
+  return min_ind;
+}
+
+int HFNWrapper::closestVisible(const Eigen::Vector2f &pos,
+                               vector<pair<float, int> > *candidates,
+                               float max_dist) {
+  sort(candidates->begin(), candidates->end());
+  for (size_t k = 0; k < candidates->size(); ++k) {
+    const pair<float, int> &candidate = (*candidates)[k];
+    if (candidate.first >= max_dist) {
+      break;
+    }
+    const Eigen::Vector2f &waypoint = waypoints_[candidate.second];
+    if (map_->lineOfSight(pos.x(), pos.y(), waypoint.x(), waypoint.y(),
+                          params_.los_margin, params_.allow_unknown_los)) {
+      return candidate.second;
+    }
+  }
+  return -1;
+}
+
 void HFNWrapper::timeout(const ros::TimerEvent &event) {
   ROS_WARN("HFNWrapper: TIMEOUT (Didn't get to goal in time)");
   stop();
@@ -725,22 +896,29 @@ void HFNWrapper::timeout(const ros::TimerEvent &event) {
 
 bool HFNWrapper::updateWaypoint() {
   // Direct robot towards successor of point that it is closest to
-  float min_dist = numeric_limits<float>::infinity();
   int min_ind = -1;
-  // Get closest visible waypoint
   Eigen::Vector2f pos(pose_.pose.position.x, pose_.pose.position.y);
-  for (size_t wayind = 0; wayind < waypoints_.size(); ++wayind) {
-    if (!map_->lineOfSight(pos.x(), pos.y(),
-                           waypoints_[wayind].x(), waypoints_[wayind].y(),
-                           params_.los_margin, params_.allow_unknown_los)) {
-      continue;
+  if (waypoint_ind_ != -1) {
+    // Get closest visible waypoint within the window around the last one, so
+    // the work per scan doesn't grow with the length of the path
+    int window = waypoints_.size();
+    if (params_.waypoint_spacing > 0) {
+      window = ceil(params_.waypoint_window / params_.waypoint_spacing);
     }
-    float dist = (pos - waypoints_[wayind]).squaredNorm();
-    if (dist < min_dist) {
-      min_dist = dist;
-      min_ind = wayind;
+    candidates_.clear();
+    int end = min<int>(waypoint_ind_ + window, waypoints_.size() - 1);
+    for (int i = max(0, waypoint_ind_ - window); i <= end; ++i) {
+      candidates_.push_back(make_pair((pos - waypoints_[i]).squaredNorm(), i));
     }
+    min_ind = closestVisible(pos, &candidates_,
+                             numeric_limits<float>::infinity());
+  }
+  if (min_ind == -1) {
+    // Lost track, e.g. after a detour around an obstacle; get closest visible
+    // waypoint on the whole path
+    min_ind = findWaypoint(pos);
   }
+  waypoint_ind_ = min_ind;
 
   int ind_delta = 0;
   if (min_ind == -1) {
@@ -2,30 +2,34 @@
 #define HFN_HPP
 
 #include <boost/scoped_ptr.hpp>
-
-#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
-#include <CGAL/Polygon_2.h>
+#include <boost/shared_ptr.hpp>
 
 #include <ros/ros.h>
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <nav_msgs/Odometry.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <nav_msgs/OccupancyGrid.h>
 #include <sensor_msgs/LaserScan.h>
+#include <visualization_msgs/Marker.h>
 #include <actionlib/server/simple_action_server.h>
 
 #include <scarab_msgs/MoveAction.h>
 
+#include "player_map/dstar_lite.hpp"
 #include "player_map/rosmap.hpp"
+#include "dynamic_window.hpp"
+#include "free_space.hpp"
+#include "scan_inflation.hpp"
 
 namespace scarab {
 
 class HumanFriendlyNav {
 public:
-  typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
-  typedef K::Point_2 Point_2;
-  typedef K::Vector_2 Vector_2;
-  typedef CGAL::Polygon_2<K> Polygon_2;
+  enum ControllerType {
+    HFN_CONTROLLER, // steer toward the goal or the nearest free point
+    DWA_CONTROLLER  // best arc of the dynamic window
+  };
 
   struct Params {
     double axle_width;
@@ -43,6 +47,9 @@ public:
     double freq;
     std::string map_frame;
     std::string base_frame;
+
+    ControllerType controller;
+    DynamicWindow::Params dwa; // used by DWA_CONTROLLER
   };
 
   HumanFriendlyNav(Params p);
@@ -64,8 +71,8 @@ public:
     return free_distance_;
   }
 
-  const Polygon_2& inflatedPolygon() {
-    return polygon_;
+  const FreeSpace& inflatedPolygon() {
+    return free_space_;
   }
 
   const Params &params() { return params_; }
@@ -76,17 +83,17 @@ private:
   double desiredVelocity(double distance, double alpha);
 
   void freeDistance(const sensor_msgs::LaserScan &input);
-  void addObstacle(std::vector<float>::iterator &it, float scan_dist);
-  float calcReducedRange(float d, float r, float theta);
   float obstacleRadius();
   void twistToWheelVel(const geometry_msgs::Twist &twist, double &left, double &right);
   void wheelVelToTwist(double left, double right, geometry_msgs::Twist *twist);
 
   Params params_;
   sensor_msgs::LaserScan free_distance_;
+  ScanInflation inflation_;
   geometry_msgs::Pose pose_, goal_;
   geometry_msgs::Twist current_twist_, goal_twist_;
-  Polygon_2 polygon_;  // Polygon of free_distance_
+  FreeSpace free_space_;  // Polygon of free_distance_
+  DynamicWindow dwa_;
   ros::Time last_ztime;
   double prev_zerr_;
 };
@@ -102,6 +109,7 @@ public:
     double goal_tol_ang;     // max angle difference for goal to be reached
     double path_margin;      // max margin for path planning
     double waypoint_spacing; // max distance between waypoints
+    double waypoint_window;  // distance along the path to track waypoints in
     double los_margin;       // margin for line of sight checks
     double timeout;          // time at which an action is aborted
     double stuck_distance;   // radius of neighborhood for when a robot is stuck
@@ -112,7 +120,13 @@ public:
     int occupied_threshold;  // min occupancy grid value for occupied space
     bool allow_unknown_path; // allow paths through unknown space
     bool allow_unknown_los;  // allow line of sight through unknown space
+    scarab::OccupancyMap::PlannerType planner; // search used for paths to goals
+    bool incremental_replan; // keep D* Lite searches to repair on map updates
+    bool cache_goal_paths;   // keep shortest paths to goals for repeat visits
+    bool costmap_updates;    // publish changed costmap tiles on costmap_updates
     double min_map_update;   // Wait at least this time before updating map
+    std::string cspace_file; // map saved by make_cspace to start with, if set
+    std::string shared_map;  // shared_map_server map to use instead of map
     std::string map_frame;
     std::string name_space;
   };
@@ -132,7 +146,7 @@ public:
 
   void onPose(const geometry_msgs::PoseStamped &input);
   void onMap(const nav_msgs::OccupancyGrid &input);
-  void onLaserScan(const sensor_msgs::LaserScan &scan);
+  void onLaserScan(const sensor_msgs::LaserScanConstPtr &scan);
   void onOdom(const nav_msgs::Odometry &odom);
   void stop();
   void setGoal(const std::vector<geometry_msgs::PoseStamped> &p);
@@ -144,8 +158,29 @@ private:
 
   // Return true if we can follow a waypoint, false otherwise
   bool updateWaypoint();
+  // Sort waypoints_ into buckets for findWaypoint()
+  void indexWaypoints();
+  // Closest waypoint visible from pos, or -1 if there is none
+  int findWaypoint(const Eigen::Vector2f &pos);
+  // Closest visible waypoint among candidates, pairs of squared distance and
+  // index, that is closer than sqrt(max_dist), or -1
+  int closestVisible(const Eigen::Vector2f &pos,
+                     std::vector<std::pair<float, int> > *candidates,
+                     float max_dist);
+  // True if map was made with the parameters in params_
+  bool cspaceMatches(const scarab::OccupancyMap &map) const;
+  // Start with the map and cspace saved in filename if it was made with the
+  // parameters in params_
+  void loadCSpace(const std::string &filename);
+  // Attach to the shared map once it is served, then follow its changes
+  void onSharedMapTimer(const ros::TimerEvent &event);
+  // Publish and replan for a new or changed map
+  void mapUpdated();
+  // Publish the costmap, or only its changed tiles if costmap_updates is set
+  void publishCostMap();
+  void onCostMapConnect(const ros::SingleSubscriberPublisher &pub);
   void pubWaypoints();
-  void pubPolygon(const HumanFriendlyNav::Polygon_2 &polygon);
+  void pubPolygon(const FreeSpace &polygon);
   bool initialized() {
     return flags_.have_pose && flags_.have_odom && flags_.have_map &&
       flags_.have_laser;
@@ -155,7 +190,10 @@ private:
 
   ros::NodeHandle nh_;
   ros::Publisher path_pub_, vis_pub_, vel_pub_, inflated_pub_, costmap_pub_;
+  ros::Publisher costmap_updates_pub_;
+  std::vector<map_msgs::OccupancyGridUpdate> costmap_updates_;
   ros::Subscriber pose_sub_, map_sub_, odom_sub_, laser_sub_;
+  visualization_msgs::Marker polygon_marker_;  // Reused by pubPolygon()
 
   boost::function<void(Status)> callback_;
   bool active_; // True if we're navigating to a goal
@@ -164,10 +202,20 @@ private:
   std::vector<geometry_msgs::PoseStamped> goals_;
   std::list<geometry_msgs::PoseStamped> pose_history_;
   scarab::Path waypoints_;
+  int waypoint_ind_; // closest visible waypoint at the last scan, -1 if lost
+  // Waypoint indices in square buckets covering waypoints_, starting at
+  // bucket_origin_
+  Eigen::Vector2f bucket_origin_;
+  int buckets_x_, buckets_y_;
+  std::vector<std::vector<int> > buckets_;
+  // Waypoints to check for line of sight, reused from scan to scan
+  std::vector<std::pair<float, int> > candidates_;
   boost::scoped_ptr<scarab::OccupancyMap> map_;
+  // One search per goal, kept while navigating if incremental_replan is set
+  std::vector<boost::shared_ptr<scarab::DStarLite> > replanners_;
   Params params_;
   HumanFriendlyNav *hfn_;
-  ros::Timer timeout_timer_;
+  ros::Timer timeout_timer_, shared_map_timer_;
   ros::Time goal_time_, last_map_update_;
   struct {
     bool have_pose, have_odom, have_map, have_laser;
@@ -0,0 +1,53 @@
+// Save the map from a map server with its cspace and costs, for the
+// cspace_file parameter of hfn to load at startup instead of computing them.
+//
+//   rosrun hfn make_cspace <file> [_max_occ_dist:=0.5] [_lethal_occ_dist:=0.23]
+//     [_cost_occ_prob:=0.0] [_cost_occ_dist:=0.0] [_free_threshold:=0]
+//     [_occupied_threshold:=100] [_map_service:=static_map]
+//
+// The parameters must match those given to hfn.
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+
+#include "player_map/rosmap.hpp"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "make_cspace", ros::init_options::AnonymousName);
+  if (argc < 2) {
+    ROS_ERROR("Usage: make_cspace <file>");
+    return 1;
+  }
+  ros::NodeHandle nh("~");
+  double max_occ_dist, lethal_occ_dist, cost_occ_prob, cost_occ_dist;
+  int free_threshold, occupied_threshold;
+  string map_service;
+  nh.param("max_occ_dist", max_occ_dist, 0.5);
+  nh.param("lethal_occ_dist", lethal_occ_dist, 0.23);
+  nh.param("cost_occ_prob", cost_occ_prob, 0.0);
+  nh.param("cost_occ_dist", cost_occ_dist, 0.0);
+  nh.param("free_threshold", free_threshold, 0);
+  nh.param("occupied_threshold", occupied_threshold, 100);
+  nh.param("map_service", map_service, string("static_map"));
+
+  boost::scoped_ptr<scarab::OccupancyMap> map(
+    scarab::OccupancyMap::FromMapServer(map_service.c_str(), free_threshold,
+                                        occupied_threshold));
+  if (map->map() == NULL) {
+    return 1;
+  }
+  ros::WallTime start = ros::WallTime::now();
+  map->updateCSpace(max_occ_dist, lethal_occ_dist, cost_occ_prob,
+                    cost_occ_dist);
+  ROS_INFO("Computed the cspace in %.3f s",
+           (ros::WallTime::now() - start).toSec());
+  if (!map->save(argv[1])) {
+    return 1;
+  }
+  ROS_INFO("Saved %d x %d map to %s", map->numX(), map->numY(), argv[1]);
+  return 0;
+}
@@ -30,9 +30,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "player_map/map.h"
 
+#define MAP_FILE_MAGIC "PMAPCSPC"
+#define MAP_FILE_BYTE_ORDER 0x01020304
+
+// Bytes per cell over all planes
+#define MAP_CELL_BYTES (sizeof(float) + sizeof(uint16_t) + sizeof(uint8_t) + \
+                        sizeof(int8_t))
+
 // Create a new map
 map_t *map_alloc(void) {
   map_t *map;
@@ -49,67 +60,546 @@ map_t *map_alloc(void) {
   map->scale = 0;
 
   // Allocate storage for main map
-  map->cells = (map_cell_t*) NULL;
+  map->data = NULL;
+  map->mapping = NULL;
+  map->mapping_size = 0;
+  map->occ_state = NULL;
+  map->occ_prob = NULL;
+  map->occ_dist = NULL;
+  map->cost = NULL;
+  map->max_occ_dist = 0;
 
   return map;
 }
 
 
+// Release the cell planes, whether allocated or mapped
+static void map_free_cells(map_t *map) {
+  if (map->mapping != NULL) {
+    munmap(map->mapping, map->mapping_size);
+    map->mapping = NULL;
+    map->mapping_size = 0;
+  } else {
+    free(map->data);
+  }
+  map->data = NULL;
+}
+
+
 // Destroy a map
 void map_free(map_t *map) {
-  free(map->cells);
+  map_free_cells(map);
   free(map);
   return;
 }
 
 
-// Get the cell at the given point
-map_cell_t *map_get_cell(map_t *map, double ox, double oy, double oa) {
+// Point the plane pointers into map->data
+static void map_set_planes(map_t *map) {
+  size_t ncells;
+  char *data;
+
+  ncells = (size_t) map->size_x * map->size_y;
+  data = (char*) map->data;
+  map->cost = (float*) data;
+  map->occ_dist = (uint16_t*) (data + ncells * sizeof(float));
+  map->occ_state = (uint8_t*) (data + ncells * (sizeof(float) + sizeof(uint16_t)));
+  map->occ_prob = (int8_t*) (map->occ_state + ncells);
+}
+
+
+// Allocate the cell planes.  All planes share one block of memory, ordered
+// by decreasing alignment.
+int map_alloc_cells(map_t *map, int size_x, int size_y) {
+  size_t ncells;
+  char *data;
+
+  ncells = (size_t) size_x * size_y;
+  data = (char*) malloc(ncells * MAP_CELL_BYTES);
+  if (data == NULL) {
+    return -1;
+  }
+
+  map_free_cells(map);
+  map->size_x = size_x;
+  map->size_y = size_y;
+  map->data = data;
+  map_set_planes(map);
+  return 0;
+}
+
+
+// Get the index of the cell at the given point
+int map_get_index(const map_t *map, double ox, double oy) {
   int i, j;
-  map_cell_t *cell;
 
   i = MAP_GXWX(map, ox);
   j = MAP_GYWY(map, oy);
 
   if (!MAP_VALID(map, i, j)) {
-    return NULL;
+    return -1;
   }
+  return MAP_INDEX(map, i, j);
+}
+
 
-  cell = map->cells + MAP_INDEX(map, i, j);
-  return cell;
+// Get the cell at the given point
+int map_get_cell(const map_t *map, double ox, double oy, map_cell_t *cell) {
+  int index;
+
+  index = map_get_index(map, ox, oy);
+  if (index < 0) {
+    return 0;
+  }
+  *cell = map_cell(map, index);
+  return 1;
 }
 
 
-// Update the cspace distance values
-// TODO: replace this with a more efficient implementation.  Not crucial,
-// because we only do it once, at startup.
+// Load an occupancy map from a binary (P5) PGM image.  Pixels are converted
+// to occupancy values using map_server's default thresholds, and the image is
+// flipped so that the first row of the file is the top of the map.
+int map_load_occ(map_t *map, const char *filename, double scale, int negate) {
+  FILE *file;
+  char magic[3];
+  int width, height, maxval;
+  int i, j, c;
+  unsigned char *row;
+  double occ;
+  int index;
+
+  file = fopen(filename, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "map_load_occ: failed to open %s\n", filename);
+    return -1;
+  }
+
+  // Read the header, skipping any comment lines
+  if (fscanf(file, "%2s", magic) != 1 || strcmp(magic, "P5") != 0) {
+    fprintf(stderr, "map_load_occ: %s is not a binary PGM\n", filename);
+    fclose(file);
+    return -1;
+  }
+  for (i = 0; i < 3; i++) {
+    while ((c = fgetc(file)) == '#' || c == ' ' || c == '\t' ||
+           c == '\n' || c == '\r') {
+      if (c == '#') {
+        while ((c = fgetc(file)) != '\n' && c != EOF) {
+          ;
+        }
+      }
+    }
+    ungetc(c, file);
+    if (fscanf(file, "%d", i == 0 ? &width : (i == 1 ? &height : &maxval)) != 1) {
+      fprintf(stderr, "map_load_occ: malformed header in %s\n", filename);
+      fclose(file);
+      return -1;
+    }
+  }
+  fgetc(file);
+  if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255) {
+    fprintf(stderr, "map_load_occ: unsupported image format in %s\n", filename);
+    fclose(file);
+    return -1;
+  }
+
+  row = (unsigned char*) malloc(width);
+  if (row == NULL || map_alloc_cells(map, width, height) != 0) {
+    free(row);
+    fclose(file);
+    return -1;
+  }
+  map->scale = scale;
+  map->max_occ_dist = 0.0;
+
+  for (j = height - 1; j >= 0; j--) {
+    if (fread(row, 1, width, file) != (size_t) width) {
+      fprintf(stderr, "map_load_occ: %s is truncated\n", filename);
+      free(row);
+      fclose(file);
+      return -1;
+    }
+    for (i = 0; i < width; i++) {
+      index = MAP_INDEX(map, i, j);
+      occ = (double) row[i] / maxval;
+      if (!negate) {
+        occ = 1.0 - occ;
+      }
+      if (occ > 0.65) {
+        map->occ_state[index] = OCCUPIED;
+        map->occ_prob[index] = 100;
+      } else if (occ < 0.196) {
+        map->occ_state[index] = FREE;
+        map->occ_prob[index] = 0;
+      } else {
+        map->occ_state[index] = UNKNOWN;
+        map->occ_prob[index] = -1;
+      }
+      map->occ_dist[index] = 0;
+      map->cost[index] = 0;
+    }
+  }
+
+  free(row);
+  fclose(file);
+  return 0;
+}
+
+
+// Write all of buf to fd.  Returns 0 on success.
+static int map_write_all(int fd, const void *buf, size_t size) {
+  const char *p;
+  ssize_t n;
+
+  p = (const char*) buf;
+  while (size > 0) {
+    n = write(fd, p, size);
+    if (n < 0) {
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+
+// Write the map header and cell planes.  The header is padded to a multiple
+// of 64 bytes so that the planes keep their alignment when mapped.
+int map_write_fd(const map_t *map, int fd, map_file_header_t *header,
+                 const void *extra) {
+  char pad[64];
+
+  memcpy(header->magic, MAP_FILE_MAGIC, sizeof(header->magic));
+  header->version = MAP_FILE_VERSION;
+  header->byte_order = MAP_FILE_BYTE_ORDER;
+  header->header_size = (sizeof(map_file_header_t) + 63) / 64 * 64;
+  header->size_x = map->size_x;
+  header->size_y = map->size_y;
+  header->origin_x = map->origin_x;
+  header->origin_y = map->origin_y;
+  header->scale = map->scale;
+  header->max_occ_dist = map->max_occ_dist;
+
+  memset(pad, 0, sizeof(pad));
+  if (map_write_all(fd, header, sizeof(map_file_header_t)) != 0 ||
+      map_write_all(fd, pad, header->header_size -
+                    sizeof(map_file_header_t)) != 0 ||
+      map_write_all(fd, map->data, (size_t) map->size_x * map->size_y *
+                    MAP_CELL_BYTES) != 0 ||
+      map_write_all(fd, extra, header->extra_size) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+
+// Save the map to a file
+int map_save(const map_t *map, const char *filename, map_file_header_t *header,
+             const void *extra) {
+  int fd;
+
+  fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "map_save: failed to open %s\n", filename);
+    return -1;
+  }
+  if (map_write_fd(map, fd, header, extra) != 0 || close(fd) != 0) {
+    fprintf(stderr, "map_save: failed to write %s\n", filename);
+    close(fd);
+    return -1;
+  }
+  return 0;
+}
+
+
+// Map a file written by map_save().  The mapping is private and writable, so
+// pages are only read (and copied) when the map is used or changed.
+int map_open(map_t *map, const char *filename, map_file_header_t *header,
+             const void **extra) {
+  int fd, result;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "map_open: failed to open %s\n", filename);
+    return -1;
+  }
+  result = map_open_fd(map, fd, 0, MAP_OPEN_PRIVATE, header, extra);
+  close(fd);
+  if (result != 0) {
+    fprintf(stderr, "map_open: failed to load %s\n", filename);
+  }
+  return result;
+}
+
+
+// Map the map_save() contents from offset in fd
+int map_open_fd(map_t *map, int fd, size_t offset, int mode,
+                map_file_header_t *header, const void **extra) {
+  struct stat st;
+  void *mapping;
+  size_t size;
+
+  if (fstat(fd, &st) != 0 ||
+      (size_t) st.st_size < offset + sizeof(map_file_header_t) ||
+      pread(fd, header, sizeof(map_file_header_t), offset) !=
+      (ssize_t) sizeof(map_file_header_t)) {
+    fprintf(stderr, "map_open_fd: failed to read the header\n");
+    return -1;
+  }
+  size = (size_t) st.st_size - offset;
+  if (memcmp(header->magic, MAP_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != MAP_FILE_VERSION ||
+      header->byte_order != MAP_FILE_BYTE_ORDER) {
+    fprintf(stderr, "map_open_fd: not a version %d map for this machine\n",
+            MAP_FILE_VERSION);
+    return -1;
+  }
+  if (header->header_size < sizeof(map_file_header_t) ||
+      header->header_size % 64 != 0 ||
+      header->size_x < 0 || header->size_y < 0 ||
+      header->header_size > size || header->extra_size > size ||
+      size != header->header_size + header->extra_size +
+      (size_t) header->size_x * header->size_y * MAP_CELL_BYTES) {
+    fprintf(stderr, "map_open_fd: the map has the wrong size\n");
+    return -1;
+  }
+
+  if (mode == MAP_OPEN_PRIVATE) {
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+  } else if (mode == MAP_OPEN_SHARED_READ) {
+    mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, offset);
+  } else {
+    mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+  }
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "map_open_fd: failed to map %zu bytes\n", size);
+    return -1;
+  }
+
+  map_free_cells(map);
+  map->mapping = mapping;
+  map->mapping_size = size;
+  map->data = (char*) mapping + header->header_size;
+  map->size_x = header->size_x;
+  map->size_y = header->size_y;
+  map->origin_x = header->origin_x;
+  map->origin_y = header->origin_y;
+  map->scale = header->scale;
+  map->max_occ_dist = header->max_occ_dist;
+  map_set_planes(map);
+  *extra = (char*) map->data + (size_t) map->size_x * map->size_y * MAP_CELL_BYTES;
+  return 0;
+}
+
+
+// One dimensional squared distance transform of the sampled function f
+// (second phase of Meijster, Roerdink & Hesselink, "A General Algorithm for
+// Computing Distance Transforms in Linear Time").  Results are written to d.
+// s and t are scratch arrays of length n.
+static void map_edt_1d(const int *f, int n, int *d, int *s, int *t) {
+  int q, u, w;
+
+  q = 0;
+  s[0] = 0;
+  t[0] = 0;
+  for (u = 1; u < n; u++) {
+    while (q >= 0 && (t[q] - s[q]) * (t[q] - s[q]) + f[s[q]] >
+                     (t[q] - u) * (t[q] - u) + f[u]) {
+      q--;
+    }
+    if (q < 0) {
+      q = 0;
+      s[0] = u;
+    } else {
+      w = 1 + (u * u - s[q] * s[q] + f[u] - f[s[q]]) / (2 * (u - s[q]));
+      if (w < n) {
+        q++;
+        s[q] = u;
+        t[q] = w;
+      }
+    }
+  }
+
+  for (u = n - 1; u >= 0; u--) {
+    d[u] = (u - s[q]) * (u - s[q]) + f[s[q]];
+    if (u == t[q]) {
+      q--;
+    }
+  }
+}
+
+
+// Limit max_occ_dist to the largest distance the occ_dist plane can hold
+static double map_limit_occ_dist(map_t *map, double max_occ_dist) {
+  if (max_occ_dist > MAP_DIST_MAX_CELLS * map->scale) {
+    fprintf(stderr, "map_update_cspace: limiting max_occ_dist to %f\n",
+            MAP_DIST_MAX_CELLS * map->scale);
+    return MAP_DIST_MAX_CELLS * map->scale;
+  }
+  return max_occ_dist;
+}
+
+
+// Recompute the cspace distance values of the cells in
+// [min_i, max_i) x [min_j, max_j) using a separable exact Euclidean distance
+// transform (Meijster et al.).  Only obstacles within max_occ_dist of the
+// region can affect it, so the transform runs over the region dilated by
+// that margin.
+static void map_update_cspace_window(map_t *map, int min_i, int min_j,
+                                     int max_i, int max_j) {
+  int i, j, n, s;
+  int wmin_i, wmin_j, wmax_i, wmax_j, width, height;
+  int *dist, *row, *line, *v, *z;
+  const uint8_t *state;
+  uint16_t *occ_dist;
+  double d;
+
+  // Column distances beyond s cells can never produce an occ_dist below
+  // max_occ_dist, so they are clamped to keep the arithmetic small.
+  s = (int) ceil(map->max_occ_dist / map->scale);
+
+  wmin_i = min_i - s > 0 ? min_i - s : 0;
+  wmin_j = min_j - s > 0 ? min_j - s : 0;
+  wmax_i = max_i + s < map->size_x ? max_i + s : map->size_x;
+  wmax_j = max_j + s < map->size_y ? max_j + s : map->size_y;
+  width = wmax_i - wmin_i;
+  height = wmax_j - wmin_j;
+  if (max_i <= min_i || max_j <= min_j || width <= 0 || height <= 0) {
+    return;
+  }
+
+  dist = (int*) malloc(sizeof(int) * width * height);
+  line = (int*) malloc(sizeof(int) * width);
+  v = (int*) malloc(sizeof(int) * width);
+  z = (int*) malloc(sizeof(int) * width);
+  assert(dist && line && v && z);
+
+  // Distance to the nearest occupied cell in the same column, computed one
+  // row at a time so that memory is accessed sequentially
+  for (j = 0; j < height; j++) {
+    row = dist + j * width;
+    state = map->occ_state + MAP_INDEX(map, wmin_i, wmin_j + j);
+    for (i = 0; i < width; i++) {
+      if (state[i] == OCCUPIED) {
+        row[i] = 0;
+      } else if (j == 0) {
+        row[i] = s + 1;
+      } else {
+        row[i] = row[i - width] + 1;
+        if (row[i] > s + 1) {
+          row[i] = s + 1;
+        }
+      }
+    }
+  }
+  for (j = height - 2; j >= 0; j--) {
+    row = dist + j * width;
+    for (i = 0; i < width; i++) {
+      if (row[i + width] + 1 < row[i]) {
+        row[i] = row[i + width] + 1;
+      }
+    }
+  }
+
+  // Combine the squared column distances along each row, skipping rows that
+  // have no obstacle within s cells
+  for (j = min_j; j < max_j; j++) {
+    row = dist + (j - wmin_j) * width;
+    occ_dist = map->occ_dist + MAP_INDEX(map, 0, j);
+    n = 0;
+    for (i = 0; i < width; i++) {
+      if (row[i] <= s) {
+        n = 1;
+      }
+      row[i] *= row[i];
+    }
+    if (!n) {
+      for (i = min_i; i < max_i; i++) {
+        occ_dist[i] = MAP_DIST_MAX;
+      }
+      continue;
+    }
+
+    map_edt_1d(row, width, line, v, z);
+    for (i = min_i; i < max_i; i++) {
+      n = line[i - wmin_i];
+      if (n > s * s) {
+        occ_dist[i] = MAP_DIST_MAX;
+      } else {
+        d = map->scale * sqrt(n);
+        occ_dist[i] = d < map->max_occ_dist ? n : MAP_DIST_MAX;
+      }
+    }
+  }
+
+  free(z);
+  free(v);
+  free(line);
+  free(dist);
+}
+
+
+// Update the cspace distance values.  Runs in O(size_x * size_y) independent
+// of max_occ_dist, and yields the same values as map_update_cspace_brute().
 void map_update_cspace(map_t *map, double max_occ_dist) {
+  map->max_occ_dist = map_limit_occ_dist(map, max_occ_dist);
+  map_update_cspace_window(map, 0, 0, map->size_x, map->size_y);
+  return;
+}
+
+
+// Set max_occ_dist for later region updates
+void map_set_max_occ_dist(map_t *map, double max_occ_dist) {
+  map->max_occ_dist = map_limit_occ_dist(map, max_occ_dist);
+  return;
+}
+
+
+// Update the cspace distance values of the cells in
+// [min_i, max_i) x [min_j, max_j) after the occupancy of cells in that region
+// changed.  Cells outside of the region keep their distances, so the region
+// must include every cell within max_occ_dist of a changed cell.
+void map_update_cspace_region(map_t *map, int min_i, int min_j,
+                              int max_i, int max_j) {
+  min_i = min_i > 0 ? min_i : 0;
+  min_j = min_j > 0 ? min_j : 0;
+  max_i = max_i < map->size_x ? max_i : map->size_x;
+  max_j = max_j < map->size_y ? max_j : map->size_y;
+  map_update_cspace_window(map, min_i, min_j, max_i, max_j);
+  return;
+}
+
+
+// Update the cspace distance values by stamping a window around every
+// occupied cell.  Costs O(occupied * (max_occ_dist / scale)^2); kept as a
+// reference for map_update_cspace().
+void map_update_cspace_brute(map_t *map, double max_occ_dist) {
   int i, j;
   int ni, nj;
   int s;
   double d;
-  map_cell_t *cell, *ncell;
+  int index, nindex;
 
-  map->max_occ_dist = max_occ_dist;
+  map->max_occ_dist = map_limit_occ_dist(map, max_occ_dist);
   s = (int) ceil(map->max_occ_dist / map->scale);
 
   // Reset the distance values
   for (j = 0; j < map->size_y; j++) {
     for (i = 0; i < map->size_x; i++) {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      cell->occ_dist = map->max_occ_dist;
+      map->occ_dist[MAP_INDEX(map, i, j)] = MAP_DIST_MAX;
     }
   }
 
   // Find all the occupied cells and update their neighbours
   for (j = 0; j < map->size_y; j++) {
     for (i = 0; i < map->size_x; i++) {
-      cell = map->cells + MAP_INDEX(map, i, j);
-      if (cell->occ_state != OCCUPIED) {
+      index = MAP_INDEX(map, i, j);
+      if (map->occ_state[index] != OCCUPIED) {
         continue;
       }
 
-      cell->occ_dist = 0;
+      map->occ_dist[index] = 0;
 
       // Update adjacent cells
       for (nj = -s; nj <= +s; nj++) {
@@ -118,11 +608,11 @@ void map_update_cspace(map_t *map, double max_occ_dist) {
             continue;
           }
 
-          ncell = map->cells + MAP_INDEX(map, i + ni, j + nj);
+          nindex = MAP_INDEX(map, i + ni, j + nj);
           d = map->scale * sqrt(ni * ni + nj * nj);
 
-          if (d < ncell->occ_dist) {
-            ncell->occ_dist = d;
+          if (d < map_occ_dist(map, nindex)) {
+            map->occ_dist[nindex] = ni * ni + nj * nj;
           }
         }
       }
@@ -0,0 +1,1157 @@
+// Benchmarks for the map and planning routines in player_map, run against
+// PGM images such as the ones shipped in scarab/maps.
+//
+// Usage: map_benchmark [-r resolution] [-d max_occ_dist] [-l lethal_occ_dist]
+//                      [-n queries] map.pgm [map.pgm ...]
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <limits>
+#include <vector>
+
+#include "player_map/cost_kernels.hpp"
+#include "player_map/dstar_lite.hpp"
+#include "player_map/map.h"
+#include "player_map/rosmap.hpp"
+#include "player_map/tiled_map.hpp"
+
+using namespace std;
+
+struct BenchmarkParams {
+  double resolution;
+  double max_occ_dist;
+  double lethal_occ_dist;
+  int queries;
+};
+
+double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+map_t* loadMap(const char *filename, double resolution) {
+  map_t *map = map_alloc();
+  if (map_load_occ(map, filename, resolution, 0) != 0) {
+    map_free(map);
+    return NULL;
+  }
+  return map;
+}
+
+// Load a map as an occupancy grid
+void loadGrid(const char *filename, double resolution,
+              nav_msgs::OccupancyGrid *grid) {
+  map_t *map = loadMap(filename, resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  grid->info.width = map->size_x;
+  grid->info.height = map->size_y;
+  grid->info.resolution = map->scale;
+  grid->info.origin.position.x = map->origin_x - map->size_x / 2 * map->scale;
+  grid->info.origin.position.y = map->origin_y - map->size_y / 2 * map->scale;
+  grid->data.assign(map->occ_prob, map->occ_prob + map->size_x * map->size_y);
+  map_free(map);
+}
+
+// Compare the distance transform against the brute-force cspace update
+void benchCSpace(const char *filename, const BenchmarkParams &params) {
+  map_t *brute = loadMap(filename, params.resolution);
+  map_t *edt = loadMap(filename, params.resolution);
+  if (brute == NULL || edt == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+
+  double start = wallTime();
+  map_update_cspace_brute(brute, params.max_occ_dist);
+  double brute_time = wallTime() - start;
+
+  start = wallTime();
+  map_update_cspace(edt, params.max_occ_dist);
+  double edt_time = wallTime() - start;
+
+  int ncells = brute->size_x * brute->size_y;
+  int mismatches = 0;
+  for (int i = 0; i < ncells; ++i) {
+    if (brute->occ_dist[i] != edt->occ_dist[i]) {
+      ++mismatches;
+    }
+  }
+
+  printf("%s (%d x %d, max_occ_dist %.2f)\n", filename, brute->size_x,
+         brute->size_y, params.max_occ_dist);
+  printf("  cspace brute force: %9.2f ms\n", 1e3 * brute_time);
+  printf("  cspace transform:   %9.2f ms (%.1fx)\n", 1e3 * edt_time,
+         brute_time / edt_time);
+  printf("  mismatched cells:   %9d\n", mismatches);
+
+  map_free(brute);
+  map_free(edt);
+}
+
+// Draw n random traversable points, with a fixed seed so that runs are
+// comparable
+vector<Eigen::Vector2f> randomFreePoints(const map_t *map, int n,
+                                         unsigned seed) {
+  vector<int> free_cells;
+  for (int i = 0; i < map->size_x * map->size_y; ++i) {
+    if (map->occ_state[i] == map_cell_t::FREE && !isinf(map->cost[i])) {
+      free_cells.push_back(i);
+    }
+  }
+
+  vector<Eigen::Vector2f> points;
+  srand(seed);
+  for (int k = 0; k < n && !free_cells.empty(); ++k) {
+    int index = free_cells[rand() % free_cells.size()];
+    points.push_back(Eigen::Vector2f(MAP_WXGX(map, index % map->size_x),
+                                     MAP_WYGY(map, index / map->size_x)));
+  }
+  return points;
+}
+
+// Compare the open list implementations on A* and Dijkstra searches
+void benchSearch(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  vector<Eigen::Vector2f> points = randomFreePoints(map, 2 * params.queries, 1);
+  if (points.empty()) {
+    return;
+  }
+
+  const char *names[] = {"set", "heap", "bucket"};
+  scarab::OccupancyMap::QueueType types[] = {
+    scarab::OccupancyMap::SET_QUEUE, scarab::OccupancyMap::HEAP_QUEUE,
+    scarab::OccupancyMap::BUCKET_QUEUE
+  };
+  for (int q = 0; q < 3; ++q) {
+    occ_map.setQueueType(types[q]);
+
+    double astar_time = 0.0;
+    long astar_expanded = 0;
+    for (size_t k = 0; k + 1 < points.size(); k += 2) {
+      double start = wallTime();
+      occ_map.astar(points[k].x(), points[k].y(),
+                    points[k+1].x(), points[k+1].y(),
+                    params.lethal_occ_dist);
+      astar_time += wallTime() - start;
+      astar_expanded += occ_map.numExpanded();
+    }
+
+    // A new source each time, finished searches are cached
+    double start = wallTime();
+    occ_map.prepareAllShortestPaths(points[q].x(), points[q].y(),
+                                    params.lethal_occ_dist);
+    double dijkstra_time = wallTime() - start;
+
+    printf("  %-6s astar:    %9.2f ms/query %12.0f expansions/s\n", names[q],
+           1e3 * astar_time / (points.size() / 2), astar_expanded / astar_time);
+    printf("  %-6s dijkstra: %9.2f ms       %12.0f expansions/s\n", names[q],
+           1e3 * dijkstra_time, occ_map.numExpanded() / dijkstra_time);
+  }
+}
+
+// True if a segment of the path passes through a cell that the planners may
+// not enter, sampled every tenth of a cell.  A segment through the corner
+// between cells only touches them at a point, so samples there are skipped.
+bool crossesLethal(const scarab::OccupancyMap &occ_map,
+                   const scarab::Path &path) {
+  const map_t *map = occ_map.map();
+  for (size_t k = 0; k + 1 < path.size(); ++k) {
+    int n = ceil(10.0 * (path[k+1] - path[k]).norm() / map->scale);
+    for (int s = 0; s <= n; ++s) {
+      Eigen::Vector2f p = path[k] + (path[k+1] - path[k]) * (float(s) / max(n, 1));
+      // Offsets from the nearest cell borders
+      double u = (p.x() - map->origin_x) / map->scale + 0.5;
+      double v = (p.y() - map->origin_y) / map->scale + 0.5;
+      if (fabs(u - floor(u + 0.5)) < 1e-3 && fabs(v - floor(v + 0.5)) < 1e-3) {
+        continue;
+      }
+      if (!occ_map.traversable(MAP_GXWX(map, p.x()), MAP_GYWY(map, p.y()),
+                               false)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Compare the planners on the same random queries
+void benchPlanners(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  vector<Eigen::Vector2f> points = randomFreePoints(map, 2 * params.queries, 2);
+
+  const char *names[] = {"astar", "jps", "theta*", "hier"};
+  scarab::OccupancyMap::PlannerType types[] = {
+    scarab::OccupancyMap::ASTAR_PLANNER, scarab::OccupancyMap::JPS_PLANNER,
+    scarab::OccupancyMap::THETA_STAR_PLANNER,
+    scarab::OccupancyMap::HIERARCHICAL_PLANNER
+  };
+  for (int p = 0; p < 4; ++p) {
+    double time = 0.0, length = 0.0;
+    long expanded = 0;
+    int lethal_paths = 0;
+    for (size_t k = 0; k + 1 < points.size(); k += 2) {
+      double start = wallTime();
+      scarab::Path path =
+        occ_map.plan(types[p], points[k].x(), points[k].y(),
+                     points[k+1].x(), points[k+1].y(), params.lethal_occ_dist);
+      time += wallTime() - start;
+      expanded += occ_map.numExpanded();
+      if (path.size() > 1) {
+        length += scarab::pathLength(path);
+      }
+      if (crossesLethal(occ_map, path)) {
+        ++lethal_paths;
+      }
+    }
+    printf("  %-6s plan:     %9.2f ms/query %12ld expansions %9.1f m, "
+           "%d paths cross lethal cells\n",
+           names[p], 1e3 * time / (points.size() / 2), expanded, length,
+           lethal_paths);
+  }
+}
+
+// Replan after an obstacle appears on the path ahead of the robot, as with
+// map updates from SLAM, using D* Lite and astar() from scratch
+void benchReplan(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  nav_msgs::OccupancyGrid grid;
+  grid.info.width = map->size_x;
+  grid.info.height = map->size_y;
+  grid.info.resolution = map->scale;
+  grid.info.origin.position.x = map->origin_x - map->size_x / 2 * map->scale;
+  grid.info.origin.position.y = map->origin_y - map->size_y / 2 * map->scale;
+  grid.data.assign(map->occ_prob, map->occ_prob + map->size_x * map->size_y);
+
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(grid);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  vector<Eigen::Vector2f> points =
+    randomFreePoints(occ_map.map(), 2 * params.queries, 3);
+
+  double plan_time = 0.0, replan_time = 0.0, astar_time = 0.0;
+  long enclosed_expanded = 0, enclosed_astar_expanded = 0;
+  int replans = 0, mismatches = 0;
+  for (size_t k = 0; k + 1 < points.size(); k += 2) {
+    scarab::DStarLite dstar(&occ_map);
+    double start = wallTime();
+    scarab::Path path = dstar.plan(points[k].x(), points[k].y(),
+                                   points[k+1].x(), points[k+1].y());
+    plan_time += wallTime() - start;
+    if (path.size() < 50) {
+      continue;
+    }
+
+    // Drive 10 cells and find a 9x9 obstacle 30 cells ahead
+    nav_msgs::OccupancyGrid blocked = grid;
+    const map_t *m = occ_map.map();
+    int oi = MAP_GXWX(m, path[40].x()), oj = MAP_GYWY(m, path[40].y());
+    for (int j = max(0, oj - 4); j <= min(m->size_y - 1, oj + 4); ++j) {
+      for (int i = max(0, oi - 4); i <= min(m->size_x - 1, oi + 4); ++i) {
+        blocked.data[MAP_INDEX(m, i, j)] = 100;
+      }
+    }
+    occ_map.setMap(blocked);
+
+    start = wallTime();
+    scarab::Path replanned =
+      dstar.plan(path[10].x(), path[10].y(), points[k+1].x(), points[k+1].y());
+    replan_time += wallTime() - start;
+    start = wallTime();
+    scarab::Path astar_path =
+      occ_map.astar(path[10].x(), path[10].y(), points[k+1].x(),
+                    points[k+1].y(), params.lethal_occ_dist);
+    astar_time += wallTime() - start;
+    if (replanned.empty() != astar_path.empty() ||
+        (astar_path.size() > 1 &&
+         fabs(scarab::pathLength(replanned) -
+              scarab::pathLength(astar_path)) > 1e-3)) {
+      ++mismatches;
+    }
+    ++replans;
+
+    // Then wall the goal in, which both should find out without searching
+    // the whole map
+    int gi = MAP_GXWX(m, points[k+1].x()), gj = MAP_GYWY(m, points[k+1].y());
+    for (int j = max(0, gj - 8); j <= min(m->size_y - 1, gj + 8); ++j) {
+      for (int i = max(0, gi - 8); i <= min(m->size_x - 1, gi + 8); ++i) {
+        if (abs(i - gi) == 8 || abs(j - gj) == 8) {
+          blocked.data[MAP_INDEX(m, i, j)] = 100;
+        }
+      }
+    }
+    occ_map.setMap(blocked);
+    replanned =
+      dstar.plan(path[10].x(), path[10].y(), points[k+1].x(), points[k+1].y());
+    enclosed_expanded += dstar.numExpanded();
+    astar_path =
+      occ_map.astar(path[10].x(), path[10].y(), points[k+1].x(),
+                    points[k+1].y(), params.lethal_occ_dist);
+    enclosed_astar_expanded += occ_map.numExpanded();
+    if (replanned.empty() != astar_path.empty() ||
+        (astar_path.size() > 1 &&
+         fabs(scarab::pathLength(replanned) -
+              scarab::pathLength(astar_path)) > 1e-3)) {
+      ++mismatches;
+    }
+
+    occ_map.setMap(grid);
+  }
+  printf("  d*lite plan:     %9.2f ms/query\n",
+         1e3 * plan_time / (points.size() / 2));
+  printf("  d*lite replan:   %9.2f ms/query (astar %.2f ms)\n",
+         1e3 * replan_time / max(replans, 1), 1e3 * astar_time / max(replans, 1));
+  printf("  d*lite enclosed: %9ld expansions/query (astar %ld), "
+         "%d of %d paths differ from astar\n",
+         enclosed_expanded / max(replans, 1),
+         enclosed_astar_expanded / max(replans, 1), mismatches, 2 * replans);
+  map_free(map);
+}
+
+// Plan from random starts to a few fixed goals, as with trips to a charging
+// dock, with astar() and with cachedPath()
+void benchGoalCache(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  vector<Eigen::Vector2f> goals = randomFreePoints(map, 3, 4);
+  vector<Eigen::Vector2f> starts = randomFreePoints(map, params.queries, 5);
+
+  double astar_time = 0.0, cached_time = 0.0;
+  int mismatches = 0;
+  for (int round = 0; round < 2; ++round) {
+    for (size_t k = 0; k < starts.size(); ++k) {
+      const Eigen::Vector2f &goal = goals[k % goals.size()];
+      double start = wallTime();
+      scarab::Path astar_path =
+        occ_map.astar(starts[k].x(), starts[k].y(), goal.x(), goal.y(),
+                      params.lethal_occ_dist);
+      astar_time += wallTime() - start;
+      start = wallTime();
+      scarab::Path cached_path =
+        occ_map.cachedPath(starts[k].x(), starts[k].y(), goal.x(), goal.y(),
+                           params.lethal_occ_dist);
+      cached_time += wallTime() - start;
+      if (astar_path.empty() != cached_path.empty() ||
+          (astar_path.size() > 1 &&
+           fabs(scarab::pathLength(astar_path) -
+                scarab::pathLength(cached_path)) > 1e-3)) {
+        ++mismatches;
+      }
+    }
+  }
+  int queries = 2 * starts.size();
+
+  // Goals just inside lethal_occ_dist, which astar() never reaches
+  vector<int> lethal;
+  for (int j = 1; j + 1 < map->size_y; ++j) {
+    for (int i = 1; i + 1 < map->size_x; ++i) {
+      int index = MAP_INDEX(map, i, j);
+      if (isinf(map->cost[index]) &&
+          map->occ_state[index] == map_cell_t::FREE &&
+          (!isinf(map->cost[index - 1]) || !isinf(map->cost[index + 1]))) {
+        lethal.push_back(index);
+      }
+    }
+  }
+  srand(6);
+  for (size_t k = 0; k < starts.size() && !lethal.empty(); ++k) {
+    int index = lethal[rand() % lethal.size()];
+    double x = MAP_WXGX(map, index % map->size_x);
+    double y = MAP_WYGY(map, index / map->size_x);
+    scarab::Path astar_path =
+      occ_map.astar(starts[k].x(), starts[k].y(), x, y,
+                    params.lethal_occ_dist);
+    scarab::Path cached_path =
+      occ_map.cachedPath(starts[k].x(), starts[k].y(), x, y,
+                         params.lethal_occ_dist);
+    mismatches += astar_path.empty() != cached_path.empty();
+  }
+
+  printf("  goal astar:      %9.2f ms/query\n", 1e3 * astar_time / queries);
+  printf("  goal cached:     %9.2f ms/query (%d mismatched lengths)\n",
+         1e3 * cached_time / queries, mismatches);
+}
+
+// Costs from 10 robots to 50 goals, as for task allocation, with astar() on
+// every pair and with costMatrix()
+void benchCostMatrix(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  scarab::Path robots, goals;
+  vector<Eigen::Vector2f> points = randomFreePoints(map, 60, 6);
+  robots.assign(points.begin(), points.begin() + 10);
+  goals.assign(points.begin() + 10, points.end());
+
+  // Without cost factors the cost of a path is its length in cells, up to
+  // float rounding
+  vector<float> astar_costs(robots.size() * goals.size());
+  double start = wallTime();
+  for (size_t r = 0; r < robots.size(); ++r) {
+    for (size_t g = 0; g < goals.size(); ++g) {
+      scarab::Path path =
+        occ_map.astar(robots[r].x(), robots[r].y(), goals[g].x(), goals[g].y(),
+                      params.lethal_occ_dist);
+      astar_costs[r * goals.size() + g] = path.empty() ?
+        numeric_limits<float>::infinity() :
+        scarab::pathLength(path) / map->scale;
+    }
+  }
+  double astar_time = wallTime() - start;
+
+  vector<float> costs;
+  start = wallTime();
+  occ_map.costMatrix(robots, goals, params.lethal_occ_dist, false, 1, &costs);
+  double serial_time = wallTime() - start;
+  start = wallTime();
+  occ_map.costMatrix(robots, goals, params.lethal_occ_dist, false, 0, &costs);
+  double parallel_time = wallTime() - start;
+
+  int mismatches = 0;
+  for (size_t k = 0; k < costs.size(); ++k) {
+    if (isinf(costs[k]) != isinf(astar_costs[k]) ||
+        (!isinf(costs[k]) &&
+         fabs(costs[k] - astar_costs[k]) > 1e-4 * astar_costs[k])) {
+      ++mismatches;
+    }
+  }
+  printf("  10x50 astar:     %9.2f ms\n", 1e3 * astar_time);
+  printf("  10x50 matrix:    %9.2f ms, %.2f ms threaded (%d mismatched costs)\n",
+         1e3 * serial_time, 1e3 * parallel_time, mismatches);
+}
+
+// Rays per second for the sampled and exact line of sight checks, between
+// random free points as with waypoints ahead of the robot
+void benchLineOfSight(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  vector<Eigen::Vector2f> points = randomFreePoints(map, 200000, 7);
+  // Keep rays short, like the distance to the next waypoint
+  for (size_t k = 1; k < points.size(); k += 2) {
+    Eigen::Vector2f d = points[k] - points[k-1];
+    if (d.norm() > 5.0) {
+      points[k] = points[k-1] + 5.0 * d / d.norm();
+    }
+  }
+  size_t rays = points.size() / 2;
+  double margin = params.lethal_occ_dist;
+
+  vector<bool> sampled(rays), exact(rays);
+  double start = wallTime();
+  for (size_t k = 0; k < rays; ++k) {
+    sampled[k] = occ_map.lineOfSightSampled(points[2*k].x(), points[2*k].y(),
+                                            points[2*k+1].x(),
+                                            points[2*k+1].y(), margin);
+  }
+  double sampled_time = wallTime() - start;
+  start = wallTime();
+  for (size_t k = 0; k < rays; ++k) {
+    exact[k] = occ_map.lineOfSight(points[2*k].x(), points[2*k].y(),
+                                   points[2*k+1].x(), points[2*k+1].y(),
+                                   margin);
+  }
+  double exact_time = wallTime() - start;
+  occ_map.addMarginLayer(margin);
+  start = wallTime();
+  int mask_mismatches = 0;
+  for (size_t k = 0; k < rays; ++k) {
+    mask_mismatches += exact[k] !=
+      occ_map.lineOfSight(points[2*k].x(), points[2*k].y(),
+                          points[2*k+1].x(), points[2*k+1].y(), margin);
+  }
+  double mask_time = wallTime() - start;
+
+  // The exact traversal visits every cell a sample can land in
+  int missed = 0, extra = 0;
+  for (size_t k = 0; k < rays; ++k) {
+    missed += exact[k] && !sampled[k];
+    extra += !exact[k] && sampled[k];
+  }
+  printf("  los sampled:     %9.0f rays/s\n", rays / sampled_time);
+  printf("  los exact:       %9.0f rays/s, %.0f rays/s with layer "
+         "(%d layer mismatches)\n", rays / exact_time, rays / mask_time,
+         mask_mismatches);
+  printf("  los blocked only by exact: %d, only by sampled: %d of %zu\n",
+         extra, missed, rays);
+}
+
+// Compare point and region checks with and without a margin layer
+void benchMarginLayers(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  double margin = params.lethal_occ_dist;
+  // Uniform points over the whole map, not only free ones
+  srand48(11);
+  size_t n = 1000000;
+  vector<Eigen::Vector2f> points(n);
+  for (size_t k = 0; k < n; ++k) {
+    points[k] = Eigen::Vector2f(
+      MAP_WXGX(map, 0) + drand48() * map->size_x * map->scale,
+      MAP_WYGY(map, 0) + drand48() * map->size_y * map->scale);
+  }
+  double half = 1.0;
+
+  vector<bool> safe(n), clear(n);
+  double start = wallTime();
+  for (size_t k = 0; k < n; ++k) {
+    safe[k] = occ_map.safePoint(points[k].x(), points[k].y(), margin);
+  }
+  double safe_time = wallTime() - start;
+  start = wallTime();
+  for (size_t k = 0; k < n; ++k) {
+    clear[k] = occ_map.regionClear(points[k].x() - half, points[k].y() - half,
+                                   points[k].x() + half, points[k].y() + half,
+                                   margin);
+  }
+  double region_time = wallTime() - start;
+
+  occ_map.addMarginLayer(margin);
+  int mismatches = 0;
+  start = wallTime();
+  for (size_t k = 0; k < n; ++k) {
+    mismatches += safe[k] !=
+      occ_map.safePoint(points[k].x(), points[k].y(), margin);
+  }
+  double safe_layer_time = wallTime() - start;
+  start = wallTime();
+  for (size_t k = 0; k < n; ++k) {
+    mismatches += clear[k] !=
+      occ_map.regionClear(points[k].x() - half, points[k].y() - half,
+                          points[k].x() + half, points[k].y() + half, margin);
+  }
+  double region_layer_time = wallTime() - start;
+
+  printf("  safePoint:   %6.1f ns, %6.1f ns with layer\n",
+         1e9 * safe_time / n, 1e9 * safe_layer_time / n);
+  printf("  regionClear: %6.1f ns, %6.1f ns with layer (%.1f m squares)\n",
+         1e9 * region_time / n, 1e9 * region_layer_time / n, 2 * half);
+  printf("  layer %zu bytes for %d cells, %d mismatches\n",
+         occ_map.marginLayer(margin)->bytes(), map->size_x * map->size_y,
+         mismatches);
+}
+
+// Time nearestPoint() from points and count the answers that differ from a
+// scan of all cells within its radius.  Cells at the margin count as clear
+// unless their cost is infinite.
+int checkNearestPoint(const scarab::OccupancyMap &occ_map,
+                      const vector<Eigen::Vector2f> &points, double margin,
+                      double *time, int *nvalid) {
+  const map_t *map = occ_map.map();
+  size_t n = points.size();
+  vector<Eigen::Vector2f> found(n);
+  vector<bool> valid(n);
+  double start = wallTime();
+  for (size_t k = 0; k < n; ++k) {
+    double x, y;
+    valid[k] = occ_map.nearestPoint(points[k].x(), points[k].y(), margin,
+                                    &x, &y);
+    found[k] = Eigen::Vector2f(x, y);
+  }
+  *time = wallTime() - start;
+
+  // Distances only need to agree, ties may pick either cell
+  int mismatches = 0;
+  *nvalid = 0;
+  int radius = ceil(5.0 / map->scale) + 1;
+  for (size_t k = 0; k < n; ++k) {
+    int ci = MAP_GXWX(map, points[k].x()), cj = MAP_GYWY(map, points[k].y());
+    double best = numeric_limits<double>::infinity();
+    for (int j = cj - radius; j <= cj + radius; ++j) {
+      for (int i = ci - radius; i <= ci + radius; ++i) {
+        if (!MAP_VALID(map, i, j)) {
+          continue;
+        }
+        int index = MAP_INDEX(map, i, j);
+        double occ_dist = map_occ_dist(map, index);
+        if (map->occ_state[index] != map_cell_t::FREE ||
+            occ_dist < margin || isinf(map->cost[index])) {
+          continue;
+        }
+        double dist = i == ci && j == cj ? 0.0 :
+          hypot(MAP_WXGX(map, i) - points[k].x(),
+                MAP_WYGY(map, j) - points[k].y());
+        if (dist <= 5.0) {
+          best = min(best, dist);
+        }
+      }
+    }
+    double dist = (found[k] - points[k]).norm();
+    *nvalid += valid[k];
+    mismatches += valid[k] != !isinf(best) ||
+      (valid[k] && fabs(dist - best) > 1e-4);
+  }
+  return mismatches;
+}
+
+void benchNearestPoint(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist);
+  // Uniform over the map, so many are far from any free cell
+  srand48(13);
+  size_t n = 20000;
+  vector<Eigen::Vector2f> points(n);
+  for (size_t k = 0; k < n; ++k) {
+    points[k] = Eigen::Vector2f(
+      MAP_WXGX(map, 0) + drand48() * map->size_x * map->scale,
+      MAP_WYGY(map, 0) + drand48() * map->size_y * map->scale);
+  }
+
+  // The lethal distance, a whole number of cells, which some cells are
+  // exactly at, and a lethal distance of a whole number of cells as the
+  // margin, where cells at the margin have infinite cost
+  scarab::OccupancyMap whole_map;
+  map_t *whole = loadMap(filename, params.resolution);
+  whole_map.setMap(whole);
+  whole_map.updateCSpace(params.max_occ_dist, 5 * map->scale);
+  scarab::OccupancyMap *maps[] = {&occ_map, &occ_map, &whole_map};
+  double margins[] = {params.lethal_occ_dist, 4 * map->scale, 5 * map->scale};
+  for (int m = 0; m < 3; ++m) {
+    double time, layer_time;
+    int nvalid, layer_nvalid;
+    int mismatches = checkNearestPoint(*maps[m], points, margins[m], &time,
+                                       &nvalid);
+    maps[m]->addMarginLayer(margins[m]);
+    int layer_mismatches = checkNearestPoint(*maps[m], points, margins[m],
+                                             &layer_time, &layer_nvalid);
+    printf("  nearestPoint:  %7.2f us/query (%d of %zu found at %.2f m%s, "
+           "%d mismatches)\n", 1e6 * time / n, nvalid, n, margins[m],
+           maps[m] == &whole_map ? " lethal" : "", mismatches);
+    printf("  with layer:    %7.2f us/query (%d of %zu found, "
+           "%d mismatches)\n", 1e6 * layer_time / n, layer_nvalid, n,
+           layer_mismatches);
+  }
+}
+
+// Time updateCSpace() and getCostMap() on the map tiled to 4096 x 4096
+// cells, and compare the costs with the double precision formula they
+// replaced and with the scalar kernel
+void benchCostMap(const char *filename, const BenchmarkParams &params) {
+  map_t *tile = loadMap(filename, params.resolution);
+  if (tile == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  const int size = 4096;
+  map_t *map = map_alloc();
+  map_alloc_cells(map, size, size);
+  map->scale = tile->scale;
+  for (int j = 0; j < size; ++j) {
+    for (int i = 0; i < size; ++i) {
+      int index = MAP_INDEX(map, i, j);
+      int tile_index = MAP_INDEX(tile, i % tile->size_x, j % tile->size_y);
+      map->occ_state[index] = tile->occ_state[tile_index];
+      map->occ_prob[index] = tile->occ_prob[tile_index];
+    }
+  }
+  map_free(tile);
+
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(map);
+  double cost_occ_prob = 1.0, cost_occ_dist = 2.0;
+  double start = wallTime();
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist,
+                       cost_occ_prob, cost_occ_dist);
+  double cspace_time = wallTime() - start;
+  start = wallTime();
+  nav_msgs::OccupancyGrid grid = occ_map.getCostMap();
+  double grid_time = wallTime() - start;
+
+  // Time the cost pass alone, on one thread, against the scalar kernel
+  int ncells = size * size;
+  scarab::CostParams cost_params;
+  cost_params.all_lethal = false;
+  cost_params.lethal_dist = floor(pow(params.lethal_occ_dist / map->scale, 2));
+  while (map->scale * sqrt(double(cost_params.lethal_dist)) >
+         params.lethal_occ_dist) {
+    --cost_params.lethal_dist;
+  }
+  cost_params.scale = map->scale;
+  cost_params.max_occ_dist = map->max_occ_dist;
+  cost_params.lethal_occ_dist = params.lethal_occ_dist;
+  cost_params.inv_dist_range =
+    1.0 / (params.max_occ_dist - params.lethal_occ_dist);
+  cost_params.prob_factor = cost_occ_prob / 100.0;
+  cost_params.unknown_prob_cost = cost_occ_prob * 0.5;
+  cost_params.dist_factor = cost_occ_dist;
+  vector<float> scalar(ncells), kernel(ncells);
+  start = wallTime();
+  scarab::computeCostsScalar(cost_params, map->occ_state, map->occ_prob,
+                             map->occ_dist, ncells, &scalar[0]);
+  double scalar_time = wallTime() - start;
+  start = wallTime();
+  scarab::computeCosts(cost_params, map->occ_state, map->occ_prob,
+                       map->occ_dist, ncells, &kernel[0]);
+  double kernel_time = wallTime() - start;
+
+  int kernel_mismatches = 0, reference_mismatches = 0;
+  double max_error = 0.0;
+  for (int k = 0; k < ncells; ++k) {
+    kernel_mismatches += scalar[k] != map->cost[k] || kernel[k] != map->cost[k];
+    double occ_dist = map_occ_dist(map, k);
+    double reference;
+    if (map->occ_state[k] == map_cell_t::OCCUPIED ||
+        occ_dist <= params.lethal_occ_dist) {
+      reference = numeric_limits<double>::infinity();
+    } else {
+      int occ_prob = map->occ_prob[k];
+      reference = occ_prob < 0 || occ_prob > 100 ? cost_occ_prob * 0.5 :
+        cost_occ_prob * occ_prob / 100.0;
+      reference += cost_occ_dist * (1.0 - (occ_dist - params.lethal_occ_dist) /
+        (params.max_occ_dist - params.lethal_occ_dist));
+    }
+    if (isinf(reference) != isinf(map->cost[k])) {
+      ++reference_mismatches;
+    } else if (!isinf(reference)) {
+      max_error = max(max_error, fabs(reference - map->cost[k]));
+    }
+  }
+
+  printf("  %dx%d costs: cspace+costs %.1f ms, cost grid %.1f ms\n",
+         size, size, 1e3 * cspace_time, 1e3 * grid_time);
+  printf("  cost pass:   %.1f ms scalar, %.1f ms %s (%d mismatches)\n",
+         1e3 * scalar_time, 1e3 * kernel_time,
+         scarab::haveAvx2CostKernel() ? "avx2" : "scalar", kernel_mismatches);
+  printf("  vs double:   %d lethal mismatches, max error %g\n",
+         reference_mismatches, max_error);
+}
+
+// Convert costs to a grid after small in place changes, as published to
+// costmap subscribers, and check the tiles against a full conversion
+void benchCostMapUpdates(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  nav_msgs::OccupancyGrid grid;
+  grid.info.width = map->size_x;
+  grid.info.height = map->size_y;
+  grid.info.resolution = map->scale;
+  grid.info.origin.position.x = map->origin_x - map->size_x / 2 * map->scale;
+  grid.info.origin.position.y = map->origin_y - map->size_y / 2 * map->scale;
+  grid.data.assign(map->occ_prob, map->occ_prob + map->size_x * map->size_y);
+
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(grid);
+  occ_map.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  double start = wallTime();
+  nav_msgs::OccupancyGrid client = occ_map.getCostMap();
+  double full_time = wallTime() - start;
+
+  // The cspace grid matches the per cell division it replaced
+  const nav_msgs::OccupancyGrid &cspace = occ_map.getCSpace();
+  const map_t *m = occ_map.map();
+  int ncells = m->size_x * m->size_y;
+  int cspace_mismatches = 0;
+  for (int k = 0; k < ncells; ++k) {
+    cspace_mismatches += cspace.data[k] !=
+      100 - int(100. * map_occ_dist(m, k) / m->max_occ_dist);
+  }
+
+  // Drop 9x9 obstacles in free space, one per update
+  srand(17);
+  int nupdates = 50, full_updates = 0, mismatches = 0;
+  size_t tile_bytes = 0;
+  double update_time = 0.0;
+  vector<map_msgs::OccupancyGridUpdate> updates;
+  for (int n = 0; n < nupdates; ++n) {
+    int oi = rand() % m->size_x, oj = rand() % m->size_y;
+    for (int j = max(0, oj - 4); j <= min(m->size_y - 1, oj + 4); ++j) {
+      for (int i = max(0, oi - 4); i <= min(m->size_x - 1, oi + 4); ++i) {
+        grid.data[MAP_INDEX(m, i, j)] = 100;
+      }
+    }
+    occ_map.setMap(grid);
+    start = wallTime();
+    if (!occ_map.getCostMapUpdates(64, &updates)) {
+      ++full_updates;
+      client = occ_map.getCostMap();
+    }
+    update_time += wallTime() - start;
+    for (size_t u = 0; u < updates.size(); ++u) {
+      const map_msgs::OccupancyGridUpdate &update = updates[u];
+      tile_bytes += update.data.size();
+      for (unsigned j = 0; j < update.height; ++j) {
+        copy(update.data.begin() + j * update.width,
+             update.data.begin() + (j + 1) * update.width,
+             client.data.begin() + MAP_INDEX(m, update.x, update.y + j));
+      }
+    }
+
+    // Compare against converting every cell
+    float max_cost = -numeric_limits<float>::infinity();
+    for (int k = 0; k < ncells; ++k) {
+      if (!isinf(m->cost[k])) {
+        max_cost = max(max_cost, m->cost[k]);
+      }
+    }
+    for (int k = 0; k < ncells; ++k) {
+      int8_t value = isinf(m->cost[k]) ? 100 :
+        int(100.0 * m->cost[k] / max_cost);
+      mismatches += client.data[k] != value;
+    }
+  }
+  printf("  cost grid:   %.2f ms full, %.3f ms per update, %d full of %d\n",
+         1e3 * full_time, 1e3 * update_time / nupdates, full_updates,
+         nupdates);
+  printf("  tiles:       %zu bytes per update vs %d (%d mismatches, "
+         "%d cspace mismatches)\n", tile_bytes / nupdates, ncells, mismatches,
+         cspace_mismatches);
+  map_free(map);
+}
+
+// Compare loading a saved cspace against computing it
+void benchCSpaceFile(const char *filename, const BenchmarkParams &params) {
+  map_t *map = loadMap(filename, params.resolution);
+  if (map == NULL) {
+    fprintf(stderr, "Failed to load %s\n", filename);
+    exit(1);
+  }
+  scarab::OccupancyMap computed;
+  computed.setMap(map);
+  computed.addMarginLayer(params.lethal_occ_dist);
+  double start = wallTime();
+  computed.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  double compute_time = wallTime() - start;
+
+  char path[] = "/tmp/map_benchmarkXXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create a temporary file\n");
+    exit(1);
+  }
+  close(fd);
+  start = wallTime();
+  bool saved = computed.save(path);
+  double save_time = wallTime() - start;
+  start = wallTime();
+  scarab::OccupancyMap *loaded = scarab::OccupancyMap::FromFile(path);
+  double load_time = wallTime() - start;
+  if (loaded != NULL) {
+    loaded->addMarginLayer(params.lethal_occ_dist);
+  }
+  double layer_time = wallTime() - start - load_time;
+  unlink(path);
+  if (!saved || loaded == NULL) {
+    fprintf(stderr, "Failed to save and load %s\n", path);
+    exit(1);
+  }
+
+  const map_t *a = computed.map(), *b = loaded->map();
+  size_t ncells = size_t(a->size_x) * a->size_y;
+  bool same = a->size_x == b->size_x && a->size_y == b->size_y &&
+    a->origin_x == b->origin_x && a->origin_y == b->origin_y &&
+    a->scale == b->scale && a->max_occ_dist == b->max_occ_dist &&
+    memcmp(a->occ_state, b->occ_state, ncells) == 0 &&
+    memcmp(a->occ_prob, b->occ_prob, ncells) == 0 &&
+    memcmp(a->occ_dist, b->occ_dist, ncells * sizeof(uint16_t)) == 0 &&
+    memcmp(a->cost, b->cost, ncells * sizeof(float)) == 0 &&
+    loaded->lethalOccDist() == computed.lethalOccDist() &&
+    loaded->costOccDist() == computed.costOccDist();
+  const scarab::BitGrid *la = computed.marginLayer(params.lethal_occ_dist);
+  const scarab::BitGrid *lb = loaded->marginLayer(params.lethal_occ_dist);
+  same = same && la != NULL && lb != NULL &&
+    memcmp(la->row(0), lb->row(0), la->bytes()) == 0;
+
+  // Plans over the loaded map use the rebuilt blocks
+  srand(23);
+  int path_mismatches = 0;
+  for (int q = 0; q < params.queries; ++q) {
+    int i1 = rand() % a->size_x, j1 = rand() % a->size_y;
+    int i2 = rand() % a->size_x, j2 = rand() % a->size_y;
+    scarab::Path pa = computed.hierarchicalAstar(
+      MAP_WXGX(a, i1), MAP_WYGY(a, j1), MAP_WXGX(a, i2), MAP_WYGY(a, j2));
+    scarab::Path pb = loaded->hierarchicalAstar(
+      MAP_WXGX(a, i1), MAP_WYGY(a, j1), MAP_WXGX(a, i2), MAP_WYGY(a, j2));
+    path_mismatches += pa.size() != pb.size() ||
+      !equal(pa.begin(), pa.end(), pb.begin());
+  }
+
+  printf("  cspace file: %.2f ms computed, %.2f ms saved, %.2f ms loaded "
+         "+ %.2f ms layer (%s, %d path mismatches)\n", 1e3 * compute_time,
+         1e3 * save_time, 1e3 * load_time, 1e3 * layer_time,
+         same ? "identical" : "DIFFERENT", path_mismatches);
+  delete loaded;
+}
+
+// True if the maps hold the same cells, costs and bit layers
+bool sameMaps(const scarab::OccupancyMap &a, const scarab::OccupancyMap &b,
+              double margin) {
+  const map_t *ma = a.map(), *mb = b.map();
+  size_t ncells = size_t(ma->size_x) * ma->size_y;
+  if (ma->size_x != mb->size_x || ma->size_y != mb->size_y ||
+      ma->origin_x != mb->origin_x || ma->origin_y != mb->origin_y ||
+      ma->max_occ_dist != mb->max_occ_dist ||
+      memcmp(ma->occ_state, mb->occ_state, ncells) != 0 ||
+      memcmp(ma->occ_dist, mb->occ_dist, ncells * sizeof(uint16_t)) != 0 ||
+      memcmp(ma->cost, mb->cost, ncells * sizeof(float)) != 0) {
+    return false;
+  }
+  const scarab::BitGrid *la = a.marginLayer(margin);
+  const scarab::BitGrid *lb = b.marginLayer(margin);
+  return la != NULL && lb != NULL &&
+    memcmp(la->row(0), lb->row(0), la->bytes()) == 0;
+}
+
+// Attach to a map shared by another map and follow its updates
+void benchSharedMap(const char *filename, const BenchmarkParams &params) {
+  nav_msgs::OccupancyGrid grid;
+  loadGrid(filename, params.resolution, &grid);
+
+  char name[64];
+  snprintf(name, sizeof(name), "/map_benchmark_%d", int(getpid()));
+  scarab::OccupancyMap owner;
+  owner.addMarginLayer(params.lethal_occ_dist);
+  owner.setMap(grid);
+  owner.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  double start = wallTime();
+  if (!owner.share(name)) {
+    fprintf(stderr, "Failed to share %s\n", name);
+    exit(1);
+  }
+  double share_time = wallTime() - start;
+  start = wallTime();
+  scarab::OccupancyMap *reader = scarab::OccupancyMap::Attach(name);
+  double attach_time = wallTime() - start;
+  if (reader == NULL) {
+    fprintf(stderr, "Failed to attach to %s\n", name);
+    exit(1);
+  }
+  reader->addMarginLayer(params.lethal_occ_dist);
+  bool same = sameMaps(owner, *reader, params.lethal_occ_dist);
+
+  // Drop 9x9 obstacles, syncing after each update
+  const map_t *m = owner.map();
+  srand(19);
+  int nupdates = 50, missed = 0;
+  double sync_time = 0.0;
+  for (int n = 0; n < nupdates; ++n) {
+    int oi = rand() % m->size_x, oj = rand() % m->size_y;
+    for (int j = max(0, oj - 4); j <= min(m->size_y - 1, oj + 4); ++j) {
+      for (int i = max(0, oi - 4); i <= min(m->size_x - 1, oi + 4); ++i) {
+        grid.data[MAP_INDEX(m, i, j)] = 100;
+      }
+    }
+    owner.setMap(grid);
+    start = wallTime();
+    missed += !reader->sync();
+    sync_time += wallTime() - start;
+    same = same && sameMaps(owner, *reader, params.lethal_occ_dist);
+  }
+
+  // A map with new geometry replaces the segment
+  grid.info.origin.position.x += grid.info.resolution;
+  owner.setMap(grid);
+  bool kept = !reader->sync();
+  owner.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  bool replaced = reader->sync();
+  same = same && kept && replaced &&
+    sameMaps(owner, *reader, params.lethal_occ_dist);
+  delete reader;
+
+  printf("  shared map:  %.2f ms shared, %.2f ms attached, %.3f ms per "
+         "sync, %d missed (%s)\n", 1e3 * share_time, 1e3 * attach_time,
+         1e3 * sync_time / nupdates, missed,
+         same ? "identical" : "DIFFERENT");
+}
+
+// Place copies of the map far apart on a tiled map, and compare it against
+// the dense map of one copy
+void benchTiledMap(const char *filename, const BenchmarkParams &params) {
+  nav_msgs::OccupancyGrid grid;
+  loadGrid(filename, params.resolution, &grid);
+  int width = grid.info.width, height = grid.info.height;
+  scarab::OccupancyMap dense;
+  dense.addMarginLayer(params.lethal_occ_dist);
+  dense.setMap(grid);
+  dense.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+
+  // Four copies at the corners of a square ten maps across
+  double x0 = grid.info.origin.position.x, y0 = grid.info.origin.position.y;
+  scarab::TiledMap tiled(grid.info.resolution, x0, y0);
+  for (int k = 0; k < 4; ++k) {
+    grid.info.origin.position.x = x0 + (k % 2) * 10 * width * params.resolution;
+    grid.info.origin.position.y = y0 + (k / 2) * 10 * height * params.resolution;
+    tiled.setGrid(grid);
+  }
+  double start = wallTime();
+  tiled.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  double cspace_time = wallTime() - start;
+  double dense_mb = 8e-6 * (tiled.maxI() - tiled.minI()) *
+    (tiled.maxJ() - tiled.minJ());
+  double tiled_mb = 1e-6 * tiled.bytes();
+
+  int min_i = tiled.cellX(x0), min_j = tiled.cellY(y0);
+  scarab::OccupancyMap window;
+  window.addMarginLayer(params.lethal_occ_dist);
+  start = wallTime();
+  window.setMap(tiled, min_i, min_j, min_i + width, min_j + height);
+  double extract_time = wallTime() - start;
+  bool same = sameMaps(dense, window, params.lethal_occ_dist);
+
+  // Growing the map far away leaves the tiles already stored in place
+  const scarab::TiledMap::Tile *tile = &tiled.tile(min_i, min_j);
+  vector<float> costs(tile->cost, tile->cost + scarab::TiledMap::TILE_CELLS);
+  size_t ntiles = tiled.numTiles();
+  grid.info.origin.position.x = x0 - 50 * width * params.resolution;
+  grid.info.origin.position.y = y0 - 50 * height * params.resolution;
+  tiled.setGrid(grid);
+  start = wallTime();
+  tiled.updateCSpace(params.max_occ_dist, params.lethal_occ_dist, 1.0, 2.0);
+  double grow_time = wallTime() - start;
+  same = same && &tiled.tile(min_i, min_j) == tile &&
+    equal(costs.begin(), costs.end(), tile->cost);
+  window.setMap(tiled, min_i, min_j, min_i + width, min_j + height);
+  same = same && sameMaps(dense, window, params.lethal_occ_dist);
+
+  printf("  tiled map:   %.1f MB dense, %.1f MB in %zu tiles, %.2f ms cspace, "
+         "%.2f ms extract, %.2f ms to add %zu tiles (%s)\n", dense_mb, tiled_mb,
+         ntiles, 1e3 * cspace_time, 1e3 * extract_time, 1e3 * grow_time,
+         tiled.numTiles() - ntiles, same ? "identical" : "DIFFERENT");
+}
+
+// Plan from a start inside lethal_occ_dist on the last column of a block,
+// whose only neighbors that can be entered are in the next block, as a
+// robot pressed against a wall is; the hierarchical planner has to find the
+// path astar() does
+void checkLethalStart() {
+  // Wall over the left of the map, leaving the cells within 0.23 m of it,
+  // and so all of the third column of 8 cell blocks, lethal
+  nav_msgs::OccupancyGrid grid;
+  grid.info.width = 48;
+  grid.info.height = 48;
+  grid.info.resolution = 0.05;
+  grid.data.assign(48 * 48, 0);
+  for (int j = 0; j < 48; ++j) {
+    for (int i = 0; i < 20; ++i) {
+      grid.data[i + j * 48] = 100;
+    }
+  }
+  scarab::OccupancyMap occ_map;
+  occ_map.setMap(grid);
+  occ_map.updateCSpace(0.5, 0.23);
+
+  const map_t *m = occ_map.map();
+  double startx = MAP_WXGX(m, 23), starty = MAP_WYGY(m, 20);
+  double stopx = MAP_WXGX(m, 40), stopy = MAP_WYGY(m, 40);
+  scarab::Path astar_path = occ_map.astar(startx, starty, stopx, stopy, 0.23);
+  scarab::Path hier_path =
+    occ_map.hierarchicalAstar(startx, starty, stopx, stopy, 0.23);
+  bool lethal = isinf(m->cost[MAP_INDEX(m, 23, 20)]);
+  bool same = !astar_path.empty() && hier_path.size() > 1 &&
+    fabs(scarab::pathLength(astar_path) - scarab::pathLength(hier_path)) < 1e-3;
+  printf("lethal start on a block border: %s\n",
+         !lethal ? "NOT LETHAL" : same ? "same path" : "DIFFERENT");
+}
+
+int main(int argc, char **argv) {
+  BenchmarkParams params;
+  params.resolution = 0.05;
+  params.max_occ_dist = 0.5;
+  params.lethal_occ_dist = 0.23;
+  params.queries = 20;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:d:l:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        params.resolution = atof(optarg);
+        break;
+      case 'd':
+        params.max_occ_dist = atof(optarg);
+        break;
+      case 'l':
+        params.lethal_occ_dist = atof(optarg);
+        break;
+      case 'n':
+        params.queries = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-r resolution] [-d max_occ_dist] "
+                "[-l lethal_occ_dist] [-n queries] map.pgm [map.pgm ...]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-r resolution] [-d max_occ_dist] "
+            "[-l lethal_occ_dist] [-n queries] map.pgm [map.pgm ...]\n",
+            argv[0]);
+    return 1;
+  }
+
+  checkLethalStart();
+  for (int i = optind; i < argc; ++i) {
+    benchCSpace(argv[i], params);
+    benchSearch(argv[i], params);
+    benchPlanners(argv[i], params);
+    benchReplan(argv[i], params);
+    benchGoalCache(argv[i], params);
+    benchCostMatrix(argv[i], params);
+    benchLineOfSight(argv[i], params);
+    benchMarginLayers(argv[i], params);
+    benchNearestPoint(argv[i], params);
+    benchCostMap(argv[i], params);
+    benchCostMapUpdates(argv[i], params);
+    benchCSpaceFile(argv[i], params);
+    benchSharedMap(argv[i], params);
+    benchTiledMap(argv[i], params);
+  }
+  return 0;
+}
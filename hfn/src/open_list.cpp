@@ -0,0 +1,120 @@
+#include "player_map/open_list.hpp"
+
+#include <cstring>
+#include <limits>
+
+using namespace std;
+namespace scarab {
+
+//============================== SetOpenList ================================//
+
+void SetOpenList::reset(int ncells) {
+  if (int(keys_.size()) != ncells) {
+    keys_.assign(ncells, numeric_limits<float>::infinity());
+  } else {
+    for (set<pair<float, int> >::iterator it = set_.begin(); it != set_.end();
+         ++it) {
+      keys_[it->second] = numeric_limits<float>::infinity();
+    }
+  }
+  set_.clear();
+}
+
+void SetOpenList::push(int index, float key) {
+  if (keys_[index] != numeric_limits<float>::infinity()) {
+    set_.erase(make_pair(keys_[index], index));
+  }
+  keys_[index] = key;
+  set_.insert(make_pair(key, index));
+}
+
+int SetOpenList::pop(float *key) {
+  int index = set_.begin()->second;
+  *key = set_.begin()->first;
+  set_.erase(set_.begin());
+  keys_[index] = numeric_limits<float>::infinity();
+  return index;
+}
+
+//============================== HeapOpenList ===============================//
+
+void HeapOpenList::reset(int ncells) {
+  if (ncells_ != ncells) {
+    ncells_ = ncells;
+    heap_.resize(ncells);
+  } else {
+    heap_.clear();
+  }
+}
+
+void HeapOpenList::push(int index, float key) {
+  if (!heap_.contains(index) || key < heap_.key(index)) {
+    heap_.push(index, key);
+  }
+}
+
+int HeapOpenList::pop(float *key) {
+  *key = heap_.topKey();
+  return heap_.pop();
+}
+
+//============================= BucketOpenList ==============================//
+
+BucketOpenList::BucketOpenList() : last_(0), size_(0) {
+
+}
+
+void BucketOpenList::reset(int /* ncells */) {
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    buckets_[i].clear();
+  }
+  last_ = 0;
+  size_ = 0;
+}
+
+// Bucket i holds keys that first differ from last_ in bit i - 1
+int BucketOpenList::bucket(uint32_t key) const {
+  return key == last_ ? 0 : 32 - __builtin_clz(key ^ last_);
+}
+
+void BucketOpenList::push(int index, float key) {
+  uint32_t bits;
+  memcpy(&bits, &key, sizeof(bits));
+  // Rounding can put a key slightly below the last key popped
+  if (bits < last_) {
+    bits = last_;
+  }
+  buckets_[bucket(bits)].push_back(make_pair(bits, index));
+  ++size_;
+}
+
+int BucketOpenList::pop(float *key) {
+  if (buckets_[0].empty()) {
+    // Move the smallest key into last_ and redistribute its bucket, whose
+    // entries all land in lower buckets
+    int i = 1;
+    while (buckets_[i].empty()) {
+      ++i;
+    }
+    vector<pair<uint32_t, int> > &from = buckets_[i];
+    uint32_t min_key = from[0].first;
+    for (size_t j = 1; j < from.size(); ++j) {
+      if (from[j].first < min_key) {
+        min_key = from[j].first;
+      }
+    }
+    last_ = min_key;
+    for (size_t j = 0; j < from.size(); ++j) {
+      buckets_[bucket(from[j].first)].push_back(from[j]);
+    }
+    from.clear();
+  }
+
+  pair<uint32_t, int> entry = buckets_[0].back();
+  buckets_[0].pop_back();
+  --size_;
+  memcpy(key, &entry.first, sizeof(*key));
+  return entry.second;
+}
+
+} // end namespace scarab
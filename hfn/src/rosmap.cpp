@@ -1,11 +1,20 @@
 #include "player_map/rosmap.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include <ros/ros.h>
 
 #include <nav_msgs/GetMap.h>
 
+#include "player_map/shared_map.hpp"
+#include "player_map/tiled_map.hpp"
+
 using namespace std;
 namespace scarab {
 
@@ -17,33 +26,39 @@ double pathLength(const Path &path) {
   return dist;
 }
 
+// Length of the shortest 8-connected path between cells (di, dj) apart on an
+// empty grid
+inline float octileDistance(int di, int dj) {
+  di = abs(di);
+  dj = abs(dj);
+  return di < dj ? (dj - di) + M_SQRT2 * di : (di - dj) + M_SQRT2 * dj;
+}
+
+inline int sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+
 void convertMap(const nav_msgs::OccupancyGrid &map, map_t *pmap,
     const int free_threshold, const int occupied_threshold) {
-  pmap->size_x = map.info.width;
-  pmap->size_y = map.info.height;
+  if (map_alloc_cells(pmap, map.info.width, map.info.height) != 0) {
+    ROS_ERROR("convertMap() Failed to allocate %d x %d map",
+              map.info.width, map.info.height);
+    ROS_BREAK();
+  }
   pmap->scale = map.info.resolution;
   pmap->origin_x = map.info.origin.position.x + (pmap->size_x / 2) * pmap->scale;
   pmap->origin_y = map.info.origin.position.y + (pmap->size_y / 2) * pmap->scale;
   pmap->max_occ_dist = 0.0;
   // Convert to player format
-  pmap->cells = (map_cell_t*)malloc(sizeof(map_cell_t)*pmap->size_x*pmap->size_y);
-  ROS_ASSERT(pmap->cells);
   for(int i = 0; i < pmap->size_x * pmap->size_y; ++i) {
-    if(0 <= map.data[i] && map.data[i] <= free_threshold) {
-      pmap->cells[i].occ_state = map_cell_t::FREE;
-    } else if(occupied_threshold <= map.data[i] && map.data[i] <= 100) {
-      pmap->cells[i].occ_state = map_cell_t::OCCUPIED;
-    } else {
-      pmap->cells[i].occ_state = map_cell_t::UNKNOWN;
-    }
-
-    pmap->cells[i].occ_prob = map.data[i];
-    pmap->cells[i].occ_dist = 0;
-    pmap->cells[i].cost = 0.;
+    pmap->occ_state[i] = convertState(map.data[i], free_threshold, occupied_threshold);
+    pmap->occ_prob[i] = map.data[i];
+    pmap->occ_dist[i] = 0;
+    pmap->cost[i] = 0.;
   }
 }
 
-
 map_t * requestCSpaceMap(const char *srv_name, const int free_threshold,
                          const int occupied_threshold) {
   ros::NodeHandle nh;
@@ -74,9 +89,14 @@ map_t * requestCSpaceMap(const char *srv_name, const int free_threshold,
 
 
 OccupancyMap::OccupancyMap()
-  : map_(NULL), ncells_(0), max_free_threshold_(0),
-    min_occupied_threshold_(100), max_occ_dist_(0.0), lethal_occ_dist_(0.0) {
-
+  : map_(NULL), max_free_threshold_(0),
+    min_occupied_threshold_(100), max_occ_dist_(0.0), lethal_occ_dist_(0.0),
+    cost_occ_prob_(0.0), cost_occ_dist_(0.0), version_(0),
+    incremental_update_(false), max_cost_(0.0), max_cost_valid_(false),
+    cspace_grid_version_(0), cost_grid_version_(0), cost_grid_max_cost_(0.0),
+    field_cache_size_(64 << 20),
+    blocks_x_(0), blocks_y_(0), shared_sequence_(0),
+    workspace_(new SearchWorkspace()) {
 }
 
 OccupancyMap::~OccupancyMap() {
@@ -89,24 +109,399 @@ OccupancyMap* OccupancyMap::FromMapServer(const char *srv_name,
     const int free_threshold, const int occupied_threshold) {
   map_t *map = requestCSpaceMap(srv_name, free_threshold, occupied_threshold);
   OccupancyMap *occ_map = new OccupancyMap();
+  occ_map->setThresholds(free_threshold, occupied_threshold);
   occ_map->setMap(map);
   return occ_map;
 }
 
+// Start of the data derived from the cells that save() stores after them:
+// the blocks, padded to a multiple of 8 bytes, then the words of passable_
+// and known_
+struct CSpaceFileExtra {
+  int32_t block_size, blocks_x, blocks_y, words_x;
+};
+
+static size_t cspaceFileExtraSize(const CSpaceFileExtra &extra, int size_y) {
+  size_t blocks = size_t(extra.blocks_x) * extra.blocks_y * sizeof(uint32_t);
+  return sizeof(CSpaceFileExtra) + (blocks + 7) / 8 * 8 +
+    2 * size_t(extra.words_x) * size_y * sizeof(uint64_t);
+}
+
+static CSpaceFileExtra cspaceFileExtra(int block_size, int blocks_x,
+                                       int blocks_y, int words_x) {
+  CSpaceFileExtra extra;
+  extra.block_size = block_size;
+  extra.blocks_x = blocks_x;
+  extra.blocks_y = blocks_y;
+  extra.words_x = words_x;
+  return extra;
+}
+
+void OccupancyMap::packDerived(vector<char> *data) const {
+  CSpaceFileExtra extra = cspaceFileExtra(BLOCK_SIZE, blocks_x_, blocks_y_,
+                                          passable_.wordsX());
+  data->assign(cspaceFileExtraSize(extra, map_->size_y), 0);
+  writeDerived(&(*data)[0]);
+}
+
+void OccupancyMap::writeDerived(char *p) const {
+  CSpaceFileExtra extra = cspaceFileExtra(BLOCK_SIZE, blocks_x_, blocks_y_,
+                                          passable_.wordsX());
+  memcpy(p, &extra, sizeof(extra));
+  p += sizeof(extra);
+  if (!blocks_.empty()) {
+    memcpy(p, &blocks_[0], blocks_.size() * sizeof(uint32_t));
+  }
+  p += (blocks_.size() * sizeof(uint32_t) + 7) / 8 * 8;
+  if (!passable_.empty()) {
+    memcpy(p, passable_.words(), passable_.bytes());
+    memcpy(p + passable_.bytes(), known_.words(), known_.bytes());
+  }
+}
+
+bool OccupancyMap::readDerived(const char *p, size_t size) {
+  CSpaceFileExtra extra;
+  if (size < sizeof(extra)) {
+    return false;
+  }
+  memcpy(&extra, p, sizeof(extra));
+  if (extra.block_size != BLOCK_SIZE ||
+      extra.blocks_x != (map_->size_x + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+      extra.blocks_y != (map_->size_y + BLOCK_SIZE - 1) / BLOCK_SIZE ||
+      extra.words_x != (map_->size_x + 63) / 64 ||
+      size != cspaceFileExtraSize(extra, map_->size_y)) {
+    return false;
+  }
+  p += sizeof(extra);
+  const uint32_t *blocks = reinterpret_cast<const uint32_t*>(p);
+  blocks_x_ = extra.blocks_x;
+  blocks_y_ = extra.blocks_y;
+  blocks_.assign(blocks, blocks + extra.blocks_x * extra.blocks_y);
+  p += (blocks_.size() * sizeof(uint32_t) + 7) / 8 * 8;
+  const uint64_t *words = reinterpret_cast<const uint64_t*>(p);
+  passable_.assign(map_->size_x, map_->size_y, words);
+  known_.assign(map_->size_x, map_->size_y,
+                words + size_t(extra.words_x) * map_->size_y);
+  return true;
+}
+
+void OccupancyMap::fileHeader(map_file_header_t *header) const {
+  memset(header, 0, sizeof(*header));
+  header->free_threshold = max_free_threshold_;
+  header->occupied_threshold = min_occupied_threshold_;
+  header->lethal_occ_dist = lethal_occ_dist_;
+  header->cost_occ_prob = cost_occ_prob_;
+  header->cost_occ_dist = cost_occ_dist_;
+}
+
+void OccupancyMap::loadHeader(const map_file_header_t &header) {
+  max_free_threshold_ = header.free_threshold;
+  min_occupied_threshold_ = header.occupied_threshold;
+  max_occ_dist_ = header.max_occ_dist;
+  lethal_occ_dist_ = header.lethal_occ_dist;
+  cost_occ_prob_ = header.cost_occ_prob;
+  cost_occ_dist_ = header.cost_occ_dist;
+}
+
+OccupancyMap* OccupancyMap::FromFile(const char *filename) {
+  map_t *map = map_alloc();
+  ROS_ASSERT(map);
+  map_file_header_t header;
+  const void *extra;
+  if (map_open(map, filename, &header, &extra) != 0) {
+    ROS_ERROR("OccupancyMap::FromFile() Failed to load %s", filename);
+    map_free(map);
+    return NULL;
+  }
+  OccupancyMap *occ_map = new OccupancyMap();
+  occ_map->setMap(map);
+  occ_map->loadHeader(header);
+  // The blocks and bit layers are copied if they were saved for this layout,
+  // and otherwise rebuilt from the loaded costs
+  if (header.max_occ_dist > 0.0 &&
+      !occ_map->readDerived(static_cast<const char*>(extra),
+                            header.extra_size)) {
+    occ_map->updateBlocks(0, 0, map->size_x, map->size_y);
+    occ_map->updateLayers(0, 0, map->size_x, map->size_y);
+  }
+  occ_map->mapChanged(false);
+  return occ_map;
+}
+
+bool OccupancyMap::save(const char *filename) const {
+  if (map_ == NULL || max_occ_dist_ <= 0.0 ||
+      map_->max_occ_dist != max_occ_dist_) {
+    ROS_ERROR("OccupancyMap::save() CSpace has not been calculated");
+    return false;
+  }
+  map_file_header_t header;
+  fileHeader(&header);
+  vector<char> extra;
+  packDerived(&extra);
+  header.extra_size = extra.size();
+  if (map_save(map_, filename, &header, &extra[0]) != 0) {
+    ROS_ERROR("OccupancyMap::save() Failed to save %s", filename);
+    return false;
+  }
+  return true;
+}
+
+bool OccupancyMap::share(const char *name) {
+  if (sharedReadOnly("share")) {
+    return false;
+  }
+  shared_name_ = name;
+  shareCSpace();
+  return shared_.get() != NULL;
+}
+
+bool OccupancyMap::shareCSpace() {
+  // Wait for the cspace of a new map before replacing the segment
+  if (map_ == NULL || max_occ_dist_ <= 0.0 ||
+      map_->max_occ_dist != max_occ_dist_) {
+    return false;
+  }
+  map_file_header_t header;
+  fileHeader(&header);
+  vector<char> extra;
+  packDerived(&extra);
+  header.extra_size = extra.size();
+  shared_.reset();
+  shared_.reset(SharedMapSegment::create(shared_name_.c_str(), map_, &header,
+                                         &extra[0]));
+  return shared_.get() != NULL;
+}
+
+void OccupancyMap::beginSharedWrite() {
+  if (shared_ && shared_->owner()) {
+    shared_->beginWrite();
+  }
+}
+
+void OccupancyMap::publishShared() {
+  if (shared_name_.empty()) {
+    return;
+  }
+  if (!shared_) {
+    // The map was replaced, so is the segment once its cspace is computed
+    shareCSpace();
+    return;
+  }
+  shared_->beginWrite();
+  map_file_header_t *header = shared_->header();
+  header->max_occ_dist = map_->max_occ_dist;
+  header->free_threshold = max_free_threshold_;
+  header->occupied_threshold = min_occupied_threshold_;
+  header->lethal_occ_dist = lethal_occ_dist_;
+  header->cost_occ_prob = cost_occ_prob_;
+  header->cost_occ_dist = cost_occ_dist_;
+  writeDerived(shared_->extra());
+  shared_->endWrite();
+}
+
+bool OccupancyMap::sharedReadOnly(const char *caller) const {
+  if (shared_ && !shared_->owner()) {
+    ROS_ERROR("OccupancyMap::%s() Map is attached to %s read only", caller,
+              shared_->name().c_str());
+    return true;
+  }
+  return false;
+}
+
+OccupancyMap* OccupancyMap::Attach(const char *name) {
+  map_t *map = map_alloc();
+  ROS_ASSERT(map);
+  SharedMapSegment *segment = SharedMapSegment::attach(name, map);
+  if (segment == NULL) {
+    map_free(map);
+    return NULL;
+  }
+  OccupancyMap *occ_map = new OccupancyMap();
+  occ_map->setMap(map);
+  occ_map->shared_.reset(segment);
+  occ_map->loadShared();
+  return occ_map;
+}
+
+bool OccupancyMap::sync() {
+  if (!shared_ || shared_->owner()) {
+    return false;
+  }
+  if (shared_->stale()) {
+    // Keep the old map until the owner has shared the new one
+    map_t *map = map_alloc();
+    ROS_ASSERT(map);
+    SharedMapSegment *segment =
+      SharedMapSegment::attach(shared_->name().c_str(), map);
+    if (segment == NULL) {
+      map_free(map);
+      return false;
+    }
+    shared_.reset();
+    setMap(map);
+    shared_.reset(segment);
+    loadShared();
+    return true;
+  }
+  if (shared_->readBegin() == shared_sequence_) {
+    return false;
+  }
+  loadShared();
+  return true;
+}
+
+void OccupancyMap::loadShared() {
+  // Copy what is derived from the cells, along with the parameters they
+  // were computed with, as of one sequence
+  uint32_t sequence;
+  do {
+    sequence = shared_->readBegin();
+    const map_file_header_t *header = shared_->header();
+    loadHeader(*header);
+    map_->max_occ_dist = header->max_occ_dist;
+    if (!readDerived(shared_->extra(), header->extra_size)) {
+      blocks_.clear();
+      blocks_x_ = blocks_y_ = 0;
+      passable_.clear();
+      known_.clear();
+    }
+  } while (shared_->readRetry(sequence) && !shared_->stale());
+  shared_sequence_ = sequence;
+  for (size_t k = 0; k < margin_layers_.size(); ++k) {
+    BitGrid *layer = &margin_layers_[k].second;
+    if (passable_.empty()) {
+      layer->clear();
+    } else {
+      layer->resize(map_->size_x, map_->size_y);
+      updateMarginLayer(margin_layers_[k].first, layer, 0, 0,
+                        map_->size_x, map_->size_y);
+    }
+  }
+  max_cost_valid_ = false;
+  mapChanged(false);
+}
+
 void OccupancyMap::setMap(map_t *map) {
+  if (sharedReadOnly("setMap")) {
+    return;
+  }
+  // Readers keep the shared map until the cspace of this one is shared
+  shared_.reset();
   if (map_ != NULL) {
     map_free(map_);
   }
   map_ = map;
+  blocks_.clear();
+  blocks_x_ = blocks_y_ = 0;
+  max_cost_valid_ = false;
+  clearLayers();
+  updateNearestOffsets();
+  mapChanged(false);
 }
 
 void OccupancyMap::setMap(const nav_msgs::OccupancyGrid &grid) {
+  if (sharedReadOnly("setMap")) {
+    return;
+  }
+  if (map_ != NULL && updateMap(grid)) {
+    return;
+  }
+  shared_.reset();
   if (map_ != NULL) {
     map_free(map_);
   }
   map_ = map_alloc();
   ROS_ASSERT(map_);
   convertMap(grid, map_, max_free_threshold_, min_occupied_threshold_);
+  blocks_.clear();
+  blocks_x_ = blocks_y_ = 0;
+  max_cost_valid_ = false;
+  clearLayers();
+  updateNearestOffsets();
+  mapChanged(false);
+}
+
+void OccupancyMap::setMap(const TiledMap &tiles, int min_i, int min_j,
+                          int max_i, int max_j) {
+  if (sharedReadOnly("setMap")) {
+    return;
+  }
+  map_t *map = map_alloc();
+  ROS_ASSERT(map);
+  tiles.extract(min_i, min_j, max_i, max_j, map);
+  setMap(map);
+  if (tiles.maxOccDist() > 0.0) {
+    max_occ_dist_ = tiles.maxOccDist();
+    lethal_occ_dist_ = tiles.lethalOccDist();
+    cost_occ_prob_ = tiles.costOccProb();
+    cost_occ_dist_ = tiles.costOccDist();
+    updateBlocks(0, 0, map->size_x, map->size_y);
+    updateLayers(0, 0, map->size_x, map->size_y);
+    mapChanged(false);
+  }
+}
+
+bool OccupancyMap::updateMap(const nav_msgs::OccupancyGrid &grid) {
+  // Only maps with identical geometry and an up to date cspace can be updated
+  // in place
+  if (map_->size_x != int(grid.info.width) ||
+      map_->size_y != int(grid.info.height) ||
+      map_->scale != grid.info.resolution ||
+      map_->origin_x != grid.info.origin.position.x + (map_->size_x / 2) * map_->scale ||
+      map_->origin_y != grid.info.origin.position.y + (map_->size_y / 2) * map_->scale ||
+      max_occ_dist_ <= 0.0 || map_->max_occ_dist != max_occ_dist_) {
+    return false;
+  }
+  beginSharedWrite();
+
+  // Apply the new occupancy values and mark the tiles that changed
+  const int tile_size = 64;
+  int tiles_x = (map_->size_x + tile_size - 1) / tile_size;
+  int tiles_y = (map_->size_y + tile_size - 1) / tile_size;
+  vector<bool> dirty(tiles_x * tiles_y, false);
+  changed_cells_.clear();
+  for (int j = 0; j < map_->size_y; ++j) {
+    for (int i = 0; i < map_->size_x; ++i) {
+      int index = MAP_INDEX(map_, i, j);
+      uint8_t state = convertState(grid.data[index], max_free_threshold_,
+                                   min_occupied_threshold_);
+      if (state != map_->occ_state[index] ||
+          grid.data[index] != map_->occ_prob[index]) {
+        if ((state == map_cell_t::UNKNOWN) !=
+            (map_->occ_state[index] == map_cell_t::UNKNOWN)) {
+          changed_cells_.push_back(index);
+        }
+        map_->occ_state[index] = state;
+        map_->occ_prob[index] = grid.data[index];
+        dirty[i / tile_size + (j / tile_size) * tiles_x] = true;
+      }
+    }
+  }
+
+  // Recompute distances and costs for each run of dirty tiles, dilated by the
+  // distance over which a changed cell can influence its neighbors
+  int margin = ceil(max_occ_dist_ / map_->scale);
+  int nregions = 0;
+  for (int tj = 0; tj < tiles_y; ++tj) {
+    for (int ti = 0; ti < tiles_x; ++ti) {
+      if (!dirty[ti + tj * tiles_x]) {
+        continue;
+      }
+      int start_ti = ti;
+      while (ti + 1 < tiles_x && dirty[ti + 1 + tj * tiles_x]) {
+        ++ti;
+      }
+      int min_i = max(0, start_ti * tile_size - margin);
+      int min_j = max(0, tj * tile_size - margin);
+      int max_i = min(map_->size_x, (ti + 1) * tile_size + margin);
+      int max_j = min(map_->size_y, (tj + 1) * tile_size + margin);
+      updateCosts(min_i, min_j, max_i, max_j, &changed_cells_, true);
+      ++nregions;
+    }
+  }
+  ROS_DEBUG("OccupancyMap::updateMap() Updated %d regions in place", nregions);
+  mapChanged(true);
+  return true;
 }
 
 bool OccupancyMap::safePoint(double x, double y) const {
@@ -114,9 +509,17 @@ bool OccupancyMap::safePoint(double x, double y) const {
 }
 
 bool OccupancyMap::safePoint(double x, double y, double safe_dist) const {
-  const map_cell_t *cell = getCell(x, y);
-  return (cell != NULL && cell->occ_state == map_cell_t::FREE &&
-          cell->occ_dist >= safe_dist);
+  int index = coordIndex(x, y);
+  if (index < 0) {
+    return false;
+  }
+  const BitGrid *layer = marginLayer(safe_dist);
+  if (layer != NULL) {
+    int i = index % map_->size_x, j = index / map_->size_x;
+    return layer->get(i, j) && known_.get(i, j);
+  }
+  return (map_->occ_state[index] == map_cell_t::FREE &&
+          map_occ_dist(map_, index) >= safe_dist);
 }
 
 void OccupancyMap::updateCSpace(double max_occ_dist,
@@ -139,105 +542,611 @@ void OccupancyMap::updateCSpace(double max_occ_dist,
     ROS_ERROR("max_occ_dist must be at least lethal_occ_dist");
     return;
   }
+  if (sharedReadOnly("updateCSpace")) {
+    return;
+  }
+  beginSharedWrite();
   max_occ_dist_ = max_occ_dist;
   lethal_occ_dist_ = lethal_occ_dist;
-  map_update_cspace(map_, max_occ_dist);
-  // compute cost for each cell
-  for (int i = 0; i < map_->size_x * map_->size_y; ++i) {
-    if (map_->cells[i].occ_state == map_cell_t::OCCUPIED ||
-        map_->cells[i].occ_dist <= lethal_occ_dist) {
-      map_->cells[i].cost = std::numeric_limits<float>::infinity();
-    } else {
-      map_->cells[i].cost = 0.0;
-      // Add cost occ prob
-      if (map_->cells[i].occ_prob < 0 || map_->cells[i].occ_prob > 100) {
-        map_->cells[i].cost += cost_occ_prob * 0.5;
-      } else {
-        map_->cells[i].cost += cost_occ_prob * float(map_->cells[i].occ_prob) / 100.0;
+  cost_occ_prob_ = cost_occ_prob;
+  cost_occ_dist_ = cost_occ_dist;
+  map_set_max_occ_dist(map_, max_occ_dist);
+  updateCosts(0, 0, map_->size_x, map_->size_y, NULL, true);
+  mapChanged(false);
+}
+
+void OccupancyMap::mapChanged(bool incremental) {
+  ++version_;
+  incremental_update_ = incremental;
+  if (!incremental) {
+    changed_cells_.clear();
+  }
+  publishShared();
+  // Cached fields are keyed by version, none can match again
+  boost::mutex::scoped_lock lock(fields_mutex_);
+  fields_.clear();
+}
+
+const vector<int>* OccupancyMap::changedCells(unsigned version) const {
+  if (incremental_update_ && version + 1 == version_) {
+    return &changed_cells_;
+  }
+  return NULL;
+}
+
+// Regions with more cells than this are split into bands of rows computed
+// by separate threads
+static const int COST_BAND_CELLS = 1 << 18;
+
+CostParams OccupancyMap::costParams() const {
+  return makeCostParams(map_->scale, map_->max_occ_dist, max_occ_dist_,
+                        lethal_occ_dist_, cost_occ_prob_, cost_occ_dist_);
+}
+
+void OccupancyMap::updateCosts(int min_i, int min_j, int max_i, int max_j,
+                               vector<int> *changed /* = NULL */,
+                               bool cspace /* = false */) {
+  CostParams params = costParams();
+  int nthreads = 1;
+  int ncells = (max_i - min_i) * (max_j - min_j);
+  if (ncells >= 2 * COST_BAND_CELLS) {
+    nthreads = min<int>(ncells / COST_BAND_CELLS,
+                        max(1u, boost::thread::hardware_concurrency()));
+    nthreads = min(nthreads, max_j - min_j);
+  }
+  vector<vector<int> > band_changed(nthreads);
+  vector<float> band_max(nthreads);
+  if (nthreads == 1) {
+    updateCostBand(params, cspace, min_i, min_j, max_i, max_j,
+                   changed != NULL ? &band_changed[0] : NULL, &band_max[0]);
+  } else {
+    // Each thread computes its own rows
+    boost::thread_group threads;
+    for (int t = 0; t < nthreads; ++t) {
+      int begin_j = min_j + (max_j - min_j) * t / nthreads;
+      int end_j = min_j + (max_j - min_j) * (t + 1) / nthreads;
+      threads.create_thread(
+        boost::bind(&OccupancyMap::updateCostBand, this, boost::cref(params),
+                    cspace, min_i, begin_j, max_i, end_j,
+                    changed != NULL ? &band_changed[t] : NULL, &band_max[t]));
+    }
+    threads.join_all();
+  }
+  float max_cost = -numeric_limits<float>::infinity();
+  for (int t = 0; t < nthreads; ++t) {
+    max_cost = max(max_cost, band_max[t]);
+    if (changed != NULL) {
+      changed->insert(changed->end(), band_changed[t].begin(),
+                      band_changed[t].end());
+    }
+  }
+  // Unless the region covers the map, the largest cost elsewhere is only
+  // known not to exceed the last one
+  if (min_i == 0 && min_j == 0 &&
+      max_i == map_->size_x && max_j == map_->size_y) {
+    max_cost_ = max_cost;
+    max_cost_valid_ = true;
+  } else if (max_cost_valid_ && max_cost >= max_cost_) {
+    max_cost_ = max_cost;
+  } else {
+    max_cost_valid_ = false;
+  }
+
+  updateBlocks(min_i, min_j, max_i, max_j);
+  updateLayers(min_i, min_j, max_i, max_j);
+}
+
+void OccupancyMap::updateCostBand(const CostParams &params, bool cspace,
+                                  int min_i, int min_j, int max_i, int max_j,
+                                  vector<int> *changed, float *max_cost) {
+  // Only writes the distances of the band, so bands can run concurrently
+  if (cspace) {
+    map_update_cspace_region(map_, min_i, min_j, max_i, max_j);
+  }
+  *max_cost = -numeric_limits<float>::infinity();
+  int width = max_i - min_i;
+  vector<float> old_costs(changed != NULL ? width : 0);
+  for (int j = min_j; j < max_j; ++j) {
+    int index = MAP_INDEX(map_, min_i, j);
+    if (changed != NULL) {
+      copy(map_->cost + index, map_->cost + index + width, old_costs.begin());
+    }
+    *max_cost = max(*max_cost, computeCosts(
+      params, map_->occ_state + index, map_->occ_prob + index,
+      map_->occ_dist + index, width, map_->cost + index));
+    if (changed != NULL) {
+      for (int k = 0; k < width; ++k) {
+        if (map_->cost[index + k] != old_costs[k]) {
+          changed->push_back(index + k);
+        }
+      }
+    }
+  }
+}
+
+void OccupancyMap::updateBlocks(int min_i, int min_j, int max_i, int max_j) {
+  int blocks_x = (map_->size_x + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int blocks_y = (map_->size_y + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if (blocks_x_ != blocks_x || blocks_y_ != blocks_y) {
+    blocks_x_ = blocks_x;
+    blocks_y_ = blocks_y;
+    blocks_.assign(blocks_x * blocks_y, 0);
+    min_i = min_j = 0;
+    max_i = map_->size_x;
+    max_j = map_->size_y;
+  }
+
+  // Edges of the blocks bordering the region depend on cells inside it
+  int min_bi = max(0, min_i / BLOCK_SIZE - 1);
+  int min_bj = max(0, min_j / BLOCK_SIZE - 1);
+  int max_bi = min(blocks_x_ - 1, (max_i - 1) / BLOCK_SIZE + 1);
+  int max_bj = min(blocks_y_ - 1, (max_j - 1) / BLOCK_SIZE + 1);
+  int nblocks = (max_bi - min_bi + 1) * (max_bj - min_bj + 1);
+  int nthreads = 1;
+  if (nblocks * BLOCK_SIZE * BLOCK_SIZE >= 2 * COST_BAND_CELLS) {
+    nthreads = min<int>(nblocks * BLOCK_SIZE * BLOCK_SIZE / COST_BAND_CELLS,
+                        max(1u, boost::thread::hardware_concurrency()));
+    nthreads = min(nthreads, max_bj - min_bj + 1);
+  }
+  if (nthreads == 1) {
+    updateBlockRows(min_bi, min_bj, max_bi, max_bj);
+    return;
+  }
+  // Each thread computes its own rows of blocks
+  boost::thread_group threads;
+  for (int t = 0; t < nthreads; ++t) {
+    int begin_bj = min_bj + (max_bj - min_bj + 1) * t / nthreads;
+    int end_bj = min_bj + (max_bj - min_bj + 1) * (t + 1) / nthreads;
+    threads.create_thread(
+      boost::bind(&OccupancyMap::updateBlockRows, this,
+                  min_bi, begin_bj, max_bi, end_bj - 1));
+  }
+  threads.join_all();
+}
+
+void OccupancyMap::updateBlockRows(int min_bi, int min_bj,
+                                   int max_bi, int max_bj) {
+  for (int bj = min_bj; bj <= max_bj; ++bj) {
+    for (int bi = min_bi; bi <= max_bi; ++bi) {
+      uint32_t edges = 0;
+      int begin_i = bi * BLOCK_SIZE, end_i = min(map_->size_x, begin_i + BLOCK_SIZE);
+      int begin_j = bj * BLOCK_SIZE, end_j = min(map_->size_y, begin_j + BLOCK_SIZE);
+      // Only moves from the cells on the border of the block can leave it
+      for (int j = begin_j; j < end_j; ++j) {
+        int step = j == begin_j || j == end_j - 1 ? 1 : end_i - begin_i - 1;
+        for (int i = begin_i; i < end_i; i += max(step, 1)) {
+          int index = MAP_INDEX(map_, i, j);
+          if (isinf(map_->cost[index])) {
+            continue;
+          }
+          bool unknown = map_->occ_state[index] == map_cell_t::UNKNOWN;
+          for (int nj = j - 1; nj <= j + 1; ++nj) {
+            for (int ni = i - 1; ni <= i + 1; ++ni) {
+              if (!MAP_VALID(map_, ni, nj)) {
+                continue;
+              }
+              int di = (ni >= end_i) - (ni < begin_i);
+              int dj = (nj >= end_j) - (nj < begin_j);
+              int nindex = MAP_INDEX(map_, ni, nj);
+              if ((di == 0 && dj == 0) || isinf(map_->cost[nindex])) {
+                continue;
+              }
+              uint32_t bit = 1 << ((dj + 1) * 3 + di + 1);
+              edges |= bit << BLOCK_UNKNOWN_SHIFT;
+              if (!unknown &&
+                  map_->occ_state[nindex] != map_cell_t::UNKNOWN) {
+                edges |= bit;
+              }
+            }
+          }
+        }
       }
-      // Add cost occ prob
-      if (lethal_occ_dist < max_occ_dist) {
-        float dist_cost = 1.0 - (map_->cells[i].occ_dist - lethal_occ_dist) / (max_occ_dist - lethal_occ_dist);
-        map_->cells[i].cost += cost_occ_dist * dist_cost;
-      } else {
-        map_->cells[i].cost = std::numeric_limits<float>::infinity();
+      blocks_[bi + bj * blocks_x_] = edges;
+    }
+  }
+}
+
+void OccupancyMap::addMarginLayer(double margin) {
+  for (size_t k = 0; k < margin_layers_.size(); ++k) {
+    if (margin_layers_[k].first == margin) {
+      return;
+    }
+  }
+  margin_layers_.push_back(make_pair(margin, BitGrid()));
+  if (!passable_.empty()) {
+    BitGrid *layer = &margin_layers_.back().second;
+    layer->resize(map_->size_x, map_->size_y);
+    updateMarginLayer(margin, layer, 0, 0, map_->size_x, map_->size_y);
+  }
+}
+
+const BitGrid* OccupancyMap::marginLayer(double margin) const {
+  for (size_t k = 0; k < margin_layers_.size(); ++k) {
+    if (margin_layers_[k].first == margin &&
+        !margin_layers_[k].second.empty()) {
+      return &margin_layers_[k].second;
+    }
+  }
+  return NULL;
+}
+
+void OccupancyMap::clearLayers() {
+  passable_.clear();
+  known_.clear();
+  for (size_t k = 0; k < margin_layers_.size(); ++k) {
+    margin_layers_[k].second.clear();
+  }
+}
+
+void OccupancyMap::updateLayers(int min_i, int min_j, int max_i, int max_j) {
+  if (passable_.sizeX() != map_->size_x || passable_.sizeY() != map_->size_y) {
+    passable_.resize(map_->size_x, map_->size_y);
+    known_.resize(map_->size_x, map_->size_y);
+    for (size_t k = 0; k < margin_layers_.size(); ++k) {
+      margin_layers_[k].second.resize(map_->size_x, map_->size_y);
+    }
+    min_i = min_j = 0;
+    max_i = map_->size_x;
+    max_j = map_->size_y;
+  }
+  // Assemble the bits a word at a time
+  for (int j = min_j; j < max_j; ++j) {
+    for (int w = min_i >> 6; w <= (max_i - 1) >> 6; ++w) {
+      int begin = max(min_i, w << 6), end = min(max_i, (w + 1) << 6);
+      uint64_t mask = 0, passable = 0, known = 0;
+      for (int i = begin; i < end; ++i) {
+        int index = MAP_INDEX(map_, i, j);
+        uint64_t bit = uint64_t(1) << (i & 63);
+        mask |= bit;
+        passable |= isinf(map_->cost[index]) ? 0 : bit;
+        known |= map_->occ_state[index] == map_cell_t::UNKNOWN ? 0 : bit;
       }
+      passable_.setBits(j, w, mask, passable);
+      known_.setBits(j, w, mask, known);
     }
   }
+  for (size_t k = 0; k < margin_layers_.size(); ++k) {
+    updateMarginLayer(margin_layers_[k].first, &margin_layers_[k].second,
+                      min_i, min_j, max_i, max_j);
+  }
 }
 
-bool OccupancyMap::nearestPoint(double x, double y, double max_obst_distance,
-                                double *out_x, double *out_y) const {
-  // spiral out from current point until we hit unoccupied grid cell
-  double theta_inc = 0.3;
-  double radius_inc = 0.01;
+void OccupancyMap::updateMarginLayer(double margin, BitGrid *layer,
+                                     int min_i, int min_j,
+                                     int max_i, int max_j) {
+  // Compare occ_dist codes instead of distances: the smallest code at least
+  // margin away, using the arithmetic of map_occ_dist(), and whether cells
+  // beyond max_occ_dist are
+  double margin_cells = max(0.0, margin / map_->scale);
+  int min_code = min(ceil(margin_cells * margin_cells), double(MAP_DIST_MAX));
+  while (min_code > 0 && map_->scale * sqrt(double(min_code - 1)) >= margin) {
+    --min_code;
+  }
+  while (min_code < MAP_DIST_MAX &&
+         map_->scale * sqrt(double(min_code)) < margin) {
+    ++min_code;
+  }
+  bool far_clear = map_->max_occ_dist >= margin;
+  for (int j = min_j; j < max_j; ++j) {
+    for (int w = min_i >> 6; w <= (max_i - 1) >> 6; ++w) {
+      int begin = max(min_i, w << 6), end = min(max_i, (w + 1) << 6);
+      uint64_t mask = 0, clear = 0;
+      for (int i = begin; i < end; ++i) {
+        int index = MAP_INDEX(map_, i, j);
+        uint64_t bit = uint64_t(1) << (i & 63);
+        int code = map_->occ_dist[index];
+        mask |= bit;
+        if (map_->occ_state[index] != map_cell_t::OCCUPIED &&
+            (code == MAP_DIST_MAX ? far_clear : code >= min_code)) {
+          clear |= bit;
+        }
+      }
+      layer->setBits(j, w, mask, clear);
+    }
+  }
+}
 
-  double radius = 0.0, theta = 0.0;
+// Search radius of nearestPoint() in meters
+static const double NEAREST_POINT_RADIUS = 5.0;
 
+static bool offsetLess(const pair<int, pair<int, int> > &a,
+                       const pair<int, pair<int, int> > &b) {
+  return a.first < b.first;
+}
+
+void OccupancyMap::updateNearestOffsets() {
+  nearest_offsets_.clear();
+  nearest_dist_sq_.clear();
+  if (map_ == NULL || map_->scale <= 0.0) {
+    return;
+  }
+  int radius = ceil(NEAREST_POINT_RADIUS / map_->scale) + 1;
+  vector<pair<int, pair<int, int> > > offsets;
+  for (int dj = -radius; dj <= radius; ++dj) {
+    for (int di = -radius; di <= radius; ++di) {
+      if (di * di + dj * dj <= radius * radius) {
+        offsets.push_back(make_pair(di * di + dj * dj, make_pair(di, dj)));
+      }
+    }
+  }
+  stable_sort(offsets.begin(), offsets.end(), offsetLess);
+  nearest_offsets_.resize(offsets.size());
+  nearest_dist_sq_.resize(offsets.size());
+  for (size_t k = 0; k < offsets.size(); ++k) {
+    nearest_dist_sq_[k] = offsets[k].first;
+    nearest_offsets_[k] = offsets[k].second;
+  }
+}
+
+// Column of the first cell from i towards max_i (step 1) or min_i (step -1),
+// within [min_i, max_i), whose bit is set in all of rows a, b and c, or -1
+static int findSetBit(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+                      int i, int step, int min_i, int max_i) {
+  if (i < min_i || i >= max_i) {
+    return -1;
+  }
+  int w = i >> 6;
+  uint64_t mask = step > 0 ? ~uint64_t(0) << (i & 63)
+    : ~uint64_t(0) >> (63 - (i & 63));
+  int last = step > 0 ? (max_i - 1) >> 6 : min_i >> 6;
+  while (true) {
+    uint64_t word = a[w] & b[w] & c[w] & mask;
+    if (word != 0) {
+      int found = step > 0 ? (w << 6) + __builtin_ctzll(word)
+        : (w << 6) + 63 - __builtin_clzll(word);
+      return min_i <= found && found < max_i ? found : -1;
+    }
+    if (w == last) {
+      return -1;
+    }
+    w += step;
+    mask = ~uint64_t(0);
+  }
+}
+
+bool OccupancyMap::nearestPoint(double x, double y, double max_obst_distance,
+                                double *out_x, double *out_y) const {
   *out_x = x;
   *out_y = y;
-  while (true) {
-    const map_cell_t *cell = getCell(*out_x, *out_y);
-    if (cell &&
-        cell->occ_state == map_cell_t::FREE &&
-        cell->occ_dist > max_obst_distance) {
+  if (map_ == NULL) {
+    return false;
+  }
+  int ci = MAP_GXWX(map_, x), cj = MAP_GYWY(map_, y);
+  int radius = ceil(NEAREST_POINT_RADIUS / map_->scale) + 1;
+  double best = numeric_limits<double>::infinity();
+  int best_i = 0, best_j = 0;
+
+  // Cells exactly at the margin count as clear, as in safePoint(), with or
+  // without a layer, but only cells that can be entered are returned: with
+  // the lethal distance as the margin, cells at it have infinite cost
+  const BitGrid *layer = marginLayer(max_obst_distance);
+  if (layer != NULL && !passable_.empty()) {
+    if (MAP_VALID(map_, ci, cj) && layer->get(ci, cj) && known_.get(ci, cj) &&
+        passable_.get(ci, cj)) {
       return true;
-    } else if (hypot(*out_x - x, *out_y - y) > 5.0) {
-      return false;
     }
-    theta += theta_inc;
-    radius += radius_inc;
-
-    *out_x = x + radius * cos(theta);
-    *out_y = y + radius * sin(theta);
+    // The closest cell of each row is the closest set bit on either side of
+    // ci, found a word at a time.  Rows are visited outwards until they are
+    // further than the best cell.
+    int min_i = max(0, ci - radius), max_i = min(map_->size_x, ci + radius + 1);
+    for (int dj = 0; dj <= radius; ++dj) {
+      if ((dj - 0.5) * map_->scale >= best) {
+        break;
+      }
+      for (int j = cj - dj; j <= cj + dj; j += max(2 * dj, 1)) {
+        if (j < 0 || j >= map_->size_y) {
+          continue;
+        }
+        const uint64_t *a = layer->row(j), *b = known_.row(j);
+        const uint64_t *c = passable_.row(j);
+        int found[2] = {
+          findSetBit(a, b, c, max(ci, min_i), 1, min_i, max_i),
+          findSetBit(a, b, c, min(ci, max_i - 1), -1, min_i, max_i)
+        };
+        for (int k = 0; k < 2; ++k) {
+          if (found[k] < 0) {
+            continue;
+          }
+          double dist = hypot(MAP_WXGX(map_, found[k]) - x,
+                              MAP_WYGY(map_, j) - y);
+          if (dist < best && dist <= NEAREST_POINT_RADIUS) {
+            best = dist;
+            best_i = found[k];
+            best_j = j;
+          }
+        }
+      }
+    }
+  } else {
+    // Visit cells by increasing distance of their offset from the cell of
+    // (x, y).  That differs from the distance to (x, y) by at most half a
+    // diagonal, so the closest cell is found once the offsets are that much
+    // further than the best so far.
+    double max_dist = NEAREST_POINT_RADIUS / map_->scale;
+    for (size_t k = 0; k < nearest_offsets_.size(); ++k) {
+      if (sqrt(double(nearest_dist_sq_[k])) - M_SQRT1_2 >= min(best, max_dist)) {
+        break;
+      }
+      int i = ci + nearest_offsets_[k].first;
+      int j = cj + nearest_offsets_[k].second;
+      if (!MAP_VALID(map_, i, j)) {
+        continue;
+      }
+      int index = MAP_INDEX(map_, i, j);
+      if (map_->occ_state[index] != map_cell_t::FREE ||
+          map_occ_dist(map_, index) < max_obst_distance ||
+          isinf(map_->cost[index])) {
+        continue;
+      }
+      if (k == 0) {
+        return true;
+      }
+      double dist = hypot(MAP_WXGX(map_, i) - x, MAP_WYGY(map_, j) - y) /
+        map_->scale;
+      if (dist < best && dist <= max_dist) {
+        best = dist;
+        best_i = i;
+        best_j = j;
+      }
+    }
   }
+  if (isinf(best)) {
+    return false;
+  }
+  *out_x = MAP_WXGX(map_, best_i);
+  *out_y = MAP_WYGY(map_, best_j);
+  return true;
 }
 
 
-nav_msgs::OccupancyGrid OccupancyMap::getCSpace() {
-  nav_msgs::OccupancyGrid grid;
-  grid.info.width = map_->size_x;
-  grid.info.height = map_->size_y;
-  grid.info.resolution = map_->scale;
-  grid.info.origin.position.x = map_->origin_x - map_->size_x / 2 * map_->scale;
-  grid.info.origin.position.y = map_->origin_y - map_->size_y / 2 * map_->scale;
+// Header and geometry of a grid matching map
+static void gridInfo(const map_t *map, nav_msgs::OccupancyGrid *grid) {
+  grid->info.width = map->size_x;
+  grid->info.height = map->size_y;
+  grid->info.resolution = map->scale;
+  grid->info.origin.position.x = map->origin_x - map->size_x / 2 * map->scale;
+  grid->info.origin.position.y = map->origin_y - map->size_y / 2 * map->scale;
+  grid->data.resize(map->size_x * map->size_y);
+}
 
-  // Convert to player format
-  grid.data.resize(map_->size_x*map_->size_y);
-  ROS_ASSERT(map_->cells);
+const nav_msgs::OccupancyGrid& OccupancyMap::getCSpace() {
+  if (cspace_grid_version_ == version_) {
+    return cspace_grid_;
+  }
+  gridInfo(map_, &cspace_grid_);
+  ROS_ASSERT(map_->data);
+  // Convert to player format, with one division per distinct distance code
+  int max_code = ceil(map_->max_occ_dist / map_->scale);
+  max_code *= max_code;
+  vector<int8_t> values(max_code + 1);
+  for (int code = 0; code <= max_code; ++code) {
+    values[code] = 100 - int(100. * (map_->scale * sqrt(double(code))) /
+                             map_->max_occ_dist);
+  }
+  int8_t far_value = 100 - int(100. * map_->max_occ_dist / map_->max_occ_dist);
   for (int i = 0; i < map_->size_x * map_->size_y; ++i) {
-    grid.data[i] = 100 - int(100. * map_->cells[i].occ_dist / map_->max_occ_dist);
+    int code = map_->occ_dist[i];
+    cspace_grid_.data[i] = code <= max_code ? values[code] : far_value;
   }
+  cspace_grid_version_ = version_;
+  return cspace_grid_;
+}
 
-  return grid;
+// Scale n costs to [0, 100] relative to max_cost, 100 for lethal cells
+static void quantizeCosts(const float *cost, int n, float max_cost,
+                          int8_t *data) {
+  for (int i = 0; i < n; ++i) {
+    if (isinff(cost[i])) {
+      data[i] = 100;
+    } else {
+      data[i] = int(100.0 * cost[i] / max_cost);
+    }
+  }
 }
 
-nav_msgs::OccupancyGrid OccupancyMap::getCostMap() {
-  nav_msgs::OccupancyGrid grid;
-  grid.info.width = map_->size_x;
-  grid.info.height = map_->size_y;
-  grid.info.resolution = map_->scale;
-  grid.info.origin.position.x = map_->origin_x - map_->size_x / 2 * map_->scale;
-  grid.info.origin.position.y = map_->origin_y - map_->size_y / 2 * map_->scale;
+const nav_msgs::OccupancyGrid& OccupancyMap::getCostMap() {
+  updateCostGrid();
+  return cost_grid_;
+}
 
-  // Convert to player format
-  grid.data.resize(map_->size_x*map_->size_y);
-  ROS_ASSERT(map_->cells);
-  float max_cost = -std::numeric_limits<float>::infinity();
-  for (int i = 0; i < map_->size_x * map_->size_y; ++i) {
-    if (map_->cells[i].cost > max_cost && !isinff(map_->cells[i].cost)) {
-      max_cost = map_->cells[i].cost;
+bool OccupancyMap::updateCostGrid() {
+  if (cost_grid_version_ == version_) {
+    return true;
+  }
+  ROS_ASSERT(map_->data);
+  // updateCosts() finds the largest cost unless it only updated part of the
+  // map
+  if (!max_cost_valid_) {
+    max_cost_ = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < map_->size_x * map_->size_y; ++i) {
+      if (map_->cost[i] > max_cost_ && !isinff(map_->cost[i])) {
+        max_cost_ = map_->cost[i];
+      }
     }
+    max_cost_valid_ = true;
   }
-  for (int i = 0; i < map_->size_x * map_->size_y; ++i) {
-    if (isinff(map_->cells[i].cost)) {
-      grid.data[i] = 100;
-    } else {
-      grid.data[i] = int(100.0 * map_->cells[i].cost / max_cost);
+
+  // After a single in place update with the same scaling, only the cells
+  // whose cost changed need converting
+  const vector<int> *changed = cost_grid_version_ != 0 ?
+    changedCells(cost_grid_version_) : NULL;
+  bool incremental = changed != NULL && max_cost_ == cost_grid_max_cost_;
+  cost_grid_version_ = version_;
+  cost_grid_max_cost_ = max_cost_;
+  if (incremental) {
+    for (size_t k = 0; k < changed->size(); ++k) {
+      int index = (*changed)[k];
+      quantizeCosts(map_->cost + index, 1, max_cost_,
+                    &cost_grid_.data[index]);
     }
+    return true;
   }
 
-  return grid;
+  // Convert to player format
+  gridInfo(map_, &cost_grid_);
+  int ncells = map_->size_x * map_->size_y;
+  int nthreads = 1;
+  if (ncells >= 2 * COST_BAND_CELLS) {
+    nthreads = min<int>(ncells / COST_BAND_CELLS,
+                        max(1u, boost::thread::hardware_concurrency()));
+  }
+  if (nthreads == 1) {
+    quantizeCosts(map_->cost, ncells, max_cost_, &cost_grid_.data[0]);
+  } else {
+    boost::thread_group threads;
+    for (int t = 0; t < nthreads; ++t) {
+      int begin = size_t(ncells) * t / nthreads;
+      int end = size_t(ncells) * (t + 1) / nthreads;
+      threads.create_thread(
+        boost::bind(&quantizeCosts, map_->cost + begin, end - begin,
+                    max_cost_, &cost_grid_.data[begin]));
+    }
+    threads.join_all();
+  }
+  return false;
+}
+
+bool OccupancyMap::getCostMapUpdates(
+    int tile_size, vector<map_msgs::OccupancyGridUpdate> *updates) {
+  updates->clear();
+  unsigned version = cost_grid_version_;
+  if (version == version_) {
+    return true;
+  }
+  if (!updateCostGrid()) {
+    return false;
+  }
+
+  // Mark the tiles holding changed cells, then copy each out of the grid
+  const vector<int> &changed = *changedCells(version);
+  int tiles_x = (map_->size_x + tile_size - 1) / tile_size;
+  int tiles_y = (map_->size_y + tile_size - 1) / tile_size;
+  vector<bool> dirty(tiles_x * tiles_y, false);
+  for (size_t k = 0; k < changed.size(); ++k) {
+    int i = changed[k] % map_->size_x, j = changed[k] / map_->size_x;
+    dirty[i / tile_size + (j / tile_size) * tiles_x] = true;
+  }
+  for (int tj = 0; tj < tiles_y; ++tj) {
+    for (int ti = 0; ti < tiles_x; ++ti) {
+      if (!dirty[ti + tj * tiles_x]) {
+        continue;
+      }
+      map_msgs::OccupancyGridUpdate update;
+      update.header = cost_grid_.header;
+      update.x = ti * tile_size;
+      update.y = tj * tile_size;
+      update.width = min(tile_size, map_->size_x - int(update.x));
+      update.height = min(tile_size, map_->size_y - int(update.y));
+      update.data.resize(update.width * update.height);
+      for (unsigned j = 0; j < update.height; ++j) {
+        const int8_t *row =
+          &cost_grid_.data[MAP_INDEX(map_, update.x, update.y + j)];
+        copy(row, row + update.width, update.data.begin() + j * update.width);
+      }
+      updates->push_back(update);
+    }
+  }
+  return true;
 }
 
 inline double OccupancyMap::minX() {
@@ -256,13 +1165,25 @@ inline double OccupancyMap::maxY() {
   return MAP_WYGY(map_, map_->size_y);
 }
 
-const map_cell_t* OccupancyMap::getCell(double x, double y) const {
-  return map_get_cell(map_, x, y, 0);
+bool OccupancyMap::getCell(double x, double y, map_cell_t *cell) const {
+  return map_get_cell(map_, x, y, cell);
 }
 
 bool OccupancyMap::lineOfSight(double x1, double y1, double x2, double y2,
                                double max_occ_dist /* = 0.0 */,
                                bool allow_unknown /* = false */) const {
+  return traceLine(x1, y1, x2, y2, max_occ_dist, allow_unknown, false);
+}
+
+bool OccupancyMap::lineOfTravel(double x1, double y1, double x2, double y2,
+                                double max_occ_dist,
+                                bool allow_unknown) const {
+  return traceLine(x1, y1, x2, y2, max_occ_dist, allow_unknown, true);
+}
+
+bool OccupancyMap::traceLine(double x1, double y1, double x2, double y2,
+                             double max_occ_dist, bool allow_unknown,
+                             bool finite_cost) const {
   if (map_ == NULL) {
     return true;
   }
@@ -272,6 +1193,67 @@ bool OccupancyMap::lineOfSight(double x1, double y1, double x2, double y2,
               map_->max_occ_dist, max_occ_dist);
     ROS_BREAK();
   }
+  const BitGrid *layer = marginLayer(max_occ_dist);
+
+  // Amanatides-Woo traversal in grid units, where cell i spans [i, i + 1)
+  // as in MAP_GXWX()
+  double u1 = (x1 - map_->origin_x) / map_->scale + 0.5;
+  double v1 = (y1 - map_->origin_y) / map_->scale + 0.5;
+  double du = (x2 - x1) / map_->scale, dv = (y2 - y1) / map_->scale;
+  int i = floor(u1), j = floor(v1);
+  // Number of cell borders crossed
+  int n = abs(int(floor(u1 + du)) - i) + abs(int(floor(v1 + dv)) - j);
+  int step_i = du > 0 ? 1 : -1, step_j = dv > 0 ? 1 : -1;
+  // Line parameter at the next vertical and horizontal cell border
+  double inf = numeric_limits<double>::infinity();
+  double delta_i = du != 0.0 ? fabs(1.0 / du) : inf;
+  double delta_j = dv != 0.0 ? fabs(1.0 / dv) : inf;
+  double next_i = du != 0.0 ? (du > 0 ? i + 1 - u1 : u1 - i) * delta_i : inf;
+  double next_j = dv != 0.0 ? (dv > 0 ? j + 1 - v1 : v1 - j) * delta_j : inf;
+  i += map_->size_x / 2;
+  j += map_->size_y / 2;
+
+  for (; n >= 0; --n) {
+    if (!MAP_VALID(map_, i, j) ||
+        (finite_cost && !traversable(i, j, allow_unknown))) {
+      return false;
+    }
+    if (layer != NULL) {
+      if (!layer->get(i, j) || (!allow_unknown && !known_.get(i, j))) {
+        return false;
+      }
+    } else {
+      int index = MAP_INDEX(map_, i, j);
+      if (map_->occ_state[index] == map_cell_t::OCCUPIED ||
+          (!allow_unknown && map_->occ_state[index] == map_cell_t::UNKNOWN) ||
+          map_occ_dist(map_, index) < max_occ_dist) {
+        return false;
+      }
+    }
+    if (next_i < next_j) {
+      next_i += delta_i;
+      i += step_i;
+    } else {
+      next_j += delta_j;
+      j += step_j;
+    }
+  }
+  return true;
+}
+
+bool OccupancyMap::lineOfSightSampled(double x1, double y1,
+                                      double x2, double y2,
+                                      double max_occ_dist /* = 0.0 */,
+                                      bool allow_unknown /* = false */) const {
+  if (map_ == NULL) {
+    return true;
+  }
+  if (map_->max_occ_dist < max_occ_dist) {
+    ROS_ERROR("OccupancyMap::lineOfSightSampled() CSpace has been calculated "
+              "up to %f, but max_occ_dist=%.2f",
+              map_->max_occ_dist, max_occ_dist);
+    ROS_BREAK();
+  }
   // March along the line between (x1, y1) and (x2, y2) until the point passes
   // beyond (x2, y2).
   double step_size = map_->scale / 2.0;
@@ -288,92 +1270,86 @@ bool OccupancyMap::lineOfSight(double x1, double y1, double x2, double y2,
   // Terminate when current point defines a vector longer than original vector
   while (pow(line_x - x1, 2) + pow(line_y - y1, 2) < mag_sq) {
     // fprintf(stderr, "%f %f\n", line_x, line_y);
-    map_cell_t *cell = map_get_cell(map_, line_x, line_y, 0);
-    if (cell == NULL) {
+    int index = map_get_index(map_, line_x, line_y);
+    if (index < 0) {
       // ROS_WARN_THROTTLE(5, "lineOfSight() Beyond map edge");
       return false;
-    } else if (cell->occ_state == map_cell_t::OCCUPIED ||
-               (!allow_unknown && cell->occ_state == map_cell_t::UNKNOWN) ||
-               cell->occ_dist < max_occ_dist) {
+    } else if (map_->occ_state[index] == map_cell_t::OCCUPIED ||
+               (!allow_unknown && map_->occ_state[index] == map_cell_t::UNKNOWN) ||
+               map_occ_dist(map_, index) < max_occ_dist) {
       return false;
     }
-    line_x += step_size * ct;
-    line_y += step_size * st;
+    line_x += step_size * ct;
+    line_y += step_size * st;
+  }
+  return true;
+}
+
+bool OccupancyMap::regionClear(double x1, double y1, double x2, double y2,
+                               double max_occ_dist /* = 0.0 */,
+                               bool allow_unknown /* = false */) const {
+  if (map_ == NULL) {
+    return true;
+  }
+  int min_i = MAP_GXWX(map_, min(x1, x2)), max_i = MAP_GXWX(map_, max(x1, x2));
+  int min_j = MAP_GYWY(map_, min(y1, y2)), max_j = MAP_GYWY(map_, max(y1, y2));
+  if (!MAP_VALID(map_, min_i, min_j) || !MAP_VALID(map_, max_i, max_j)) {
+    return false;
+  }
+  const BitGrid *layer = marginLayer(max_occ_dist);
+  if (layer != NULL) {
+    // Whole words of cells at a time
+    for (int j = min_j; j <= max_j; ++j) {
+      if (!layer->rowAll(j, min_i, max_i + 1) ||
+          (!allow_unknown && !known_.rowAll(j, min_i, max_i + 1))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  for (int j = min_j; j <= max_j; ++j) {
+    for (int i = min_i; i <= max_i; ++i) {
+      int index = MAP_INDEX(map_, i, j);
+      if (map_->occ_state[index] == map_cell_t::OCCUPIED ||
+          (!allow_unknown && map_->occ_state[index] == map_cell_t::UNKNOWN) ||
+          map_occ_dist(map_, index) < max_occ_dist) {
+        return false;
+      }
+    }
   }
   return true;
 }
 
-void OccupancyMap::initializeSearch(double startx, double starty) {
-  starti_ = MAP_GXWX(map_, startx);
-  startj_ = MAP_GYWY(map_, starty);
+void OccupancyMap::initializeSearch(SearchWorkspace *ws,
+                                    double startx, double starty) const {
+  ws->starti_ = MAP_GXWX(map_, startx);
+  ws->startj_ = MAP_GYWY(map_, starty);
 
-  if (!MAP_VALID(map_, starti_, startj_)) {
+  if (!MAP_VALID(map_, ws->starti_, ws->startj_)) {
     ROS_ERROR("OccupancyMap::initializeSearch() Invalid starting position");
     ROS_BREAK();
   }
 
-  int ncells = map_->size_x * map_->size_y;
-  if (ncells_ != ncells) {
-    ncells_ = ncells;
-    costs_.reset(new float[ncells]);
-    prev_i_.reset(new int[ncells]);
-    prev_j_.reset(new int[ncells]);
-  }
+  ws->begin(map_->size_x * map_->size_y);
+
+  int start_ind = MAP_INDEX(map_, ws->starti_, ws->startj_);
+  ws->stamps_[start_ind] = ws->epoch_;
+  ws->costs_[start_ind] = 0.0;
+  ws->prev_i_[start_ind] = ws->starti_;
+  ws->prev_j_[start_ind] = ws->startj_;
+  ws->jump_dir_[start_ind] = 4;
+
+  ws->Q_->reset(ws->ncells_);
+  ws->Q_->push(start_ind, 0.0);
+  ws->expanded_ = 0;
+  ws->field_.reset();
 
-  // TODO: Return to more efficient lazy-initialization
-  // // Map is large and initializing costs_ takes a while.  To speedup,
-  // // partially initialize costs_ in a rectangle surrounding start and stop
-  // // positions + margin.  If you run up against boundary, initialize the rest.
-  // int margin = 120;
-  // init_ul_ = make_pair(max(0, min(starti_, stopi) - margin),
-  //                      max(0, min(startj_, stopj) - margin));
-  // init_lr_ = make_pair(min(map_->size_x, max(starti_, stopi) + margin),
-  //                      min(map_->size_y, max(startj_, stopj) + margin));
-  // for (int j = init_ul.second; j < init_lr.second; ++j) {
-  //   for (int i = init_ul.first; i < init_lr.first; ++i) {
-  //     int ind = MAP_INDEX(map_, i, j);
-  //     costs_[ind] = std::numeric_limits<float>::infinity();
-  //   }
-  // }
-  // full_init_ = false;
-
-  for (int i = 0; i < ncells_; ++i) {
-    costs_[i] = std::numeric_limits<float>::infinity();
-    prev_i_[i] = -1;
-    prev_j_[i] = -1;
-  }
-
-  int start_ind = MAP_INDEX(map_, starti_, startj_);
-  costs_[start_ind] = 0.0;
-  prev_i_[starti_] = starti_;
-  prev_j_[startj_] = startj_;
-
-  Q_.reset(new set<Node, NodeCompare>());
-  Q_->insert(Node(make_pair(starti_, startj_), 0.0, 0.0));
-
-  stopi_ = -1;
-  stopj_ = -1;
-}
-
-void OccupancyMap::addNeighbors(const Node &node, double max_occ_dist, bool allow_unknown) {
-  // TODO: Return to more efficient lazy-initialization
-  // // Check if we're neighboring nodes whose costs_ are uninitialized.
-  // // if (!full_init &&
-  // //     ((ci + 1 >= init_lr.first) || (ci - 1 <= init_ul.first) ||
-  // //      (cj + 1 >= init_lr.second) || (cj - 1 <= init_ul.second))) {
-  // //   full_init = true;
-  // //   for (int j = 0; j < map_->size_y; ++j) {
-  // //     for (int i = 0; i < map_->size_x; ++i) {
-  // //       // Only initialize costs_ that are outside original rectangle
-  // //       if (!(init_ul.first <= i && i < init_lr.first &&
-  // //             init_ul.second <= j && j < init_lr.second)) {
-  // //         int ind = MAP_INDEX(map_, i, j);
-  // //         costs_[ind] = std::numeric_limits<float>::infinity();
-  // //       }
-  // //     }
-  // //   }
-  // // }
+  ws->stopi_ = -1;
+  ws->stopj_ = -1;
+}
 
+void OccupancyMap::addNeighbors(SearchWorkspace *ws, const Node &node,
+                                double max_occ_dist, bool allow_unknown) const {
   int ci = node.coord.first;
   int cj = node.coord.second;
 
@@ -385,124 +1361,546 @@ void OccupancyMap::addNeighbors(const Node &node, double max_occ_dist, bool allo
         continue;
       }
       // fprintf(stderr, "  Examining %i %i ", newi, newj);
-      int index = MAP_INDEX(map_, newi, newj);
-      map_cell_t *cell = map_->cells + index;
       // If cell is occupied or too close to occupied cell, continue
-
-      if (isinff(cell->cost) ||
-          (!allow_unknown && cell->occ_state == map_cell_t::UNKNOWN)) {
+      if (!traversable(newi, newj, allow_unknown)) {
+        continue;
+      }
+      if (!ws->corridor_.empty() &&
+          !ws->corridor_[newi / BLOCK_SIZE + (newj / BLOCK_SIZE) * blocks_x_]) {
+        continue;
+      }
+      int index = MAP_INDEX(map_, newi, newj);
+      if (ws->closed(index)) {
         // fprintf(stderr, "occupado\n");
         continue;
       }
+      float cell_cost = map_->cost[index];
       // fprintf(stderr, "free\n");
       double edge_cost = ci == newi || cj == newj ? 1 : sqrt(2);
-      double heur_cost = 0.0;
-      if (stopi_ != -1 && stopj_ != -1) {
-        heur_cost = hypot(newi - stopi_, newj - stopj_);
-      }
-      double total_cost = node.true_cost + edge_cost + cell->cost + heur_cost;
-      if (total_cost < costs_[index]) {
-        // fprintf(stderr, "    Better path: new cost= % 6.2f\n", ttl_cost);
-        // If node has finite cost, it's in queue and needs to be removed
-        if (!isinf(costs_[index])) {
-          Q_->erase(Node(make_pair(newi, newj), costs_[index], 0.0));
+      double true_cost = node.true_cost + edge_cost + cell_cost;
+      if (ws->stamps_[index] < ws->epoch_ || true_cost < ws->costs_[index]) {
+        // fprintf(stderr, "    Better path: new cost= % 6.2f\n", true_cost);
+        double heur_cost = 0.0;
+        if (ws->stopi_ != -1 && ws->stopj_ != -1) {
+          heur_cost = hypot(newi - ws->stopi_, newj - ws->stopj_);
         }
-        costs_[index] = total_cost;
-        prev_i_[index] = ci;
-        prev_j_[index] = cj;
-        Q_->insert(Node(make_pair(newi, newj),
-                        node.true_cost + edge_cost + cell->cost,
-                        total_cost));
+        ws->stamps_[index] = ws->epoch_;
+        ws->costs_[index] = true_cost;
+        ws->prev_i_[index] = ci;
+        ws->prev_j_[index] = cj;
+        ws->Q_->push(index, true_cost + heur_cost);
       }
     }
   }
 }
 
-void OccupancyMap::buildPath(int i, int j, Path *path) {
-  while (!(i == starti_ && j == startj_)) {
+void OccupancyMap::buildPath(const SearchWorkspace &ws, int i, int j,
+                             Path *path) const {
+  while (!(i == ws.starti_ && j == ws.startj_)) {
     int index = MAP_INDEX(map_, i, j);
     float x = MAP_WXGX(map_, i);
     float y = MAP_WYGY(map_, j);
     path->push_back(Eigen::Vector2f(x, y));
 
-    i = prev_i_[index];
-    j = prev_j_[index];
+    i = ws.prev_i_[index];
+    j = ws.prev_j_[index];
   }
   float x = MAP_WXGX(map_, i);
   float y = MAP_WYGY(map_, j);
   path->push_back(Eigen::Vector2f(x, y));
 }
 
-bool OccupancyMap::nextNode(double max_occ_dist, Node *curr_node, bool allow_unknown) {
-  if (!Q_->empty()) {
-    // Copy node and then erase it
-    *curr_node = *Q_->begin();
-    int ci = curr_node->coord.first, cj = curr_node->coord.second;
+bool OccupancyMap::nextNode(SearchWorkspace *ws, double max_occ_dist,
+                            Node *curr_node, bool allow_unknown) const {
+  while (!ws->Q_->empty()) {
+    float key;
+    int index = ws->Q_->pop(&key);
+    // Skip stale entries left behind by open lists without decrease-key
+    if (ws->closed(index)) {
+      continue;
+    }
+    ws->stamps_[index] = ws->epoch_ + 1;
+    ++ws->expanded_;
+
+    curr_node->coord = make_pair(index % map_->size_x, index / map_->size_x);
+    curr_node->true_cost = ws->costs_[index];
+    curr_node->heuristic = key;
     // fprintf(stderr, "At %i %i (cost = %6.2f)  % 7.2f % 7.2f \n",
     //     ci, cj, curr_node.true_dist, MAP_WXGX(map_, ci), MAP_WYGY(map_, cj));
-    costs_[MAP_INDEX(map_, ci, cj)] = curr_node->true_cost;
-    Q_->erase(Q_->begin());
-    addNeighbors(*curr_node, max_occ_dist, allow_unknown);
+    addNeighbors(ws, *curr_node, max_occ_dist, allow_unknown);
     return true;
-  } else {
-    return false;
   }
+  return false;
 }
 
 Path OccupancyMap::astar(double startx, double starty,
-                                double stopx, double stopy,
-                                double max_occ_dist /* = 0.0 */,
-                                bool allow_unknown /* = false */) {
+                         double stopx, double stopy,
+                         double max_occ_dist /* = 0.0 */,
+                         bool allow_unknown /* = false */) {
+  return astar(workspace_.get(), startx, starty, stopx, stopy, max_occ_dist,
+               allow_unknown);
+}
+
+Path OccupancyMap::astar(SearchWorkspace *ws, double startx, double starty,
+                         double stopx, double stopy,
+                         double max_occ_dist /* = 0.0 */,
+                         bool allow_unknown /* = false */) const {
   Path path;
 
-  if (map_ == NULL) {
-    ROS_WARN("OccupancyMap::astar() Map not set");
+  if (!startPointSearch(ws, "astar", startx, starty, stopx, stopy,
+                        max_occ_dist)) {
     return path;
   }
+  int stopi = ws->stopi_, stopj = ws->stopj_;
+
+  bool found = false;
+  Node curr_node;
+  while (nextNode(ws, max_occ_dist, &curr_node, allow_unknown)) {
+    if (curr_node.coord.first == stopi && curr_node.coord.second == stopj) {
+      found = true;
+      break;
+    }
+  }
+
+  // Recreate path
+  if (found) {
+    buildPath(*ws, stopi, stopj, &path);
+  }
+  return Path(path.rbegin(), path.rend());
+}
+
+bool OccupancyMap::searchBlocks(int starti, int startj, int stopi,
+                                int stopj, bool allow_unknown,
+                                vector<int> *block_prev) const {
+  int shift = allow_unknown ? BLOCK_UNKNOWN_SHIFT : 0;
+  int nblocks = blocks_x_ * blocks_y_;
+  int start_block = starti / BLOCK_SIZE + (startj / BLOCK_SIZE) * blocks_x_;
+  int stop_bi = stopi / BLOCK_SIZE, stop_bj = stopj / BLOCK_SIZE;
+  int stop_block = stop_bi + stop_bj * blocks_x_;
+  vector<float> block_costs(nblocks, std::numeric_limits<float>::infinity());
+  block_prev->assign(nblocks, -1);
+  IndexedHeap<float> heap;
+  heap.resize(nblocks);
+  block_costs[start_block] = 0.0;
+  heap.push(start_block, 0.0);
+  // astar() lets a start it can't enter, e.g. inside lethal_occ_dist, step
+  // out to any neighbor it can, but the blocks only hold moves out of cells
+  // that can be entered, so start from the blocks of those neighbors too
+  if (!traversable(starti, startj, allow_unknown)) {
+    for (int nj = startj - 1; nj <= startj + 1; ++nj) {
+      for (int ni = starti - 1; ni <= starti + 1; ++ni) {
+        if (!traversable(ni, nj, allow_unknown)) {
+          continue;
+        }
+        int bi = ni / BLOCK_SIZE, bj = nj / BLOCK_SIZE;
+        int nblock = bi + bj * blocks_x_;
+        float true_cost = nblock == start_block ? 0.0 :
+          (bi == starti / BLOCK_SIZE || bj == startj / BLOCK_SIZE ? 1.0 :
+           M_SQRT2);
+        if (true_cost < block_costs[nblock]) {
+          block_costs[nblock] = true_cost;
+          (*block_prev)[nblock] = start_block;
+          heap.push(nblock, true_cost + hypot(bi - stop_bi, bj - stop_bj));
+        }
+      }
+    }
+  }
+  while (!heap.empty() && heap.top() != stop_block) {
+    int block = heap.pop();
+    int bi = block % blocks_x_, bj = block / blocks_x_;
+    for (int nj = bj - 1; nj <= bj + 1; ++nj) {
+      for (int ni = bi - 1; ni <= bi + 1; ++ni) {
+        uint32_t bit = 1 << ((nj - bj + 1) * 3 + ni - bi + 1);
+        if (!(blocks_[block] & (bit << shift))) {
+          continue;
+        }
+        int nblock = ni + nj * blocks_x_;
+        float true_cost = block_costs[block] +
+          (ni == bi || nj == bj ? 1.0 : M_SQRT2);
+        if (true_cost < block_costs[nblock]) {
+          block_costs[nblock] = true_cost;
+          (*block_prev)[nblock] = block;
+          heap.push(nblock, true_cost + hypot(ni - stop_bi, nj - stop_bj));
+        }
+      }
+    }
+  }
+  return !heap.empty();
+}
+
+bool OccupancyMap::blocksConnect(double x1, double y1, double x2, double y2,
+                                 bool allow_unknown /* = false */) const {
+  if (map_ == NULL || blocks_.empty()) {
+    return true;
+  }
+  int i1 = MAP_GXWX(map_, x1), j1 = MAP_GYWY(map_, y1);
+  int i2 = MAP_GXWX(map_, x2), j2 = MAP_GYWY(map_, y2);
+  if (!MAP_VALID(map_, i1, j1) || !MAP_VALID(map_, i2, j2)) {
+    return true;
+  }
+  vector<int> block_prev;
+  return searchBlocks(i1, j1, i2, j2, allow_unknown, &block_prev);
+}
+
+Path OccupancyMap::hierarchicalAstar(double startx, double starty,
+                                     double stopx, double stopy,
+                                     double max_occ_dist /* = 0.0 */,
+                                     bool allow_unknown /* = false */) {
+  return hierarchicalAstar(workspace_.get(), startx, starty, stopx, stopy,
+                           max_occ_dist, allow_unknown);
+}
+
+Path OccupancyMap::hierarchicalAstar(SearchWorkspace *ws,
+                                     double startx, double starty,
+                                     double stopx, double stopy,
+                                     double max_occ_dist /* = 0.0 */,
+                                     bool allow_unknown /* = false */) const {
+  if (map_ == NULL || blocks_.empty() ||
+      !MAP_VALID(map_, MAP_GXWX(map_, startx), MAP_GYWY(map_, starty)) ||
+      !MAP_VALID(map_, MAP_GXWX(map_, stopx), MAP_GYWY(map_, stopy))) {
+    // Let astar() report the problem
+    return astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                 allow_unknown);
+  }
+  int starti = MAP_GXWX(map_, startx), startj = MAP_GYWY(map_, starty);
+  int stopi = MAP_GXWX(map_, stopx), stopj = MAP_GYWY(map_, stopy);
+
+  // A* over blocks, which are connected if a move between their cells is.
+  // Every path in the map maps to a path over blocks, so if there is none
+  // the goal is unreachable.
+  vector<int> block_prev;
+  if (!searchBlocks(starti, startj, stopi, stopj, allow_unknown,
+                    &block_prev)) {
+    ws->expanded_ = 0;
+    return Path();
+  }
+  int nblocks = blocks_x_ * blocks_y_;
+  int stop_block = stopi / BLOCK_SIZE + (stopj / BLOCK_SIZE) * blocks_x_;
+
+  // Refine within the blocks near the coarse path
+  ws->corridor_.assign(nblocks, 0);
+  for (int block = stop_block; block != -1; block = block_prev[block]) {
+    int bi = block % blocks_x_, bj = block / blocks_x_;
+    for (int nj = max(0, bj - CORRIDOR_RADIUS);
+         nj <= min(blocks_y_ - 1, bj + CORRIDOR_RADIUS); ++nj) {
+      for (int ni = max(0, bi - CORRIDOR_RADIUS);
+           ni <= min(blocks_x_ - 1, bi + CORRIDOR_RADIUS); ++ni) {
+        ws->corridor_[ni + nj * blocks_x_] = 1;
+      }
+    }
+  }
+  Path path = astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                    allow_unknown);
+  ws->corridor_.clear();
+
+  // Blocks may connect where their cells don't, e.g. across a thin wall, so
+  // the corridor can miss the way through
+  if (path.empty()) {
+    int corridor_expanded = ws->expanded_;
+    ROS_DEBUG("OccupancyMap::hierarchicalAstar() No path in corridor, "
+              "searching the full map");
+    path = astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                 allow_unknown);
+    ws->expanded_ += corridor_expanded;
+  }
+  return path;
+}
+
+bool OccupancyMap::startPointSearch(SearchWorkspace *ws, const char *caller,
+                                    double startx, double starty,
+                                    double stopx, double stopy,
+                                    double max_occ_dist) const {
+  if (map_ == NULL) {
+    ROS_WARN("OccupancyMap::%s() Map not set", caller);
+    return false;
+  }
 
   int stopi = MAP_GXWX(map_, stopx), stopj = MAP_GYWY(map_, stopy);
   if (!MAP_VALID(map_, stopi ,stopj)) {
-    ROS_ERROR("OccupancyMap::astar() Invalid stopping position");
+    ROS_ERROR("OccupancyMap::%s() Invalid stopping position", caller);
     ROS_BREAK();
   }
   if (map_->max_occ_dist < max_occ_dist) {
-    ROS_ERROR("OccupancyMap::astar() CSpace has been calculated up to %f, "
+    ROS_ERROR("OccupancyMap::%s() CSpace has been calculated up to %f, "
               "but max_occ_dist=%.2f",
-              map_->max_occ_dist, max_occ_dist);
+              caller, map_->max_occ_dist, max_occ_dist);
     ROS_BREAK();
   }
 
-  initializeSearch(startx, starty);
+  initializeSearch(ws, startx, starty);
   // Set stop to use heuristic
-  stopi_ = stopi;
-  stopj_ = stopj;
+  ws->stopi_ = stopi;
+  ws->stopj_ = stopj;
+  return true;
+}
 
-  bool found = false;
-  Node curr_node;
-  while (nextNode(max_occ_dist, &curr_node, allow_unknown)) {
-    if (curr_node.coord.first == stopi && curr_node.coord.second == stopj) {
-      found = true;
+Path OccupancyMap::plan(PlannerType type,
+                        double startx, double starty,
+                        double stopx, double stopy,
+                        double max_occ_dist /* = 0.0 */,
+                        bool allow_unknown /* = false */) {
+  return plan(workspace_.get(), type, startx, starty, stopx, stopy,
+              max_occ_dist, allow_unknown);
+}
+
+Path OccupancyMap::plan(SearchWorkspace *ws, PlannerType type,
+                        double startx, double starty,
+                        double stopx, double stopy,
+                        double max_occ_dist /* = 0.0 */,
+                        bool allow_unknown /* = false */) const {
+  // JPS and Theta* only minimize path length, so they can't honor cell costs
+  bool uniform_cost = cost_occ_prob_ == 0.0 && cost_occ_dist_ == 0.0;
+  if (type == JPS_PLANNER && uniform_cost) {
+    return jps(ws, startx, starty, stopx, stopy, max_occ_dist, allow_unknown);
+  } else if (type == THETA_STAR_PLANNER && uniform_cost) {
+    return thetaStar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                     allow_unknown);
+  } else if (type == HIERARCHICAL_PLANNER) {
+    return hierarchicalAstar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                             allow_unknown);
+  } else {
+    return astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                 allow_unknown);
+  }
+}
+
+bool OccupancyMap::jump(const SearchWorkspace &ws, int i, int j, int di, int dj,
+                        bool allow_unknown, int *jump_i, int *jump_j) const {
+  while (true) {
+    i += di;
+    j += dj;
+    if (!traversable(i, j, allow_unknown)) {
+      return false;
+    }
+    if (i == ws.stopi_ && j == ws.stopj_) {
       break;
     }
+    // Stop where a neighbor is forced, i.e., only reachable optimally through
+    // (i, j), or where a straight jump from a diagonal finds such a cell
+    if (di != 0 && dj != 0) {
+      int ti, tj;
+      if ((!traversable(i - di, j, allow_unknown) &&
+           traversable(i - di, j + dj, allow_unknown)) ||
+          (!traversable(i, j - dj, allow_unknown) &&
+           traversable(i + di, j - dj, allow_unknown)) ||
+          jump(ws, i, j, di, 0, allow_unknown, &ti, &tj) ||
+          jump(ws, i, j, 0, dj, allow_unknown, &ti, &tj)) {
+        break;
+      }
+    } else if (di != 0) {
+      if ((!traversable(i, j + 1, allow_unknown) &&
+           traversable(i + di, j + 1, allow_unknown)) ||
+          (!traversable(i, j - 1, allow_unknown) &&
+           traversable(i + di, j - 1, allow_unknown))) {
+        break;
+      }
+    } else {
+      if ((!traversable(i + 1, j, allow_unknown) &&
+           traversable(i + 1, j + dj, allow_unknown)) ||
+          (!traversable(i - 1, j, allow_unknown) &&
+           traversable(i - 1, j + dj, allow_unknown))) {
+        break;
+      }
+    }
   }
+  *jump_i = i;
+  *jump_j = j;
+  return true;
+}
 
-  // Recreate path
-  if (found) {
-    buildPath(stopi, stopj, &path);
+bool OccupancyMap::jumpPointSearch(SearchWorkspace *ws, double los_occ_dist,
+                                   bool allow_unknown) const {
+  bool any_angle = los_occ_dist >= 0.0;
+  while (!ws->Q_->empty()) {
+    float key;
+    int index = ws->Q_->pop(&key);
+    if (ws->closed(index)) {
+      continue;
+    }
+    ws->stamps_[index] = ws->epoch_ + 1;
+    ++ws->expanded_;
+
+    int ci = index % map_->size_x, cj = index / map_->size_x;
+    if (ci == ws->stopi_ && cj == ws->stopj_) {
+      return true;
+    }
+
+    // Directions to search: all of them from the start, otherwise the natural
+    // and forced neighbors for the direction we arrived from
+    int pi = ws->prev_i_[index], pj = ws->prev_j_[index];
+    int dirs[8][2];
+    int ndirs = 0;
+    int di = ws->jump_dir_[index] / 3 - 1, dj = ws->jump_dir_[index] % 3 - 1;
+    if (di == 0 && dj == 0) {
+      for (int nj = -1; nj <= 1; ++nj) {
+        for (int ni = -1; ni <= 1; ++ni) {
+          if (ni != 0 || nj != 0) {
+            dirs[ndirs][0] = ni;
+            dirs[ndirs++][1] = nj;
+          }
+        }
+      }
+    } else if (di != 0 && dj != 0) {
+      int natural[3][2] = {{di, 0}, {0, dj}, {di, dj}};
+      for (int k = 0; k < 3; ++k) {
+        dirs[ndirs][0] = natural[k][0];
+        dirs[ndirs++][1] = natural[k][1];
+      }
+      if (!traversable(ci - di, cj, allow_unknown)) {
+        dirs[ndirs][0] = -di;
+        dirs[ndirs++][1] = dj;
+      }
+      if (!traversable(ci, cj - dj, allow_unknown)) {
+        dirs[ndirs][0] = di;
+        dirs[ndirs++][1] = -dj;
+      }
+    } else {
+      dirs[ndirs][0] = di;
+      dirs[ndirs++][1] = dj;
+      // Sides perpendicular to the direction of travel
+      int si = dj != 0, sj = di != 0;
+      if (!traversable(ci + si, cj + sj, allow_unknown)) {
+        dirs[ndirs][0] = di + si;
+        dirs[ndirs++][1] = dj + sj;
+      }
+      if (!traversable(ci - si, cj - sj, allow_unknown)) {
+        dirs[ndirs][0] = di - si;
+        dirs[ndirs++][1] = dj - sj;
+      }
+    }
+
+    for (int k = 0; k < ndirs; ++k) {
+      int ni, nj;
+      if (!jump(*ws, ci, cj, dirs[k][0], dirs[k][1], allow_unknown,
+                &ni, &nj)) {
+        continue;
+      }
+      int nindex = MAP_INDEX(map_, ni, nj);
+      if (ws->closed(nindex)) {
+        continue;
+      }
+      int parent_i = ci, parent_j = cj;
+      float true_cost = ws->costs_[index] + octileDistance(ni - ci, nj - cj);
+      // Theta*: connect straight to our parent if it can see the successor
+      if (any_angle && (pi != ci || pj != cj) &&
+          lineOfTravel(MAP_WXGX(map_, pi), MAP_WYGY(map_, pj),
+                       MAP_WXGX(map_, ni), MAP_WYGY(map_, nj),
+                       los_occ_dist, allow_unknown)) {
+        parent_i = pi;
+        parent_j = pj;
+        true_cost = ws->costs_[MAP_INDEX(map_, pi, pj)] + hypot(ni - pi, nj - pj);
+      }
+      if (ws->stamps_[nindex] < ws->epoch_ || true_cost < ws->costs_[nindex]) {
+        ws->stamps_[nindex] = ws->epoch_;
+        ws->costs_[nindex] = true_cost;
+        ws->prev_i_[nindex] = parent_i;
+        ws->prev_j_[nindex] = parent_j;
+        ws->jump_dir_[nindex] = 3 * (dirs[k][0] + 1) + dirs[k][1] + 1;
+        float heur_cost = any_angle ? hypot(ni - ws->stopi_, nj - ws->stopj_) :
+          octileDistance(ni - ws->stopi_, nj - ws->stopj_);
+        ws->Q_->push(nindex, true_cost + heur_cost);
+      }
+    }
+  }
+  return false;
+}
+
+Path OccupancyMap::jps(double startx, double starty,
+                       double stopx, double stopy,
+                       double max_occ_dist /* = 0.0 */,
+                       bool allow_unknown /* = false */) {
+  return jps(workspace_.get(), startx, starty, stopx, stopy, max_occ_dist,
+             allow_unknown);
+}
+
+Path OccupancyMap::jps(SearchWorkspace *ws, double startx, double starty,
+                       double stopx, double stopy,
+                       double max_occ_dist /* = 0.0 */,
+                       bool allow_unknown /* = false */) const {
+  Path path;
+  if (!startPointSearch(ws, "jps", startx, starty, stopx, stopy,
+                        max_occ_dist) ||
+      !jumpPointSearch(ws, -1.0, allow_unknown)) {
+    return path;
+  }
+
+  // Fill in the cells between consecutive jump points, which are always on a
+  // straight or diagonal line, so the path looks like one from astar()
+  int i = ws->stopi_, j = ws->stopj_;
+  while (i != ws->starti_ || j != ws->startj_) {
+    int index = MAP_INDEX(map_, i, j);
+    int pi = ws->prev_i_[index], pj = ws->prev_j_[index];
+    while (i != pi || j != pj) {
+      path.push_back(Eigen::Vector2f(MAP_WXGX(map_, i), MAP_WYGY(map_, j)));
+      i -= sign(i - pi);
+      j -= sign(j - pj);
+    }
   }
+  path.push_back(Eigen::Vector2f(MAP_WXGX(map_, i), MAP_WYGY(map_, j)));
   return Path(path.rbegin(), path.rend());
 }
 
+Path OccupancyMap::thetaStar(double startx, double starty,
+                             double stopx, double stopy,
+                             double max_occ_dist /* = 0.0 */,
+                             bool allow_unknown /* = false */) {
+  return thetaStar(workspace_.get(), startx, starty, stopx, stopy,
+                   max_occ_dist, allow_unknown);
+}
+
+Path OccupancyMap::thetaStar(SearchWorkspace *ws,
+                             double startx, double starty,
+                             double stopx, double stopy,
+                             double max_occ_dist /* = 0.0 */,
+                             bool allow_unknown /* = false */) const {
+  Path path;
+  double los_occ_dist = max(max_occ_dist, lethal_occ_dist_);
+  if (!startPointSearch(ws, "thetaStar", startx, starty, stopx, stopy,
+                        max_occ_dist) ||
+      !jumpPointSearch(ws, los_occ_dist, allow_unknown)) {
+    return path;
+  }
+
+  // Parents are limited to earlier jump points, so skip any corners that the
+  // path can cut across
+  Path corners;
+  buildPath(*ws, ws->stopi_, ws->stopj_, &corners);
+  path.push_back(corners.back());
+  for (int i = corners.size() - 1; i > 0; ) {
+    int next = i - 1;
+    for (int j = 0; j < next; ++j) {
+      if (lineOfTravel(corners[i].x(), corners[i].y(),
+                       corners[j].x(), corners[j].y(),
+                       los_occ_dist, allow_unknown)) {
+        next = j;
+        break;
+      }
+    }
+    path.push_back(corners[next]);
+    i = next;
+  }
+  return path;
+}
+
 const Path&
 OccupancyMap::prepareShortestPaths(double x, double y,
                                    double min_distance, double max_distance,
                                    double max_occ_dist,
                                    bool allow_unknown) {
-  endpoints_.clear();
+  return prepareShortestPaths(workspace_.get(), x, y, min_distance,
+                              max_distance, max_occ_dist, allow_unknown);
+}
+
+const Path&
+OccupancyMap::prepareShortestPaths(SearchWorkspace *ws, double x, double y,
+                                   double min_distance, double max_distance,
+                                   double max_occ_dist,
+                                   bool allow_unknown) const {
+  ws->endpoints_.clear();
 
   if (map_ == NULL) {
     ROS_WARN("OccupancyMap::prepareShortestPaths() Map not set");
-    return endpoints_;
+    return ws->endpoints_;
   }
 
   if (map_->max_occ_dist < max_occ_dist) {
@@ -512,23 +1910,28 @@ OccupancyMap::prepareShortestPaths(double x, double y,
     ROS_BREAK();
   }
 
-  initializeSearch(x, y);
+  initializeSearch(ws, x, y);
 
   Node curr_node;
-  while (nextNode(max_occ_dist, &curr_node, allow_unknown)) {
+  while (nextNode(ws, max_occ_dist, &curr_node, allow_unknown)) {
     double node_dist = curr_node.true_cost * map_->scale;
     if (min_distance <= node_dist && node_dist < max_distance) {
       float x = MAP_WXGX(map_, curr_node.coord.first);
       float y = MAP_WYGY(map_, curr_node.coord.second);
-      endpoints_.push_back(Eigen::Vector2f(x, y));
+      ws->endpoints_.push_back(Eigen::Vector2f(x, y));
     } else if (node_dist > max_distance) {
       break;
     }
   }
-  return endpoints_;
+  return ws->endpoints_;
 }
 
 Path OccupancyMap::buildShortestPath(int ind) {
+  return buildShortestPath(*workspace_, ind);
+}
+
+Path OccupancyMap::buildShortestPath(const SearchWorkspace &ws,
+                                     int ind) const {
   Path path;
 
   if (map_ == NULL) {
@@ -537,15 +1940,23 @@ Path OccupancyMap::buildShortestPath(int ind) {
   }
 
   // Recreate path
-  const Eigen::Vector2f &stop = endpoints_.at(ind);
+  const Eigen::Vector2f &stop = ws.endpoints_.at(ind);
   int stopi = MAP_GXWX(map_, stop(0)), stopj = MAP_GYWY(map_, stop(1));
-  buildPath(stopi, stopj, &path);
+  buildPath(ws, stopi, stopj, &path);
   return Path(path.rbegin(), path.rend());
 }
 
 void OccupancyMap::prepareAllShortestPaths(double x, double y,
                                            double max_occ_dist,
                                            bool allow_unknown) {
+  prepareAllShortestPaths(workspace_.get(), x, y, max_occ_dist,
+                          allow_unknown);
+}
+
+void OccupancyMap::prepareAllShortestPaths(SearchWorkspace *ws,
+                                           double x, double y,
+                                           double max_occ_dist,
+                                           bool allow_unknown) const {
   if (map_ == NULL) {
     ROS_WARN("OccupancyMap::prepareAllShortestPaths() Map not set");
     return;
@@ -558,15 +1969,32 @@ void OccupancyMap::prepareAllShortestPaths(double x, double y,
     ROS_BREAK();
   }
 
-  initializeSearch(x, y);
+  int source = coordIndex(x, y);
+  if (source >= 0) {
+    boost::shared_ptr<const DistanceField> field =
+      findField(source, max_occ_dist, allow_unknown);
+    if (field) {
+      ws->field_ = field;
+      ws->expanded_ = 0;
+      return;
+    }
+  }
+
+  initializeSearch(ws, x, y);
 
   Node curr_node;
-  while (nextNode(max_occ_dist, &curr_node, allow_unknown)) {
+  while (nextNode(ws, max_occ_dist, &curr_node, allow_unknown)) {
     ;
   }
+  ws->field_ = storeField(*ws, max_occ_dist, allow_unknown);
 }
 
 Path OccupancyMap::shortestPath(double stopx, double stopy) {
+  return shortestPath(*workspace_, stopx, stopy);
+}
+
+Path OccupancyMap::shortestPath(const SearchWorkspace &ws,
+                                double stopx, double stopy) const {
   Path path;
 
   if (map_ == NULL) {
@@ -583,14 +2011,227 @@ Path OccupancyMap::shortestPath(double stopx, double stopy) {
               stopx, stopy);
     ROS_BREAK();
     return path; // return to prevent compiler warning
-  } else if ( prev_i_[ind] == -1 || prev_j_[ind] == -1) {
+  } else if (ws.field_) {
+    if (ws.field_->prev[ind] == DistanceField::UNREACHED) {
+      return path;
+    }
+    fieldPath(*ws.field_, i, j, &path);
+    return Path(path.rbegin(), path.rend());
+  } else if (ws.stamps_[ind] < ws.epoch_) {
     return path;
   } else {
-    buildPath(i, j, &path);
+    buildPath(ws, i, j, &path);
     return Path(path.rbegin(), path.rend());
   }
 }
 
+Path OccupancyMap::cachedPath(double startx, double starty,
+                              double stopx, double stopy,
+                              double max_occ_dist, bool allow_unknown) {
+  return cachedPath(workspace_.get(), startx, starty, stopx, stopy,
+                    max_occ_dist, allow_unknown);
+}
+
+Path OccupancyMap::cachedPath(SearchWorkspace *ws,
+                              double startx, double starty,
+                              double stopx, double stopy,
+                              double max_occ_dist, bool allow_unknown) const {
+  Path path;
+
+  if (map_ == NULL) {
+    ROS_WARN("OccupancyMap::cachedPath() Map not set");
+    return path;
+  }
+  int start = coordIndex(startx, starty);
+  int stop = coordIndex(stopx, stopy);
+  if (start < 0 || stop < 0) {
+    ROS_ERROR("OccupancyMap::cachedPath() Invalid starting or stopping position");
+    return path;
+  }
+  // The search from the goal would still grow out of a goal that cannot be
+  // entered, e.g. a lethal or unknown one, where astar() never reaches it
+  if (!traversable(stop % map_->size_x, stop / map_->size_x, allow_unknown)) {
+    return astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                 allow_unknown);
+  }
+
+  boost::shared_ptr<const DistanceField> field =
+    findField(stop, max_occ_dist, allow_unknown);
+  if (!field) {
+    prepareAllShortestPaths(ws, stopx, stopy, max_occ_dist, allow_unknown);
+    field = ws->field_;
+  }
+
+  // Moves are charged the cost of the cell entered, so walking the paths
+  // from the goal backwards costs the same for every path up to the costs of
+  // the two endpoints, and the shortest one is the same.  The exception is a
+  // start that cannot be entered, which the goal's search never reaches.
+  if (field->prev[start] == DistanceField::UNREACHED) {
+    if (traversable(start % map_->size_x, start / map_->size_x,
+                    allow_unknown)) {
+      return path;
+    }
+    return astar(ws, startx, starty, stopx, stopy, max_occ_dist,
+                 allow_unknown);
+  }
+  fieldPath(*field, start % map_->size_x, start / map_->size_x, &path);
+  return path;
+}
+
+void OccupancyMap::setFieldCacheSize(size_t bytes) {
+  boost::mutex::scoped_lock lock(fields_mutex_);
+  field_cache_size_ = bytes;
+}
+
+boost::shared_ptr<const DistanceField> OccupancyMap::findField(
+    int source, double max_occ_dist, bool allow_unknown) const {
+  boost::mutex::scoped_lock lock(fields_mutex_);
+  typedef list<boost::shared_ptr<const DistanceField> >::iterator Iterator;
+  for (Iterator it = fields_.begin(); it != fields_.end(); ++it) {
+    const DistanceField &field = **it;
+    if (field.source == source && field.max_occ_dist == max_occ_dist &&
+        field.allow_unknown == allow_unknown && field.version == version_) {
+      fields_.splice(fields_.begin(), fields_, it);
+      return fields_.front();
+    }
+  }
+  return boost::shared_ptr<const DistanceField>();
+}
+
+boost::shared_ptr<const DistanceField> OccupancyMap::storeField(
+    const SearchWorkspace &ws, double max_occ_dist, bool allow_unknown) const {
+  int ncells = map_->size_x * map_->size_y;
+  boost::shared_ptr<DistanceField> field(new DistanceField());
+  field->source = MAP_INDEX(map_, ws.starti_, ws.startj_);
+  field->max_occ_dist = max_occ_dist;
+  field->allow_unknown = allow_unknown;
+  field->version = version_;
+  field->costs.assign(ncells, numeric_limits<float>::infinity());
+  field->prev.assign(ncells, DistanceField::UNREACHED);
+  for (int index = 0; index < ncells; ++index) {
+    if (ws.stamps_[index] >= ws.epoch_) {
+      int i = index % map_->size_x, j = index / map_->size_x;
+      field->costs[index] = ws.costs_[index];
+      field->prev[index] =
+        3 * (ws.prev_i_[index] - i + 1) + ws.prev_j_[index] - j + 1;
+    }
+  }
+
+  // Drop the least recently used fields, but always keep the new one.
+  // Workspaces still holding a dropped field keep it alive.
+  boost::mutex::scoped_lock lock(fields_mutex_);
+  fields_.push_front(field);
+  size_t field_size = ncells * (sizeof(float) + sizeof(uint8_t));
+  while (fields_.size() > 1 && fields_.size() * field_size > field_cache_size_) {
+    fields_.pop_back();
+  }
+  return field;
+}
+
+void OccupancyMap::fieldPath(const DistanceField &field, int i, int j,
+                             Path *path) const {
+  int index = MAP_INDEX(map_, i, j);
+  path->push_back(Eigen::Vector2f(MAP_WXGX(map_, i), MAP_WYGY(map_, j)));
+  while (index != field.source) {
+    int dir = field.prev[index];
+    i += dir / 3 - 1;
+    j += dir % 3 - 1;
+    index = MAP_INDEX(map_, i, j);
+    path->push_back(Eigen::Vector2f(MAP_WXGX(map_, i), MAP_WYGY(map_, j)));
+  }
+}
+
+void OccupancyMap::costMatrix(const Path &sources, const Path &targets,
+                              double max_occ_dist, bool allow_unknown,
+                              int nthreads, vector<float> *costs,
+                              vector<Path> *paths) const {
+  costs->assign(sources.size() * targets.size(),
+                numeric_limits<float>::infinity());
+  if (paths != NULL) {
+    paths->assign(sources.size() * targets.size(), Path());
+  }
+
+  if (map_ == NULL) {
+    ROS_WARN("OccupancyMap::costMatrix() Map not set");
+    return;
+  }
+  if (map_->max_occ_dist < max_occ_dist) {
+    ROS_ERROR("OccupancyMap::costMatrix() CSpace has been calculated "
+              "up to %f, but max_occ_dist=%.2f",
+              map_->max_occ_dist, max_occ_dist);
+    ROS_BREAK();
+  }
+
+  // Points off the map are left unreachable
+  vector<int> target_cells(targets.size());
+  vector<uint8_t> is_target(map_->size_x * map_->size_y, 0);
+  for (size_t t = 0; t < targets.size(); ++t) {
+    target_cells[t] = coordIndex(targets[t].x(), targets[t].y());
+    if (target_cells[t] >= 0) {
+      is_target[target_cells[t]] = 1;
+    }
+  }
+
+  if (nthreads <= 0) {
+    nthreads = max(1u, boost::thread::hardware_concurrency());
+  }
+  nthreads = min<int>(nthreads, sources.size());
+  if (nthreads <= 1) {
+    costMatrixWorker(0, 1, sources, target_cells, is_target, allow_unknown,
+                     costs, paths);
+    return;
+  }
+  // Each thread writes its own rows of costs and paths
+  boost::thread_group threads;
+  for (int t = 0; t < nthreads; ++t) {
+    threads.create_thread(
+      boost::bind(&OccupancyMap::costMatrixWorker, this, t, nthreads,
+                  boost::cref(sources), boost::cref(target_cells),
+                  boost::cref(is_target), allow_unknown, costs, paths));
+  }
+  threads.join_all();
+}
+
+void OccupancyMap::costMatrixWorker(size_t first, size_t step,
+                                    const Path &sources,
+                                    const vector<int> &targets,
+                                    const vector<uint8_t> &is_target,
+                                    bool allow_unknown, vector<float> *costs,
+                                    vector<Path> *paths) const {
+  int ntargets = 0;
+  for (size_t i = 0; i < is_target.size(); ++i) {
+    ntargets += is_target[i];
+  }
+
+  SearchWorkspace ws(workspace_->queueType());
+  for (size_t s = first; s < sources.size(); s += step) {
+    if (coordIndex(sources[s].x(), sources[s].y()) < 0) {
+      continue;
+    }
+    // Dijkstra until every target is closed
+    initializeSearch(&ws, sources[s].x(), sources[s].y());
+    int remaining = ntargets;
+    Node curr_node;
+    while (remaining > 0 && nextNode(&ws, 0.0, &curr_node, allow_unknown)) {
+      remaining -= is_target[MAP_INDEX(map_, curr_node.coord.first,
+                                       curr_node.coord.second)];
+    }
+
+    for (size_t t = 0; t < targets.size(); ++t) {
+      int index = targets[t];
+      if (index < 0 || !ws.closed(index)) {
+        continue;
+      }
+      (*costs)[s * targets.size() + t] = ws.costs_[index];
+      if (paths != NULL) {
+        Path &path = (*paths)[s * targets.size() + t];
+        buildPath(ws, index % map_->size_x, index / map_->size_x, &path);
+        reverse(path.begin(), path.end());
+      }
+    }
+  }
+}
+
 void OccupancyMap::setThresholds(int free, int occ) {
   if (free < 0 || free >= 100) {
     ROS_ERROR("Unoccupied space threshold must be in the range [0,100)");
@@ -608,4 +2249,68 @@ void OccupancyMap::setThresholds(int free, int occ) {
   min_occupied_threshold_ = occ;
 }
 
+void OccupancyMap::setQueueType(QueueType type) {
+  workspace_->setQueueType(type);
+}
+
+OccupancyMap::QueueType OccupancyMap::queueType() const {
+  return workspace_->queueType();
+}
+
+int OccupancyMap::numExpanded() const {
+  return workspace_->numExpanded();
+}
+
+SearchWorkspace::SearchWorkspace(
+    OccupancyMap::QueueType type /* = OccupancyMap::HEAP_QUEUE */)
+  : ncells_(0), starti_(-1), startj_(-1), stopi_(-1), stopj_(-1), epoch_(0),
+    Q_(new HeapOpenList()), queue_type_(OccupancyMap::HEAP_QUEUE),
+    expanded_(0) {
+  setQueueType(type);
+}
+
+OpenList* SearchWorkspace::createOpenList(OccupancyMap::QueueType type) {
+  switch (type) {
+    case OccupancyMap::SET_QUEUE:
+      return new SetOpenList();
+    case OccupancyMap::HEAP_QUEUE:
+      return new HeapOpenList();
+    case OccupancyMap::BUCKET_QUEUE:
+      return new BucketOpenList();
+    default:
+      return NULL;
+  }
+}
+
+void SearchWorkspace::setQueueType(OccupancyMap::QueueType type) {
+  OpenList *Q = createOpenList(type);
+  if (Q == NULL) {
+    ROS_ERROR("SearchWorkspace::setQueueType() Unknown queue type %d", type);
+    return;
+  }
+  Q_.reset(Q);
+  queue_type_ = type;
+}
+
+void SearchWorkspace::begin(int ncells) {
+  if (ncells_ != ncells) {
+    ncells_ = ncells;
+    costs_.reset(new float[ncells]);
+    prev_i_.reset(new int[ncells]);
+    prev_j_.reset(new int[ncells]);
+    jump_dir_.reset(new uint8_t[ncells]);
+    stamps_.reset(new uint32_t[ncells]);
+    std::fill(stamps_.get(), stamps_.get() + ncells, 0);
+    epoch_ = 0;
+  }
+
+  // Rather than resetting every cell, start a new epoch.  Cells stamped
+  // before it are treated as unvisited and initialized when first reached.
+  epoch_ += 2;
+  if (epoch_ < 2) {
+    std::fill(stamps_.get(), stamps_.get() + ncells_, 0);
+    epoch_ = 2;
+  }
+}
+
 } // end namespace scarab
@@ -0,0 +1,508 @@
+// Benchmarks for the per-scan routines of HumanFriendlyNav, run against scans
+// ray cast from random poses in PGM images such as the ones shipped in
+// scarab/maps.
+//
+// Usage: scan_benchmark [-r resolution] [-o obstacle_radius] [-n scans]
+//                       map.pgm [map.pgm ...]
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <limits>
+#include <new>
+#include <vector>
+
+#include <sensor_msgs/LaserScan.h>
+
+#include "player_map/map.h"
+#include "dynamic_window.hpp"
+#include "free_space.hpp"
+#include "scan_inflation.hpp"
+#include "scan_kernels.hpp"
+
+using namespace std;
+
+struct BenchmarkParams {
+  double resolution;
+  double obstacle_radius;
+  int scans;
+};
+
+struct Sensor {
+  const char *name;
+  double angle_min, angle_increment;
+  int size;
+  double range_min, range_max;
+};
+
+// Hokuyo UTM-30LX and URG-04LX
+static const Sensor SENSORS[] = {
+  {"UTM-30LX", -2.35619449, 0.00436332313, 1081, 0.1, 30.0},
+  {"URG-04LX", -2.08621382, 0.00613592315, 682, 0.02, 5.6}
+};
+
+// Timed runs over each set of scans
+static const int RUNS = 5;
+// Budget for the per-scan work of the controller
+static const double CONTROL_BUDGET = 100e-6;
+
+// Heap allocations so far, counted by replacing the global new and delete
+static long allocations = 0;
+
+#if __cplusplus >= 201103L
+void* operator new(size_t size) {
+#else
+void* operator new(size_t size) throw(std::bad_alloc) {
+#endif
+  ++allocations;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) throw() {
+  free(p);
+}
+
+double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+// Scans from random free poses, half of them within a meter of a wall
+void makeScans(map_t *map, const Sensor &sensor, int count,
+               vector<sensor_msgs::LaserScan> *scans) {
+  srand(17);
+  scans->resize(count);
+  for (int s = 0; s < count; ++s) {
+    int index;
+    do {
+      index = rand() % (map->size_x * map->size_y);
+    } while (map->occ_state[index] != map_cell_t::FREE ||
+             map_occ_dist(map, index) < 0.2 ||
+             (s % 2 == 0 && map_occ_dist(map, index) > 1.0));
+    double x = MAP_WXGX(map, index % map->size_x);
+    double y = MAP_WYGY(map, index / map->size_x);
+    double a = 2.0 * M_PI * rand() / RAND_MAX;
+
+    sensor_msgs::LaserScan &scan = (*scans)[s];
+    scan.header.frame_id = "laser";
+    scan.angle_min = sensor.angle_min;
+    scan.angle_increment = sensor.angle_increment;
+    scan.angle_max = sensor.angle_min + (sensor.size - 1) * sensor.angle_increment;
+    scan.range_min = sensor.range_min;
+    scan.range_max = sensor.range_max;
+    scan.ranges.resize(sensor.size);
+    for (int i = 0; i < sensor.size; ++i) {
+      // Beams that hit nothing read past range_max, as out of range returns
+      scan.ranges[i] = map_calc_range(
+        map, x, y, a + scan.angle_min + i * scan.angle_increment,
+        sensor.range_max + 1.0);
+    }
+  }
+}
+
+// Compare the inflation against the original per-obstacle walk
+void benchInflation(map_t *map, const Sensor &sensor,
+                    const BenchmarkParams &params) {
+  vector<sensor_msgs::LaserScan> scans;
+  makeScans(map, sensor, params.scans, &scans);
+
+  // Best of several runs over all the scans
+  vector<vector<float> > brute(scans.size()), fast(scans.size());
+  scarab::ScanInflation inflation;
+  double brute_time = numeric_limits<double>::infinity();
+  double fast_time = numeric_limits<double>::infinity();
+  for (int run = 0; run < RUNS; ++run) {
+    double start = wallTime();
+    for (size_t s = 0; s < scans.size(); ++s) {
+      scarab::ScanInflation::inflateBrute(scans[s], params.obstacle_radius,
+                                          &brute[s]);
+    }
+    brute_time = min(brute_time, wallTime() - start);
+    start = wallTime();
+    for (size_t s = 0; s < scans.size(); ++s) {
+      inflation.inflate(scans[s], params.obstacle_radius, &fast[s]);
+    }
+    fast_time = min(fast_time, wallTime() - start);
+  }
+
+  // The original loses precision for distant obstacles, and where that turns
+  // a discriminant negative it cuts the beam to 0
+  int mismatches = 0, zeroed = 0;
+  for (size_t s = 0; s < scans.size(); ++s) {
+    for (size_t i = 0; i < brute[s].size(); ++i) {
+      if (fabs(brute[s][i] - fast[s][i]) > 1e-3) {
+        ++mismatches;
+        zeroed += brute[s][i] == 0.0f;
+      }
+    }
+  }
+  printf("  %-9s inflation: %.1f us brute, %.1f us per scan, %d beams "
+         "differ by over 1 mm (%d zeroed by brute)\n", sensor.name,
+         1e6 * brute_time / scans.size(), 1e6 * fast_time / scans.size(),
+         mismatches, zeroed);
+}
+
+// Time the per-scan control path, inflating a scan, building its free space
+// and finding the free point nearest a goal, count the heap allocations of
+// those steps after the first scan, and compare the kernels against their
+// scalar versions.  The waypoint update and publishing in the ROS callback
+// around them are not counted.
+void benchControl(map_t *map, const Sensor &sensor,
+                  const BenchmarkParams &params) {
+  vector<sensor_msgs::LaserScan> scans;
+  makeScans(map, sensor, params.scans, &scans);
+  vector<float> goal_x(scans.size()), goal_y(scans.size());
+  for (size_t s = 0; s < scans.size(); ++s) {
+    double a = 2.0 * M_PI * rand() / RAND_MAX;
+    goal_x[s] = 5.0 * cos(a);
+    goal_y[s] = 5.0 * sin(a);
+  }
+
+  scarab::ScanInflation inflation;
+  scarab::FreeSpace free_space;
+  sensor_msgs::LaserScan free;
+  vector<float> x(sensor.size), y(sensor.size);
+  vector<float> scalar_x(sensor.size), scalar_y(sensor.size);
+  double control_time = numeric_limits<double>::infinity();
+  double worst_time = 0.0;
+  double scalar_time = numeric_limits<double>::infinity();
+  double kernel_time = numeric_limits<double>::infinity();
+  long steady_allocations = 0;
+  int mismatches = 0;
+  for (int run = 0; run < RUNS; ++run) {
+    double run_time = 0.0, run_worst = 0.0;
+    double run_scalar = 0.0, run_kernel = 0.0;
+    for (size_t s = 0; s < scans.size(); ++s) {
+      const sensor_msgs::LaserScan &scan = scans[s];
+      long start_allocations = allocations;
+      double start = wallTime();
+      inflation.inflate(scan, params.obstacle_radius, &free);
+      free_space.update(scan, free.ranges);
+      int nearest = scarab::nearestPoint(free_space.x(), free_space.y(),
+                                         sensor.size, goal_x[s], goal_y[s]);
+      double end = wallTime();
+      if (run > 0 || s > 0) {
+        steady_allocations += allocations - start_allocations;
+      }
+      run_time += end - start;
+      run_worst = max(run_worst, end - start);
+
+      const scarab::BeamAngles &angles = free_space.angles();
+      start = wallTime();
+      scarab::projectRanges(&free.ranges[0], angles.cos(), angles.sin(),
+                            sensor.size, &x[0], &y[0]);
+      int kernel_nearest = scarab::nearestPoint(&x[0], &y[0], sensor.size,
+                                                goal_x[s], goal_y[s]);
+      run_kernel += wallTime() - start;
+      start = wallTime();
+      scarab::projectRangesScalar(&free.ranges[0], angles.cos(), angles.sin(),
+                                  sensor.size, &scalar_x[0], &scalar_y[0]);
+      int scalar_nearest = scarab::nearestPointScalar(
+        &scalar_x[0], &scalar_y[0], sensor.size, goal_x[s], goal_y[s]);
+      run_scalar += wallTime() - start;
+      if (run == 0 && (x != scalar_x || y != scalar_y ||
+                       kernel_nearest != scalar_nearest ||
+                       nearest != scalar_nearest)) {
+        ++mismatches;
+      }
+    }
+    control_time = min(control_time, run_time);
+    worst_time = run == 0 ? run_worst : min(worst_time, run_worst);
+    scalar_time = min(scalar_time, run_scalar);
+    kernel_time = min(kernel_time, run_kernel);
+  }
+
+  // The inflation kernel against its scalar version, for the obstacle at
+  // the middle beam of each scan
+  vector<float> cos_offset(sensor.size), sin2_offset(sensor.size);
+  for (int i = 0; i < sensor.size; ++i) {
+    float theta = (i - sensor.size / 2) * float(sensor.angle_increment);
+    cos_offset[i] = cos(theta);
+    sin2_offset[i] = sin(theta) * sin(theta);
+  }
+  for (size_t s = 0; s < scans.size(); ++s) {
+    vector<float> reduced(scans[s].ranges), scalar_reduced(scans[s].ranges);
+    float d = scans[s].ranges[sensor.size / 2];
+    float r = min(float(params.obstacle_radius), d - 0.001f);
+    scarab::reduceRanges(d, r, &cos_offset[0], &sin2_offset[0], sensor.size,
+                         &reduced[0]);
+    scarab::reduceRangesScalar(d, r, &cos_offset[0], &sin2_offset[0],
+                               sensor.size, &scalar_reduced[0]);
+    mismatches += reduced != scalar_reduced;
+  }
+
+  printf("  %-9s control: %.1f us per scan, %.1f us worst (budget %.0f us), "
+         "%ld allocations after the first scan; projection and nearest "
+         "point %.2f us %s, %.2f us scalar; %d scans differ\n", sensor.name,
+         1e6 * control_time / scans.size(), 1e6 * worst_time,
+         1e6 * CONTROL_BUDGET, steady_allocations,
+         1e6 * kernel_time / scans.size(),
+         scarab::haveAvxScanKernels() ? "AVX" : "scalar",
+         1e6 * scalar_time / scans.size(), mismatches);
+}
+
+// Crossing number test of (x, y) against the polygon of free_space
+bool containsBrute(const scarab::FreeSpace &free_space, double x, double y) {
+  bool inside = false;
+  int n = free_space.size();
+  for (int v = 0, u = n - 1; v < n; u = v++) {
+    double xv = free_space.vertexX(v), yv = free_space.vertexY(v);
+    double xu = free_space.vertexX(u), yu = free_space.vertexY(u);
+    if ((yv > y) != (yu > y) &&
+        x < (xu - xv) * (y - yv) / (yu - yv) + xv) {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+// Squared distance from (x, y) to the closest point on every edge of the
+// polygon of free_space
+double boundaryDistanceBrute(const scarab::FreeSpace &free_space, double x,
+                             double y) {
+  double dist2 = numeric_limits<double>::infinity();
+  int n = free_space.size();
+  for (int v = 0, u = n - 1; v < n; u = v++) {
+    double x1 = free_space.vertexX(u), y1 = free_space.vertexY(u);
+    double sx = free_space.vertexX(v) - x1, sy = free_space.vertexY(v) - y1;
+    double length2 = sx * sx + sy * sy;
+    double t = length2 > 0.0 ?
+      min(max(((x - x1) * sx + (y - y1) * sy) / length2, 0.0), 1.0) : 0.0;
+    double dx = x - x1 - t * sx, dy = y - y1 - t * sy;
+    dist2 = min(dist2, dx * dx + dy * dy);
+  }
+  return dist2;
+}
+
+// Time goal projection onto the free space of each scan, and compare it
+// against walking every edge of the polygon
+void benchFreeSpace(map_t *map, const Sensor &sensor,
+                    const BenchmarkParams &params) {
+  vector<sensor_msgs::LaserScan> scans;
+  makeScans(map, sensor, params.scans, &scans);
+  const int GOALS = 20;
+  vector<double> goal_x(GOALS), goal_y(GOALS);
+  for (int g = 0; g < GOALS; ++g) {
+    goal_x[g] = 20.0 * rand() / RAND_MAX - 10.0;
+    goal_y[g] = 20.0 * rand() / RAND_MAX - 10.0;
+  }
+
+  scarab::ScanInflation inflation;
+  scarab::FreeSpace free_space;
+  vector<float> free;
+  double update_time = 0.0, fast_time = 0.0, brute_time = 0.0;
+  int outside = 0, contains_mismatches = 0, closest_mismatches = 0;
+  for (size_t s = 0; s < scans.size(); ++s) {
+    inflation.inflate(scans[s], params.obstacle_radius, &free);
+    double start = wallTime();
+    free_space.update(scans[s], free);
+    update_time += wallTime() - start;
+
+    for (int g = 0; g < GOALS; ++g) {
+      double x = goal_x[g], y = goal_y[g], bx, by;
+      start = wallTime();
+      bool inside = free_space.contains(x, y);
+      if (!inside) {
+        free_space.closestBoundaryPoint(x, y, &bx, &by);
+      }
+      fast_time += wallTime() - start;
+
+      start = wallTime();
+      bool brute_inside = containsBrute(free_space, x, y);
+      double brute_dist2 = boundaryDistanceBrute(free_space, x, y);
+      brute_time += wallTime() - start;
+      contains_mismatches += inside != brute_inside;
+      if (!inside) {
+        ++outside;
+        double dist = hypot(x - bx, y - by);
+        closest_mismatches += fabs(dist - sqrt(brute_dist2)) > 1e-6;
+      }
+    }
+  }
+
+  int lookups = scans.size() * GOALS;
+  printf("  %-9s free space: %.1f us per update, %.2f us per goal vs %.2f "
+         "us walking the polygon; %d of %d containment tests and %d of %d "
+         "closest points differ\n", sensor.name,
+         1e6 * update_time / scans.size(), 1e6 * fast_time / lookups,
+         1e6 * brute_time / lookups, contains_mismatches, lookups,
+         closest_mismatches, outside);
+}
+
+// First step of the arc at v and w from the sensor, in steps of dt, at which
+// the pose falls outside the beams or past the clearance of the nearest one,
+// or steps + 1 if none, found from the pose itself
+int rolloutBrute(const sensor_msgs::LaserScan &scan,
+                 const vector<float> &clearance, double v, double w,
+                 double dt, int steps) {
+  for (int k = 1; k <= steps; ++k) {
+    double t = k * dt, x, y;
+    if (fabs(w * t) < 1e-6) {
+      x = v * t;
+      y = 0.0;
+    } else {
+      x = v / w * sin(w * t);
+      y = v / w * (1.0 - cos(w * t));
+    }
+    int i = floor((atan2(y, x) - scan.angle_min) / scan.angle_increment + 0.5);
+    if (i < 0 || i >= int(clearance.size()) || hypot(x, y) > clearance[i]) {
+      return k;
+    }
+  }
+  return steps + 1;
+}
+
+// Time the dynamic window controller on each scan, compare the rollout
+// kernel against its scalar version, and both against rolling out the poses
+// of each arc directly
+void benchRollouts(map_t *map, const Sensor &sensor,
+                   const BenchmarkParams &params) {
+  vector<sensor_msgs::LaserScan> scans;
+  makeScans(map, sensor, params.scans, &scans);
+
+  scarab::DynamicWindow::Params p;
+  p.v_max = 0.5;
+  p.w_max = 0.7;
+  p.acc_v = 0.5;
+  p.acc_w = 1.5;
+  p.period = 0.2;
+  p.sim_time = 2.0;
+  p.sim_step = 0.1;
+  p.v_samples = 10;
+  p.w_samples = 21;
+  p.heading_weight = 1.0;
+  p.clearance_weight = 0.1;
+  p.velocity_weight = 0.1;
+  scarab::DynamicWindow dwa(p);
+  int steps = int(p.sim_time / p.sim_step + 0.5);
+
+  // A wider grid than the window, reaching past the beams on either side
+  const int V_SAMPLES = 20, W_SAMPLES = 20;
+  int n = V_SAMPLES * W_SAMPLES;
+  vector<float> v(n), w(n), chord(n), half_angle(n), cos_half(n);
+  for (int i = 0; i < V_SAMPLES; ++i) {
+    for (int j = 0; j < W_SAMPLES; ++j) {
+      int c = i * W_SAMPLES + j;
+      v[c] = 0.05 + 0.05 * i;
+      w[c] = -1.5 + 3.0 * j / (W_SAMPLES - 1);
+      half_angle[c] = 0.5 * w[c] * p.sim_step;
+      cos_half[c] = cos(half_angle[c]);
+      chord[c] = fabs(half_angle[c]) < 1e-6 ? v[c] * p.sim_step :
+        2.0 * v[c] / w[c] * sin(half_angle[c]);
+    }
+  }
+
+  scarab::ScanInflation inflation;
+  vector<float> free, clearance;
+  vector<int> hit(n), scalar_hit(n), brute_hit(n);
+  double dwa_time = 0.0, kernel_time = 0.0, scalar_time = 0.0;
+  double brute_time = 0.0;
+  int stopped = 0, mismatches = 0, brute_mismatches = 0;
+  for (size_t s = 0; s < scans.size(); ++s) {
+    const sensor_msgs::LaserScan &scan = scans[s];
+    inflation.inflate(scan, params.obstacle_radius, &free);
+    double a = 2.0 * M_PI * rand() / RAND_MAX;
+    double vel, rot;
+    double start = wallTime();
+    dwa.update(scan, free);
+    stopped += !dwa.bestVelocity(0.3, 0.0, 5.0 * cos(a), 5.0 * sin(a), &vel,
+                                 &rot);
+    dwa_time += wallTime() - start;
+
+    clearance.resize(free.size());
+    for (size_t i = 0; i < free.size(); ++i) {
+      bool valid = scan.range_min <= scan.ranges[i] &&
+        scan.ranges[i] <= scan.range_max;
+      clearance[i] = valid ? free[i] : scan.range_max;
+    }
+    start = wallTime();
+    scarab::rolloutArcs(&chord[0], &half_angle[0], &cos_half[0], n,
+                        &clearance[0], sensor.size, scan.angle_min,
+                        scan.angle_increment, steps, &hit[0]);
+    kernel_time += wallTime() - start;
+    start = wallTime();
+    scarab::rolloutArcsScalar(&chord[0], &half_angle[0], &cos_half[0], n,
+                              &clearance[0], sensor.size, scan.angle_min,
+                              scan.angle_increment, steps, &scalar_hit[0]);
+    scalar_time += wallTime() - start;
+    start = wallTime();
+    for (int c = 0; c < n; ++c) {
+      brute_hit[c] = rolloutBrute(scan, clearance, v[c], w[c], p.sim_step,
+                                  steps);
+    }
+    brute_time += wallTime() - start;
+    for (int c = 0; c < n; ++c) {
+      mismatches += hit[c] != scalar_hit[c];
+      brute_mismatches += hit[c] != brute_hit[c];
+    }
+  }
+
+  int rollouts = scans.size() * n;
+  printf("  %-9s rollouts: %.1f us per scan for %d arcs of %d steps (%d "
+         "scans braking); %.1f us per %d arcs %s, %.1f us scalar, %.1f us "
+         "from poses; %d of %d arcs differ from scalar, %d from poses\n",
+         sensor.name, 1e6 * dwa_time / scans.size(),
+         p.v_samples * p.w_samples, steps, stopped,
+         1e6 * kernel_time / scans.size(), n,
+         scarab::haveAvx2RolloutKernel() ? "AVX2" : "scalar",
+         1e6 * scalar_time / scans.size(), 1e6 * brute_time / scans.size(),
+         mismatches, rollouts, brute_mismatches);
+}
+
+int main(int argc, char **argv) {
+  BenchmarkParams params;
+  params.resolution = 0.05;
+  params.obstacle_radius = 0.33;
+  params.scans = 200;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "r:o:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        params.resolution = atof(optarg);
+        break;
+      case 'o':
+        params.obstacle_radius = atof(optarg);
+        break;
+      case 'n':
+        params.scans = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-r resolution] [-o obstacle_radius] "
+                "[-n scans] map.pgm [map.pgm ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-r resolution] [-o obstacle_radius] "
+            "[-n scans] map.pgm [map.pgm ...]\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = optind; i < argc; ++i) {
+    map_t *map = map_alloc();
+    if (map_load_occ(map, argv[i], params.resolution, 0) != 0) {
+      fprintf(stderr, "Failed to load %s\n", argv[i]);
+      return 1;
+    }
+    map_update_cspace(map, 1.0);
+    printf("%s\n", argv[i]);
+    for (size_t s = 0; s < sizeof(SENSORS) / sizeof(SENSORS[0]); ++s) {
+      benchInflation(map, SENSORS[s], params);
+      benchControl(map, SENSORS[s], params);
+      benchFreeSpace(map, SENSORS[s], params);
+      benchRollouts(map, SENSORS[s], params);
+    }
+    map_free(map);
+  }
+  return 0;
+}
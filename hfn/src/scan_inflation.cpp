@@ -0,0 +1,228 @@
+#include "scan_inflation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "scan_kernels.hpp"
+
+using namespace std;
+namespace scarab {
+
+ScanInflation::ScanInflation() : angle_increment_(0.0f) {
+
+}
+
+void ScanInflation::updateTables(float angle_increment, size_t size) {
+  if (angle_increment == angle_increment_ && sin_.size() == size + 1) {
+    return;
+  }
+  angle_increment_ = angle_increment;
+  sin_.resize(size + 1);
+  cos_.resize(2 * size + 1);
+  sin2_.resize(2 * size + 1);
+  for (size_t t = 0; t <= size; ++t) {
+    float theta = t * angle_increment;
+    float s = sin(theta);
+    // Past a right angle no obstacle's window reaches, as r < d
+    sin_[t] = theta < M_PI / 2 ? s : 2.0f;
+    cos_[size + t] = cos_[size - t] = cos(theta);
+    sin2_[size + t] = sin2_[size - t] = s * s;
+  }
+  first_.resize(size + 1);
+  for (size_t q = 0, t = 0; q <= size; ++q) {
+    while (t <= size && sin_[t] < float(q) / size) {
+      ++t;
+    }
+    first_[q] = t;
+  }
+  block_max_.resize((size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+float ScanInflation::largest(const float *free, int begin, int end,
+                             float largest) {
+  for (int i = begin; i < end; ++i) {
+    if (free[i] > largest) {
+      largest = free[i];
+    }
+  }
+  return largest;
+}
+
+void ScanInflation::inflate(const sensor_msgs::LaserScan &scan, float radius,
+                            vector<float> *free) {
+  const vector<float> &ranges = scan.ranges;
+  int size = ranges.size();
+  free->assign(ranges.begin(), ranges.end());
+  if (size == 0 || scan.angle_increment <= 0.0f) {
+    return;
+  }
+  updateTables(scan.angle_increment, size);
+  float *f = &(*free)[0];
+
+  // Order the obstacles nearest first by bucketing the distance to their
+  // nearest points; the order within a bucket doesn't matter
+  near_.resize(size);
+  float max_near = 0.0f;
+  int nobstacles = 0;
+  for (int k = 0; k < size; ++k) {
+    float d = ranges[k];
+    if (scan.range_min <= d && d <= scan.range_max) {
+      near_[k] = d - min(radius, d - 0.001f);
+      max_near = max(max_near, near_[k]);
+      ++nobstacles;
+    } else {
+      near_[k] = -1.0f;
+    }
+  }
+  float bucket_scale = (size - 1) / max(max_near, 1e-3f);
+  bucket_start_.assign(size + 1, 0);
+  for (int k = 0; k < size; ++k) {
+    if (near_[k] >= 0.0f) {
+      ++bucket_start_[int(near_[k] * bucket_scale) + 1];
+    }
+  }
+  for (int b = 0; b < size; ++b) {
+    bucket_start_[b + 1] += bucket_start_[b];
+  }
+  order_.resize(size);
+  for (int k = 0; k < size; ++k) {
+    if (near_[k] >= 0.0f) {
+      order_[bucket_start_[int(near_[k] * bucket_scale)]++] = k;
+    }
+  }
+
+  int nblocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  for (int b = 0; b < nblocks; ++b) {
+    block_max_[b] = largest(f, b * BLOCK_SIZE,
+                            min(size, (b + 1) * BLOCK_SIZE),
+                            -numeric_limits<float>::infinity());
+  }
+  covered_.assign(size + 1, 0);
+
+  for (int o = 0; o < nobstacles; ++o) {
+    int k = order_[o];
+    float d = ranges[k];
+    float r = min(radius, d - 0.001f);
+    float sin_phi = r / d;
+    // Beams k - before to k + after, with the bounds of the original walk:
+    // offsets before k while their angle is below phi = asin(r / d), after k
+    // while the angle of the next one is at most phi
+    int before = min<int>(first_[int(sin_phi * size)], size);
+    while (before > 0 && sin_[before] >= sin_phi) {
+      --before;
+    }
+    while (before < size && sin_[before + 1] < sin_phi) {
+      ++before;
+    }
+    int after = before - 1;
+    if (before < size && sin_[before + 1] == sin_phi) {
+      ++after;
+    }
+    int begin = max(0, k - before), end = min(size - 1, k + after);
+    if (begin > end) {
+      continue;
+    }
+    ++covered_[begin];
+    --covered_[end + 1];
+
+    // No beam gets nearer the obstacle than near_[k], and the distance to it
+    // grows with the offset from k, so a block of beams can't be shortened
+    // if its largest free distance isn't larger than either
+    const float *cos_k = &cos_[size - k], *sin2_k = &sin2_[size - k];
+    float r2 = r * r, d2 = d * d, near = near_[k];
+    for (int b = begin / BLOCK_SIZE; b <= end / BLOCK_SIZE; ++b) {
+      if (block_max_[b] <= near) {
+        continue;
+      }
+      int lo = max(begin, b * BLOCK_SIZE);
+      int hi = min(end, (b + 1) * BLOCK_SIZE - 1);
+      int i = lo > k ? lo : (hi < k ? hi : k);
+      if (d * cos_k[i] - sqrt(max(r2 - d2 * sin2_k[i], 0.0f)) >=
+          block_max_[b]) {
+        continue;
+      }
+      float block_max =
+        reduceRanges(d, r, cos_k + lo, sin2_k + lo, hi - lo + 1, f + lo);
+      block_max = largest(f, b * BLOCK_SIZE, lo, block_max);
+      block_max_[b] = largest(f, hi + 1, min(size, (b + 1) * BLOCK_SIZE),
+                              block_max);
+    }
+  }
+
+  // As in the original walk, beams in the window of an obstacle are at
+  // least 0
+  int windows = 0;
+  for (int i = 0; i < size; ++i) {
+    windows += covered_[i];
+    if (windows > 0 && f[i] < 0.0f) {
+      f[i] = 0.0f;
+    }
+  }
+}
+
+void ScanInflation::inflate(const sensor_msgs::LaserScan &scan, float radius,
+                            sensor_msgs::LaserScan *free) {
+  free->header = scan.header;
+  free->angle_min = scan.angle_min;
+  free->angle_max = scan.angle_max;
+  free->angle_increment = scan.angle_increment;
+  free->time_increment = scan.time_increment;
+  free->scan_time = scan.scan_time;
+  free->range_min = scan.range_min;
+  free->range_max = scan.range_max;
+  free->intensities.clear();
+  inflate(scan, radius, &free->ranges);
+}
+
+// Free distance along a beam at theta from an obstacle of radius r at d
+static float calcReducedRange(float d, float r, float theta) {
+  float b = -2.0*d*cos(theta);
+  float c = d*d - r*r;
+
+  float discriminant = b*b - 4.0*c;
+  if (discriminant < 0.0) {
+    return 0.0;
+  }
+
+  float l = (-b-sqrt(discriminant)) / 2.0;
+  return (l>0.0) ? l : 0.0;
+}
+
+void ScanInflation::inflateBrute(const sensor_msgs::LaserScan &scan,
+                                 float radius, vector<float> *free) {
+  free->assign(scan.ranges.begin(), scan.ranges.end());
+  vector<float>::const_iterator it_input;
+  vector<float>::iterator it;
+  for (it_input=scan.ranges.begin(), it=free->begin();
+       it_input!=scan.ranges.end(); ++it_input, ++it) {
+    float scan_dist = *it_input;
+    if (!(scan.range_min <= scan_dist && scan_dist <= scan.range_max)) {
+      continue;
+    }
+    float r = min(radius, scan_dist-0.001f);
+    float phi = asin(r / scan_dist);
+    float dTheta = scan.angle_increment;
+    float theta = 0.0;
+
+    vector<float>::iterator it_f=it;
+    while (!(it_f==free->begin() || theta-dTheta<=-phi)) {
+      it_f--;
+      theta -= dTheta;
+    }
+
+    while (it_f!=free->end() && theta+dTheta<=phi) {
+      float l = calcReducedRange(scan_dist, r, theta);
+      if (l < *it_f) {
+        *it_f = l;
+      }
+      if (*it_f < 0.0) {
+        *it_f = 0.0;
+      }
+      it_f++;
+      theta += dTheta;
+    }
+  }
+}
+
+} // end namespace scarab
@@ -0,0 +1,64 @@
+#ifndef SCAN_INFLATION_HPP
+#define SCAN_INFLATION_HPP
+
+#include <vector>
+
+#include <sensor_msgs/LaserScan.h>
+
+namespace scarab {
+
+// Free distance along each beam of a laser scan once every valid range is
+// inflated to a disk the size of the robot, i.e. the distance along the beam
+// to the nearest of those disks, or its own range if it meets none.
+class ScanInflation {
+public:
+  ScanInflation();
+
+  // Write the free distances of scan for obstacles of radius into free.
+  // Obstacles are added nearest first, so the free distances drop early and
+  // most blocks of beams in the window of later obstacles are rejected by
+  // comparing the largest free distance in the block against the obstacle's
+  // nearest point, then against the obstacle at the block's beam nearest
+  // it.  Windows and distances come from tables of the sine and cosine of
+  // each beam offset, kept for the scan geometry.
+  void inflate(const sensor_msgs::LaserScan &scan, float radius,
+               std::vector<float> *free);
+  // As above, into a scan with the header and geometry of scan but no
+  // intensities.  Reusing free, nothing is allocated once it has held a
+  // scan of the same size and frame.
+  void inflate(const sensor_msgs::LaserScan &scan, float radius,
+               sensor_msgs::LaserScan *free);
+
+  // Original version, walking the full window of every obstacle and
+  // recomputing its trigonometry per beam
+  static void inflateBrute(const sensor_msgs::LaserScan &scan, float radius,
+                           std::vector<float> *free);
+
+private:
+  enum { BLOCK_SIZE = 32 };
+
+  void updateTables(float angle_increment, size_t size);
+  // Largest of free[begin] to free[end - 1] and largest, skipping NaN
+  static float largest(const float *free, int begin, int end, float largest);
+
+  float angle_increment_;
+  // Sine of each beam offset from 0 to the scan size, 2 from a right angle
+  // on, and the cosine and squared sine of offsets from minus to plus the
+  // scan size, at cos_[size + offset]
+  std::vector<float> sin_, cos_, sin2_;
+  // First offset whose sine is at least q / size, to start the search for
+  // the window of an obstacle without taking its arcsine
+  std::vector<int> first_;
+  // Distance to the nearest point of the obstacle of each valid beam, -1 for
+  // the others, and the valid beams roughly by that distance at the start
+  // of order_, which holds a whole scan so it never reallocates
+  std::vector<float> near_;
+  std::vector<int> bucket_start_, order_;
+  // Largest free distance in each block
+  std::vector<float> block_max_;
+  // Windows starting minus windows ending at each beam
+  std::vector<int> covered_;
+};
+
+} // end namespace scarab
+#endif
@@ -0,0 +1,327 @@
+#include "scan_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// As in cost_kernels.cpp, the AVX and AVX2 kernels are compiled for those
+// targets alone and only called after checking the CPU
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCARAB_SCAN_AVX
+#include <immintrin.h>
+#endif
+
+using namespace std;
+namespace scarab {
+
+BeamAngles::BeamAngles() : angle_min_(0.0f), angle_increment_(0.0f) {
+
+}
+
+void BeamAngles::update(float angle_min, float angle_increment,
+                        size_t size) {
+  if (angle_min == angle_min_ && angle_increment == angle_increment_ &&
+      size == cos_.size()) {
+    return;
+  }
+  angle_min_ = angle_min;
+  angle_increment_ = angle_increment;
+  cos_.resize(size);
+  sin_.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    double a = angle_min + i * double(angle_increment);
+    cos_[i] = std::cos(a);
+    sin_[i] = std::sin(a);
+  }
+}
+
+float reduceRangesScalar(float d, float r, const float *cos_offset,
+                         const float *sin2_offset, int n, float *free) {
+  float r2 = r * r, d2 = d * d;
+  float free_max = -numeric_limits<float>::infinity();
+  for (int k = 0; k < n; ++k) {
+    float l = d * cos_offset[k] - sqrt(max(r2 - d2 * sin2_offset[k], 0.0f));
+    free[k] = min(free[k], l);
+    if (free[k] > free_max) {
+      free_max = free[k];
+    }
+  }
+  return free_max;
+}
+
+void projectRangesScalar(const float *ranges, const float *cos_angle,
+                         const float *sin_angle, int n, float *x, float *y) {
+  for (int k = 0; k < n; ++k) {
+    x[k] = ranges[k] * cos_angle[k];
+    y[k] = ranges[k] * sin_angle[k];
+  }
+}
+
+// Continue a search for the nearest point from index begin
+static int nearestPointFrom(const float *xs, const float *ys, int begin,
+                            int n, float x, float y, int best,
+                            float best_dist) {
+  for (int k = begin; k < n; ++k) {
+    float dx = xs[k] - x, dy = ys[k] - y;
+    float dist = dx * dx + dy * dy;
+    if (dist < best_dist) {
+      best = k;
+      best_dist = dist;
+    }
+  }
+  return best;
+}
+
+int nearestPointScalar(const float *xs, const float *ys, int n, float x,
+                       float y) {
+  return nearestPointFrom(xs, ys, 0, n, x, y, -1,
+                          numeric_limits<float>::infinity());
+}
+
+void rolloutArcsScalar(const float *chord, const float *half_angle,
+                       const float *cos_half, int n, const float *clearance,
+                       int nbeams, float angle_min, float angle_increment,
+                       int steps, int *hit) {
+  float inv_increment = 1.0f / angle_increment;
+  for (int j = 0; j < n; ++j) {
+    // sin(k a) / sin(a) for k - 1 and k
+    float u_prev = 0.0f, u = 1.0f;
+    hit[j] = steps + 1;
+    for (int k = 1; k <= steps; ++k) {
+      float range = chord[j] * u;
+      float t = (float(k) * half_angle[j] - angle_min) * inv_increment + 0.5f;
+      if (!(t >= 0.0f && t < float(nbeams) &&
+            range <= clearance[int(t)])) {
+        hit[j] = k;
+        break;
+      }
+      float u_next = 2.0f * cos_half[j] * u - u_prev;
+      u_prev = u;
+      u = u_next;
+    }
+  }
+}
+
+#ifdef SCARAB_SCAN_AVX
+// Same operations as the scalar versions, 8 beams at a time.  min_ps(a, b)
+// returns b unless a < b, as min(b, a) does.
+__attribute__((target("avx")))
+static float reduceRangesAvx(float d, float r, const float *cos_offset,
+                             const float *sin2_offset, int n, float *free) {
+  const __m256 v_d = _mm256_set1_ps(d);
+  const __m256 v_d2 = _mm256_set1_ps(d * d);
+  const __m256 v_r2 = _mm256_set1_ps(r * r);
+  const __m256 v_zero = _mm256_setzero_ps();
+  // max_ps(a, b) returns b unless a > b, so NaN free distances are skipped
+  // as by the scalar comparison
+  __m256 v_max = _mm256_set1_ps(-numeric_limits<float>::infinity());
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 q = _mm256_sub_ps(v_r2, _mm256_mul_ps(
+      v_d2, _mm256_loadu_ps(sin2_offset + k)));
+    __m256 l = _mm256_sub_ps(_mm256_mul_ps(v_d, _mm256_loadu_ps(cos_offset + k)),
+                             _mm256_sqrt_ps(_mm256_max_ps(q, v_zero)));
+    __m256 reduced = _mm256_min_ps(l, _mm256_loadu_ps(free + k));
+    _mm256_storeu_ps(free + k, reduced);
+    v_max = _mm256_max_ps(reduced, v_max);
+  }
+  if (k < n) {
+    // The last beams in the low lanes, leaving the rest alone
+    __m256i mask = _mm256_castps_si256(_mm256_cmp_ps(
+      _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f),
+      _mm256_set1_ps(float(n - k)), _CMP_LT_OQ));
+    __m256 q = _mm256_sub_ps(v_r2, _mm256_mul_ps(
+      v_d2, _mm256_maskload_ps(sin2_offset + k, mask)));
+    __m256 l = _mm256_sub_ps(
+      _mm256_mul_ps(v_d, _mm256_maskload_ps(cos_offset + k, mask)),
+      _mm256_sqrt_ps(_mm256_max_ps(q, v_zero)));
+    __m256 reduced = _mm256_min_ps(l, _mm256_maskload_ps(free + k, mask));
+    _mm256_maskstore_ps(free + k, mask, reduced);
+    v_max = _mm256_max_ps(_mm256_blendv_ps(v_max, reduced,
+                                           _mm256_castsi256_ps(mask)),
+                          v_max);
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, v_max);
+  float free_max = lanes[0];
+  for (int i = 1; i < 8; ++i) {
+    free_max = max(free_max, lanes[i]);
+  }
+  return free_max;
+}
+
+__attribute__((target("avx")))
+static void projectRangesAvx(const float *ranges, const float *cos_angle,
+                             const float *sin_angle, int n, float *x,
+                             float *y) {
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 range = _mm256_loadu_ps(ranges + k);
+    _mm256_storeu_ps(x + k, _mm256_mul_ps(range, _mm256_loadu_ps(cos_angle + k)));
+    _mm256_storeu_ps(y + k, _mm256_mul_ps(range, _mm256_loadu_ps(sin_angle + k)));
+  }
+  projectRangesScalar(ranges + k, cos_angle + k, sin_angle + k, n - k, x + k,
+                      y + k);
+}
+
+__attribute__((target("avx")))
+static int nearestPointAvx(const float *xs, const float *ys, int n, float x,
+                           float y) {
+  const float inf = numeric_limits<float>::infinity();
+  const __m256 v_x = _mm256_set1_ps(x);
+  const __m256 v_y = _mm256_set1_ps(y);
+  const __m256 v_eight = _mm256_set1_ps(8.0f);
+  // Best distance and index so far in each lane; indices are exact as floats
+  __m256 v_best_dist = _mm256_set1_ps(inf);
+  __m256 v_best = _mm256_set1_ps(-1.0f);
+  __m256 v_index = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f,
+                                  7.0f);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + k), v_x);
+    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + k), v_y);
+    __m256 dist = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    __m256 closer = _mm256_cmp_ps(dist, v_best_dist, _CMP_LT_OQ);
+    v_best_dist = _mm256_blendv_ps(v_best_dist, dist, closer);
+    v_best = _mm256_blendv_ps(v_best, v_index, closer);
+    v_index = _mm256_add_ps(v_index, v_eight);
+  }
+
+  // The lane with the smallest distance, and of those the smallest index
+  float dists[8], indices[8];
+  _mm256_storeu_ps(dists, v_best_dist);
+  _mm256_storeu_ps(indices, v_best);
+  int best = -1;
+  float best_dist = inf;
+  for (int lane = 0; lane < 8; ++lane) {
+    if (indices[lane] >= 0.0f &&
+        (dists[lane] < best_dist ||
+         (dists[lane] == best_dist && int(indices[lane]) < best))) {
+      best = int(indices[lane]);
+      best_dist = dists[lane];
+    }
+  }
+  return nearestPointFrom(xs, ys, k, n, x, y, best, best_dist);
+}
+
+// Eight arcs at a time, gathering the clearance of their beams
+__attribute__((target("avx2")))
+static void rolloutArcsAvx2(const float *chord, const float *half_angle,
+                            const float *cos_half, int n,
+                            const float *clearance, int nbeams,
+                            float angle_min, float angle_increment,
+                            int steps, int *hit) {
+  const __m256 v_angle_min = _mm256_set1_ps(angle_min);
+  const __m256 v_inv_increment = _mm256_set1_ps(1.0f / angle_increment);
+  const __m256 v_half = _mm256_set1_ps(0.5f);
+  const __m256 v_two = _mm256_set1_ps(2.0f);
+  const __m256 v_zero = _mm256_setzero_ps();
+  const __m256 v_nbeams = _mm256_set1_ps(float(nbeams));
+  const __m256 v_last = _mm256_set1_ps(float(nbeams - 1));
+  const __m256 v_none = _mm256_set1_ps(float(steps + 1));
+  int j = 0;
+  for (; j + 8 <= n; j += 8) {
+    const __m256 v_chord = _mm256_loadu_ps(chord + j);
+    const __m256 v_half_angle = _mm256_loadu_ps(half_angle + j);
+    const __m256 v_cos_half = _mm256_loadu_ps(cos_half + j);
+    __m256 u_prev = v_zero, u = _mm256_set1_ps(1.0f);
+    __m256 v_hit = v_none;
+    for (int k = 1; k <= steps; ++k) {
+      const __m256 v_k = _mm256_set1_ps(float(k));
+      __m256 range = _mm256_mul_ps(v_chord, u);
+      __m256 t = _mm256_add_ps(_mm256_mul_ps(
+        _mm256_sub_ps(_mm256_mul_ps(v_k, v_half_angle), v_angle_min),
+        v_inv_increment), v_half);
+      __m256 inside = _mm256_and_ps(_mm256_cmp_ps(t, v_zero, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(t, v_nbeams, _CMP_LT_OQ));
+      // Beams outside the scan are clamped for the gather and masked out
+      __m256i beam = _mm256_cvttps_epi32(
+        _mm256_min_ps(_mm256_max_ps(t, v_zero), v_last));
+      __m256 free = _mm256_and_ps(inside, _mm256_cmp_ps(
+        range, _mm256_i32gather_ps(clearance, beam, 4), _CMP_LE_OQ));
+      __m256 first = _mm256_andnot_ps(free, _mm256_cmp_ps(v_hit, v_none,
+                                                          _CMP_EQ_OQ));
+      v_hit = _mm256_blendv_ps(v_hit, v_k, first);
+      if (_mm256_movemask_ps(_mm256_cmp_ps(v_hit, v_none, _CMP_EQ_OQ)) == 0) {
+        break;
+      }
+      __m256 u_next = _mm256_sub_ps(
+        _mm256_mul_ps(_mm256_mul_ps(v_two, v_cos_half), u), u_prev);
+      u_prev = u;
+      u = u_next;
+    }
+    _mm256_storeu_si256((__m256i*)(hit + j), _mm256_cvttps_epi32(v_hit));
+  }
+  // GCC leaves this out before the tail call, which slows the SSE code of
+  // the caller after it several times over
+  _mm256_zeroupper();
+  rolloutArcsScalar(chord + j, half_angle + j, cos_half + j, n - j,
+                    clearance, nbeams, angle_min, angle_increment, steps,
+                    hit + j);
+}
+#endif
+
+bool haveAvxScanKernels() {
+#ifdef SCARAB_SCAN_AVX
+  static const bool have_avx = __builtin_cpu_supports("avx");
+  return have_avx;
+#else
+  return false;
+#endif
+}
+
+bool haveAvx2RolloutKernel() {
+#ifdef SCARAB_SCAN_AVX
+  static const bool have_avx2 = __builtin_cpu_supports("avx2");
+  return have_avx2;
+#else
+  return false;
+#endif
+}
+
+float reduceRanges(float d, float r, const float *cos_offset,
+                   const float *sin2_offset, int n, float *free) {
+#ifdef SCARAB_SCAN_AVX
+  if (haveAvxScanKernels()) {
+    return reduceRangesAvx(d, r, cos_offset, sin2_offset, n, free);
+  }
+#endif
+  return reduceRangesScalar(d, r, cos_offset, sin2_offset, n, free);
+}
+
+void projectRanges(const float *ranges, const float *cos_angle,
+                   const float *sin_angle, int n, float *x, float *y) {
+#ifdef SCARAB_SCAN_AVX
+  if (haveAvxScanKernels()) {
+    projectRangesAvx(ranges, cos_angle, sin_angle, n, x, y);
+    return;
+  }
+#endif
+  projectRangesScalar(ranges, cos_angle, sin_angle, n, x, y);
+}
+
+int nearestPoint(const float *xs, const float *ys, int n, float x, float y) {
+#ifdef SCARAB_SCAN_AVX
+  if (haveAvxScanKernels()) {
+    return nearestPointAvx(xs, ys, n, x, y);
+  }
+#endif
+  return nearestPointScalar(xs, ys, n, x, y);
+}
+
+void rolloutArcs(const float *chord, const float *half_angle,
+                 const float *cos_half, int n, const float *clearance,
+                 int nbeams, float angle_min, float angle_increment,
+                 int steps, int *hit) {
+#ifdef SCARAB_SCAN_AVX
+  if (nbeams > 0 && haveAvx2RolloutKernel()) {
+    rolloutArcsAvx2(chord, half_angle, cos_half, n, clearance, nbeams,
+                    angle_min, angle_increment, steps, hit);
+    return;
+  }
+#endif
+  rolloutArcsScalar(chord, half_angle, cos_half, n, clearance, nbeams,
+                    angle_min, angle_increment, steps, hit);
+}
+
+} // end namespace scarab
@@ -0,0 +1,72 @@
+#ifndef SCAN_KERNELS_HPP
+#define SCAN_KERNELS_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace scarab {
+
+// Cosine and sine of the angle of each beam of a laser scan, recomputed only
+// when the geometry changes
+class BeamAngles {
+public:
+  BeamAngles();
+  void update(float angle_min, float angle_increment, size_t size);
+
+  float angleMin() const { return angle_min_; }
+  float angleIncrement() const { return angle_increment_; }
+  size_t size() const { return cos_.size(); }
+  float angle(int i) const { return angle_min_ + i * angle_increment_; }
+  const float* cos() const { return &cos_[0]; }
+  const float* sin() const { return &sin_[0]; }
+
+private:
+  float angle_min_, angle_increment_;
+  std::vector<float> cos_, sin_;
+};
+
+// Shorten free[i] to the distance along beam i to an obstacle of radius r at
+// distance d, for n beams with cos_offset[i] and sin2_offset[i] the cosine
+// and squared sine of the angle between beam i and the obstacle.  Returns
+// the largest of the n free distances after, skipping NaN, or -infinity if
+// there are none.  Uses AVX where the CPU supports it; the results are
+// identical either way.
+float reduceRanges(float d, float r, const float *cos_offset,
+                   const float *sin2_offset, int n, float *free);
+// Points at ranges[i] along each of n beams
+void projectRanges(const float *ranges, const float *cos_angle,
+                   const float *sin_angle, int n, float *x, float *y);
+// Index of the point (xs[i], ys[i]) of n nearest (x, y), the first of any
+// ties, or -1 if no distance is finite
+int nearestPoint(const float *xs, const float *ys, int n, float x, float y);
+// Step, from 1 to steps, at which each of n arcs from the sensor first
+// leaves the free space, or steps + 1 if none does.  Arc j turns half_angle[j]
+// of chord angle per step and the chord of its first step is chord[j], so at
+// step k its point is at angle k half_angle[j] and distance chord[j]
+// sin(k half_angle[j]) / sin(half_angle[j]), taken by recurrence from
+// cos_half[j], the cosine of half_angle[j].  A point leaves the free space
+// if it is outside the beams or beyond the clearance of the nearest beam.
+// Uses AVX2 where the CPU supports it; the results are identical either way.
+void rolloutArcs(const float *chord, const float *half_angle,
+                 const float *cos_half, int n, const float *clearance,
+                 int nbeams, float angle_min, float angle_increment,
+                 int steps, int *hit);
+
+// Scalar versions, always available
+float reduceRangesScalar(float d, float r, const float *cos_offset,
+                         const float *sin2_offset, int n, float *free);
+void projectRangesScalar(const float *ranges, const float *cos_angle,
+                         const float *sin_angle, int n, float *x, float *y);
+int nearestPointScalar(const float *xs, const float *ys, int n, float x,
+                       float y);
+void rolloutArcsScalar(const float *chord, const float *half_angle,
+                       const float *cos_half, int n, const float *clearance,
+                       int nbeams, float angle_min, float angle_increment,
+                       int steps, int *hit);
+// True if the kernels above run AVX versions on this CPU
+bool haveAvxScanKernels();
+// True if rolloutArcs() runs its AVX2 version on this CPU
+bool haveAvx2RolloutKernel();
+
+} // end namespace scarab
+#endif
@@ -0,0 +1,149 @@
+#include "player_map/shared_map.hpp"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+using namespace std;
+namespace scarab {
+
+// The control page comes first so that the map stays page aligned
+static size_t controlSize() {
+  return sysconf(_SC_PAGESIZE);
+}
+
+SharedMapSegment::SharedMapSegment(const string &name, bool owner,
+                                   Control *control, size_t control_size,
+                                   map_t *map)
+  : name_(name), owner_(owner), writing_(false), control_(control),
+    control_size_(control_size),
+    header_(static_cast<map_file_header_t*>(map->mapping)),
+    extra_(static_cast<char*>(map->mapping) + map->mapping_size -
+           header_->extra_size) {
+}
+
+SharedMapSegment::~SharedMapSegment() {
+  if (owner_) {
+    __atomic_store_n(&control_->stale, 1, __ATOMIC_RELEASE);
+    shm_unlink(name_.c_str());
+  }
+  munmap(control_, control_size_);
+}
+
+void SharedMapSegment::replace(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    return;
+  }
+  void *control = mmap(NULL, controlSize(), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  if (control != MAP_FAILED) {
+    __atomic_store_n(&static_cast<Control*>(control)->stale, 1,
+                     __ATOMIC_RELEASE);
+    munmap(control, controlSize());
+  }
+  close(fd);
+  shm_unlink(name);
+}
+
+SharedMapSegment* SharedMapSegment::create(const char *name, map_t *map,
+                                           map_file_header_t *header,
+                                           const void *extra) {
+  replace(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    ROS_ERROR("SharedMapSegment: Failed to create %s", name);
+    return NULL;
+  }
+  size_t control_size = controlSize();
+  Control *control = NULL;
+  const void *mapped_extra;
+  map_file_header_t mapped_header;
+  if (ftruncate(fd, control_size) != 0 ||
+      lseek(fd, control_size, SEEK_SET) < 0 ||
+      map_write_fd(map, fd, header, extra) != 0 ||
+      (control = static_cast<Control*>(
+         mmap(NULL, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+              0))) == MAP_FAILED ||
+      map_open_fd(map, fd, control_size, MAP_OPEN_SHARED_WRITE,
+                  &mapped_header, &mapped_extra) != 0) {
+    ROS_ERROR("SharedMapSegment: Failed to write %s", name);
+    if (control != NULL && control != MAP_FAILED) {
+      munmap(control, control_size);
+    }
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  close(fd);
+  return new SharedMapSegment(name, true, control, control_size, map);
+}
+
+SharedMapSegment* SharedMapSegment::attach(const char *name, map_t *map) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  size_t control_size = controlSize();
+  const void *extra;
+  map_file_header_t header;
+  void *control = mmap(NULL, control_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (control == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  if (map_open_fd(map, fd, control_size, MAP_OPEN_SHARED_READ, &header,
+                  &extra) != 0) {
+    ROS_ERROR("SharedMapSegment: %s does not hold a map", name);
+    munmap(control, control_size);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+  return new SharedMapSegment(name, false, static_cast<Control*>(control),
+                              control_size, map);
+}
+
+void SharedMapSegment::beginWrite() {
+  if (writing_) {
+    return;
+  }
+  writing_ = true;
+  uint32_t sequence = __atomic_load_n(&control_->sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&control_->sequence, sequence + 1, __ATOMIC_RELAXED);
+  // Readers must see the odd sequence before any of the writes
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void SharedMapSegment::endWrite() {
+  if (!writing_) {
+    return;
+  }
+  writing_ = false;
+  uint32_t sequence = __atomic_load_n(&control_->sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&control_->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t SharedMapSegment::readBegin() const {
+  uint32_t sequence;
+  // A stale segment is not written again, even if its owner died writing
+  while ((sequence = __atomic_load_n(&control_->sequence,
+                                     __ATOMIC_ACQUIRE)) & 1 && !stale()) {
+    sched_yield();
+  }
+  return sequence;
+}
+
+bool SharedMapSegment::readRetry(uint32_t sequence) const {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&control_->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+bool SharedMapSegment::stale() const {
+  return __atomic_load_n(&control_->stale, __ATOMIC_ACQUIRE) != 0;
+}
+
+} // end namespace scarab
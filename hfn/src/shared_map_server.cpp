@@ -0,0 +1,82 @@
+// Keep the map from the map topic, with its cspace and costs, in shared
+// memory for the nodes on this machine to attach to (see the shared_map
+// parameter of hfn and kinematic_sim) instead of each computing their own.
+//
+//   rosrun hfn shared_map_server [_name:=/scarab_map] [_cspace_file:=<file>]
+//     [_max_occ_dist:=0.5] [_lethal_occ_dist:=0.23] [_cost_occ_prob:=0.0]
+//     [_cost_occ_dist:=0.0] [_free_threshold:=0] [_occupied_threshold:=100]
+//
+// The cspace parameters must cover those of every node attaching.
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <ros/ros.h>
+
+#include <nav_msgs/OccupancyGrid.h>
+
+#include "player_map/rosmap.hpp"
+
+using namespace std;
+
+class SharedMapServer {
+public:
+  explicit SharedMapServer(ros::NodeHandle &nh) {
+    nh.param("name", name_, string("/scarab_map"));
+    nh.param("max_occ_dist", max_occ_dist_, 0.5);
+    nh.param("lethal_occ_dist", lethal_occ_dist_, 0.23);
+    nh.param("cost_occ_prob", cost_occ_prob_, 0.0);
+    nh.param("cost_occ_dist", cost_occ_dist_, 0.0);
+    int free_threshold, occupied_threshold;
+    nh.param("free_threshold", free_threshold, 0);
+    nh.param("occupied_threshold", occupied_threshold, 100);
+    string cspace_file;
+    nh.param("cspace_file", cspace_file, string(""));
+
+    // Share a saved cspace until the map arrives, if it was made with the
+    // same parameters
+    if (!cspace_file.empty()) {
+      map_.reset(scarab::OccupancyMap::FromFile(cspace_file.c_str()));
+      if (map_ && (map_->freeThreshold() != free_threshold ||
+                   map_->occupiedThreshold() != occupied_threshold ||
+                   map_->maxOccDist() != max_occ_dist_ ||
+                   map_->lethalOccDist() != lethal_occ_dist_ ||
+                   map_->costOccProb() != cost_occ_prob_ ||
+                   map_->costOccDist() != cost_occ_dist_)) {
+        ROS_WARN("SharedMapServer: %s was made with different parameters",
+                 cspace_file.c_str());
+        map_.reset();
+      }
+    }
+    if (!map_) {
+      map_.reset(new scarab::OccupancyMap());
+      map_->setThresholds(free_threshold, occupied_threshold);
+    }
+    map_->share(name_.c_str());
+    map_sub_ = nh_.subscribe("map", 1, &SharedMapServer::onMap, this);
+  }
+
+  void onMap(const nav_msgs::OccupancyGrid &grid) {
+    ros::WallTime start = ros::WallTime::now();
+    map_->setMap(grid);
+    map_->updateCSpace(max_occ_dist_, lethal_occ_dist_, cost_occ_prob_,
+                       cost_occ_dist_);
+    ROS_DEBUG("SharedMapServer: Updated %s in %.3f s", name_.c_str(),
+              (ros::WallTime::now() - start).toSec());
+  }
+
+private:
+  ros::NodeHandle nh_;
+  ros::Subscriber map_sub_;
+  boost::scoped_ptr<scarab::OccupancyMap> map_;
+  string name_;
+  double max_occ_dist_, lethal_occ_dist_, cost_occ_prob_, cost_occ_dist_;
+};
+
+int main(int argc, char **argv) {
+  ros::init(argc, argv, "shared_map_server");
+  ros::NodeHandle nh("~");
+  SharedMapServer server(nh);
+  ros::spin();
+  return 0;
+}
@@ -0,0 +1,296 @@
+#include "player_map/tiled_map.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <ros/ros.h>
+
+#include "player_map/cost_kernels.hpp"
+#include "player_map/rosmap.hpp"
+
+using namespace std;
+namespace scarab {
+
+TiledMap::TiledMap(double scale, double origin_x, double origin_y)
+  : scale_(scale), origin_x_(origin_x), origin_y_(origin_y),
+    min_i_(0), min_j_(0), max_i_(0), max_j_(0),
+    tile_min_x_(0), tile_min_y_(0), tiles_x_(0), tiles_y_(0), num_tiles_(0),
+    max_occ_dist_(0.0), lethal_occ_dist_(0.0), cost_occ_prob_(0.0),
+    cost_occ_dist_(0.0), map_max_occ_dist_(0.0) {
+  // Unknown cells before the cspace is computed, as convertMap() leaves them
+  fill(unknown_.cost, unknown_.cost + TILE_CELLS, 0.0f);
+  fill(unknown_.occ_dist, unknown_.occ_dist + TILE_CELLS, 0);
+  fill(unknown_.occ_state, unknown_.occ_state + TILE_CELLS,
+       uint8_t(map_cell_t::UNKNOWN));
+  fill(unknown_.occ_prob, unknown_.occ_prob + TILE_CELLS, -1);
+  unknown_.dirty = false;
+}
+
+TiledMap::~TiledMap() {
+  for (size_t k = 0; k < tiles_.size(); ++k) {
+    delete tiles_[k];
+  }
+}
+
+int TiledMap::cellX(double x) const {
+  return floor((x - origin_x_) / scale_ + 0.5);
+}
+
+int TiledMap::cellY(double y) const {
+  return floor((y - origin_y_) / scale_ + 0.5);
+}
+
+map_cell_t TiledMap::cell(int i, int j) const {
+  const Tile &t = tile(i, j);
+  int k = offset(i, j);
+  map_cell_t cell;
+  cell.occ_state = t.occ_state[k];
+  cell.occ_prob = t.occ_prob[k];
+  cell.occ_dist = t.occ_dist[k] == MAP_DIST_MAX ? map_max_occ_dist_ :
+    scale_ * sqrt(double(t.occ_dist[k]));
+  cell.cost = t.cost[k];
+  return cell;
+}
+
+size_t TiledMap::bytes() const {
+  return num_tiles_ * sizeof(Tile) + tiles_.capacity() * sizeof(Tile*);
+}
+
+void TiledMap::growTo(int ti, int tj) {
+  int min_x = tile_min_x_, min_y = tile_min_y_;
+  int max_x = tile_min_x_ + tiles_x_, max_y = tile_min_y_ + tiles_y_;
+  if (tiles_.empty()) {
+    min_x = max_x = ti;
+    min_y = max_y = tj;
+  }
+  // Leave room to grow further in the same direction
+  int slack_x = max(1, tiles_x_ / 2), slack_y = max(1, tiles_y_ / 2);
+  if (ti < min_x) {
+    min_x = ti - slack_x;
+  } else if (ti >= max_x) {
+    max_x = ti + 1 + slack_x;
+  }
+  if (tj < min_y) {
+    min_y = tj - slack_y;
+  } else if (tj >= max_y) {
+    max_y = tj + 1 + slack_y;
+  }
+
+  vector<Tile*> tiles(size_t(max_x - min_x) * (max_y - min_y), NULL);
+  for (int y = 0; y < tiles_y_; ++y) {
+    for (int x = 0; x < tiles_x_; ++x) {
+      tiles[(x + tile_min_x_ - min_x) + (y + tile_min_y_ - min_y) *
+            (max_x - min_x)] = tiles_[x + y * tiles_x_];
+    }
+  }
+  tiles_.swap(tiles);
+  tile_min_x_ = min_x;
+  tile_min_y_ = min_y;
+  tiles_x_ = max_x - min_x;
+  tiles_y_ = max_y - min_y;
+}
+
+TiledMap::Tile* TiledMap::writableTile(int ti, int tj) {
+  if (ti < tile_min_x_ || ti >= tile_min_x_ + tiles_x_ ||
+      tj < tile_min_y_ || tj >= tile_min_y_ + tiles_y_) {
+    growTo(ti, tj);
+  }
+  Tile *&t = tiles_[(ti - tile_min_x_) + (tj - tile_min_y_) * tiles_x_];
+  if (t == NULL) {
+    t = new Tile(unknown_);
+    ++num_tiles_;
+  }
+  return t;
+}
+
+void TiledMap::setCell(int i, int j, uint8_t occ_state, int8_t occ_prob) {
+  Tile *t = writableTile(i >> TILE_BITS, j >> TILE_BITS);
+  int k = offset(i, j);
+  if (t->occ_state[k] != occ_state || t->occ_prob[k] != occ_prob) {
+    t->occ_state[k] = occ_state;
+    t->occ_prob[k] = occ_prob;
+    t->dirty = true;
+  }
+  if (min_i_ >= max_i_) {
+    min_i_ = max_i_ = i;
+    min_j_ = max_j_ = j;
+  }
+  min_i_ = min(min_i_, i);
+  min_j_ = min(min_j_, j);
+  max_i_ = max(max_i_, i + 1);
+  max_j_ = max(max_j_, j + 1);
+}
+
+bool TiledMap::setGrid(const nav_msgs::OccupancyGrid &grid,
+                       int free_threshold /* = 0 */,
+                       int occupied_threshold /* = 100 */) {
+  if (fabs(grid.info.resolution - scale_) > 1e-6 * scale_) {
+    ROS_ERROR("TiledMap::setGrid() Resolution %f differs from %f",
+              grid.info.resolution, scale_);
+    return false;
+  }
+  int i0 = cellX(grid.info.origin.position.x);
+  int j0 = cellY(grid.info.origin.position.y);
+  for (unsigned gj = 0; gj < grid.info.height; ++gj) {
+    for (unsigned gi = 0; gi < grid.info.width; ++gi) {
+      int8_t value = grid.data[gi + gj * grid.info.width];
+      int i = i0 + gi, j = j0 + gj;
+      // Unknown cells already read as unknown without a tile
+      if (value == -1 && !allocated(i, j)) {
+        continue;
+      }
+      setCell(i, j, convertState(value, free_threshold, occupied_threshold),
+              value);
+    }
+  }
+  return true;
+}
+
+void TiledMap::computeTile(int ti, int tj, int margin, map_t *scratch,
+                           Tile *out) const {
+  // Gather the occupancy of the window a tile row at a time
+  int wmin_i = (ti << TILE_BITS) - margin, wmin_j = (tj << TILE_BITS) - margin;
+  for (int y = 0; y < scratch->size_y; ++y) {
+    int j = wmin_j + y;
+    for (int x = 0; x < scratch->size_x; ) {
+      int i = wmin_i + x;
+      int run = min(scratch->size_x - x, TILE_SIZE - (i & (TILE_SIZE - 1)));
+      memcpy(scratch->occ_state + MAP_INDEX(scratch, x, y),
+             tile(i, j).occ_state + offset(i, j), run);
+      x += run;
+    }
+  }
+  map_update_cspace_region(scratch, margin, margin, margin + TILE_SIZE,
+                           margin + TILE_SIZE);
+
+  const Tile &in = tile(ti << TILE_BITS, tj << TILE_BITS);
+  memcpy(out->occ_state, in.occ_state, sizeof(out->occ_state));
+  memcpy(out->occ_prob, in.occ_prob, sizeof(out->occ_prob));
+  for (int y = 0; y < TILE_SIZE; ++y) {
+    memcpy(out->occ_dist + (y << TILE_BITS),
+           scratch->occ_dist + MAP_INDEX(scratch, margin, margin + y),
+           TILE_SIZE * sizeof(uint16_t));
+  }
+  CostParams params = makeCostParams(scale_, map_max_occ_dist_, max_occ_dist_,
+                                     lethal_occ_dist_, cost_occ_prob_,
+                                     cost_occ_dist_);
+  computeCosts(params, out->occ_state, out->occ_prob, out->occ_dist,
+               TILE_CELLS, out->cost);
+  out->dirty = false;
+}
+
+void TiledMap::updateCSpace(double max_occ_dist, double lethal_occ_dist,
+                            double cost_occ_prob /* = 0.0 */,
+                            double cost_occ_dist /* = 0.0 */) {
+  if (max_occ_dist < lethal_occ_dist) {
+    ROS_ERROR("max_occ_dist must be at least lethal_occ_dist");
+    return;
+  }
+  bool all = max_occ_dist != max_occ_dist_ ||
+    lethal_occ_dist != lethal_occ_dist_ || cost_occ_prob != cost_occ_prob_ ||
+    cost_occ_dist != cost_occ_dist_;
+  max_occ_dist_ = max_occ_dist;
+  lethal_occ_dist_ = lethal_occ_dist;
+  cost_occ_prob_ = cost_occ_prob;
+  cost_occ_dist_ = cost_occ_dist;
+
+  // Window around a tile holding every obstacle within max_occ_dist of it
+  map_t *scratch = map_alloc();
+  ROS_ASSERT(scratch);
+  scratch->scale = scale_;
+  map_set_max_occ_dist(scratch, max_occ_dist);
+  map_max_occ_dist_ = scratch->max_occ_dist;
+  int margin = ceil(map_max_occ_dist_ / scale_);
+  if (map_alloc_cells(scratch, TILE_SIZE + 2 * margin,
+                      TILE_SIZE + 2 * margin) != 0) {
+    ROS_ERROR("TiledMap::updateCSpace() Failed to allocate scratch map");
+    ROS_BREAK();
+  }
+
+  // Unknown cells far from obstacles
+  fill(unknown_.occ_dist, unknown_.occ_dist + TILE_CELLS,
+       uint16_t(MAP_DIST_MAX));
+  CostParams params = makeCostParams(scale_, map_max_occ_dist_, max_occ_dist,
+                                     lethal_occ_dist, cost_occ_prob,
+                                     cost_occ_dist);
+  computeCosts(params, unknown_.occ_state, unknown_.occ_prob,
+               unknown_.occ_dist, TILE_CELLS, unknown_.cost);
+
+  // Changed tiles and those within reach of their obstacles
+  int reach = (margin + TILE_SIZE - 1) / TILE_SIZE;
+  vector<pair<int, int> > update;
+  for (int y = 0; y < tiles_y_; ++y) {
+    for (int x = 0; x < tiles_x_; ++x) {
+      const Tile *t = tiles_[x + y * tiles_x_];
+      if (t == NULL || (!all && !t->dirty)) {
+        continue;
+      }
+      for (int dy = -reach; dy <= reach; ++dy) {
+        for (int dx = -reach; dx <= reach; ++dx) {
+          update.push_back(make_pair(tile_min_y_ + y + dy,
+                                     tile_min_x_ + x + dx));
+        }
+      }
+    }
+  }
+  sort(update.begin(), update.end());
+  update.erase(unique(update.begin(), update.end()), update.end());
+
+  // Compute into scratch tiles first, as neighbors read the old occupancy
+  // only, then keep the results that are not all unknown
+  Tile *result = new Tile;
+  size_t written = 0;
+  for (size_t k = 0; k < update.size(); ++k) {
+    int ti = update[k].second, tj = update[k].first;
+    computeTile(ti, tj, margin, scratch, result);
+    if (findTile(ti, tj) == NULL &&
+        memcmp(result->occ_dist, unknown_.occ_dist,
+               sizeof(result->occ_dist)) == 0) {
+      continue;
+    }
+    Tile *t = writableTile(ti, tj);
+    ++written;
+    memcpy(t->cost, result->cost, sizeof(t->cost));
+    memcpy(t->occ_dist, result->occ_dist, sizeof(t->occ_dist));
+  }
+  // Occupancy was not written above, so clearing the flags afterwards is safe
+  for (size_t k = 0; k < tiles_.size(); ++k) {
+    if (tiles_[k] != NULL) {
+      tiles_[k]->dirty = false;
+    }
+  }
+  delete result;
+  map_free(scratch);
+  ROS_DEBUG("TiledMap::updateCSpace() Updated %zu of %zu tiles in reach, "
+            "%zu tiles in all", written, update.size(), num_tiles_);
+}
+
+void TiledMap::extract(int min_i, int min_j, int max_i, int max_j,
+                       map_t *map) const {
+  if (map_alloc_cells(map, max_i - min_i, max_j - min_j) != 0) {
+    ROS_ERROR("TiledMap::extract() Failed to allocate %d x %d map",
+              max_i - min_i, max_j - min_j);
+    ROS_BREAK();
+  }
+  map->scale = scale_;
+  map->origin_x = worldX(min_i) + (map->size_x / 2) * scale_;
+  map->origin_y = worldY(min_j) + (map->size_y / 2) * scale_;
+  map->max_occ_dist = map_max_occ_dist_;
+  for (int y = 0; y < map->size_y; ++y) {
+    int j = min_j + y;
+    for (int x = 0; x < map->size_x; ) {
+      int i = min_i + x;
+      int run = min(map->size_x - x, TILE_SIZE - (i & (TILE_SIZE - 1)));
+      const Tile &t = tile(i, j);
+      int k = offset(i, j), index = MAP_INDEX(map, x, y);
+      memcpy(map->cost + index, t.cost + k, run * sizeof(float));
+      memcpy(map->occ_dist + index, t.occ_dist + k, run * sizeof(uint16_t));
+      memcpy(map->occ_state + index, t.occ_state + k, run);
+      memcpy(map->occ_prob + index, t.occ_prob + k, run);
+      x += run;
+    }
+  }
+}
+
+} // end namespace scarab
@@ -19,6 +19,12 @@
 
 using namespace std;
 
+// Cspace the sim computes for maps it loads itself.  Its position checks
+// read only distances to obstacles, never costs, so any lethal distance
+// serves on a map it attaches to.
+static const double SIM_MAX_OCC_DIST = 0.2;
+static const double SIM_LETHAL_OCC_DIST = 0.05;
+
 ////////////////////////////////////////////////////////////////////////////////
 // The class for the driver
 class KinematicSimAgent
@@ -91,10 +97,33 @@ public:
     node_->param("pub_global_frame", pub_global_frame_, false);
 
     bool use_map;
+    string map_file, shared_map;
     node_->param("use_map", use_map, false);
+    node_->param("map_file", map_file, string(""));
+    node_->param("shared_map", shared_map, string(""));
     if (use_map) {
-      map_.reset(scarab::OccupancyMap::FromMapServer("/static_map"));
-      map_->updateCSpace(0.2, 0.05);
+      // The map of hfn's shared_map_server or a cspace file from its
+      // make_cspace saves computing the cspace here
+      if (!shared_map.empty()) {
+        map_.reset(scarab::OccupancyMap::Attach(shared_map.c_str()));
+      }
+      if (map_) {
+        // Attached maps are read only, so the sim uses hfn's cspace as is
+        if (map_->maxOccDist() < SIM_MAX_OCC_DIST) {
+          ROS_WARN("%s: Shared map %s has max_occ_dist %.2f, below the %.2f "
+                   "the sim needs; obstacles further than that look closer",
+                   ros::this_node::getName().c_str(), shared_map.c_str(),
+                   map_->maxOccDist(), SIM_MAX_OCC_DIST);
+        }
+      } else {
+        if (!map_file.empty()) {
+          map_.reset(scarab::OccupancyMap::FromFile(map_file.c_str()));
+        }
+        if (!map_) {
+          map_.reset(scarab::OccupancyMap::FromMapServer("/static_map"));
+        }
+        map_->updateCSpace(SIM_MAX_OCC_DIST, SIM_LETHAL_OCC_DIST);
+      }
     }
 
     // ensure that frame id begins with / character
@@ -266,6 +295,7 @@ public:
 
     // If using a map, get closest valid position
     if (map_ != NULL) {
+      map_->sync();
       double new_x, new_y;
       if (map_->nearestPoint(this->x, this->y, 0.3, &new_x, &new_y)) {
         if (this->x != new_x || this->y != new_y) {